@@ -11,12 +11,16 @@
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_pkt.h"
 
 void send_icmp_to_packets(struct sr_instance *sr, struct sr_arpreq *request) {
 	struct sr_packet *packet;
+	struct sr_pkt pkt;
 
 	for (packet = request->packets; packet != NULL; packet = packet->next) {
-		sr_send_icmp_packet(sr, (sr_ip_hdr_t *)(packet->buf + sizeof(sr_ethernet_hdr_t)),
+		/* queued frames are IP ones the router built or forwarded */
+		sr_pkt_parse(&pkt, packet->buf, packet->len, NULL);
+		sr_send_icmp_packet(sr, &pkt,
 		ICMP_DEST_UNREACHABLE, ICMP_DEST_HOST_UNREACHABLE_CODE);
 		
 	}
@@ -26,12 +30,13 @@ void send_arp_requests(struct sr_instance *sr, struct sr_arpreq *request) {
 	struct sr_packet *packet;
 	
 	for (packet = request->packets; packet != NULL; packet = packet->next) {
-		struct sr_if *interface = sr_get_interface(sr, packet->iface);
-		send_arp_request(sr, request, interface);
+		send_arp_request(sr, request, packet->iface);
 	}
 }
 
-void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request) {
+/* Returns 1 if an ARP request went out, -1 if request was given up on
+   (and freed), 0 if it is not due yet. */
+int handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request) {
 	time_t now = time(NULL);
 	
 	if (difftime(now, request->sent) > 1.0) {
@@ -39,12 +44,13 @@ void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request) {
 			send_icmp_to_packets(sr, request);
 			/* Delete the request from entry table */
 			sr_arpreq_destroy(&sr->cache, request);
+			return -1;
 			
 		} else {
 			/* ARP reply if the target IP address is one of your router’s IP addresses. In the case of an ARP reply, you should only cache the entry if the target IP address is one of your router’s IP addresses.
 			Note that ARP requests are sent to the broadcast MAC address (ff-ff-ff-ff-ff-ff). ARP replies are sent directly to the requester’s MAC address.*/
 			
-			struct sr_if *interface = sr_get_interface(sr, (request->packets)->iface);
+			struct sr_if *interface = (request->packets)->iface;
 			
 			pthread_mutex_lock(&((sr->cache).lock));
 			
@@ -53,8 +59,30 @@ void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request) {
 			time ( &request->sent );
 			
 			pthread_mutex_unlock(&((sr->cache).lock));
+			return 1;
 		}
 	}
+	return 0;
+}
+
+/* Queue a frame waiting on ip and send the ARP request for it if one is
+   due, all under the request lock.  Once that lock is dropped a request
+   can be answered and freed by another thread (the reply for ip need
+   not land on the worker that queued the frame), so the sr_arpreq never
+   leaves here.  Returns what handle_arpreq did. */
+int sr_arpcache_queuereq_send(struct sr_instance *sr, uint32_t ip,
+                              struct sr_pbuf *pb, struct sr_if *iface) {
+	struct sr_arpreq *request;
+	int ret;
+	
+	pthread_mutex_lock(&((sr->cache).lock));
+	
+	request = sr_arpcache_queuereq_pbuf(&sr->cache, ip, pb, iface);
+	ret = handle_arpreq(sr, request);
+	
+	pthread_mutex_unlock(&((sr->cache).lock));
+	
+	return ret;
 }
 
 /* 
@@ -85,32 +113,257 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr) {
 
 /* You should not need to touch the rest of this code. */
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+/* Hash an IP (any byte order) to a slot. The finalizer from MurmurHash3
+   spreads neighbors on one subnet across the whole table. */
+static unsigned int sr_arpcache_hash(uint32_t ip, unsigned int size) {
+    ip ^= ip >> 16;
+    ip *= 0x85ebca6b;
+    ip ^= ip >> 13;
+    ip *= 0xc2b2ae35;
+    ip ^= ip >> 16;
+    return ip & (size - 1);
+}
+
+/* Returns the slot holding ip, or -1. Caller holds the table lock. */
+static int sr_arpcache_find(struct sr_arpcache *cache, uint32_t ip) {
+    unsigned int mask = cache->size - 1;
+    unsigned int i = sr_arpcache_hash(ip, cache->size);
+    unsigned int probes;
+    
+    for (probes = 0; probes < cache->size; probes++, i = (i + 1) & mask) {
+        struct sr_arpentry *entry = &(cache->entries[i]);
+        if (entry->valid == arp_slot_empty)
+            break;
+        if ((entry->valid == arp_slot_valid) && (entry->ip == ip))
+            return i;
+    }
+    
+    return -1;
+}
+
+static void sr_arpcache_lru_unlink(struct sr_arpcache *cache, int i) {
+    struct sr_arpentry *entry = &(cache->entries[i]);
     
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+    if (entry->lru_prev >= 0)
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
     
+    if (entry->lru_next >= 0)
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+}
+
+static void sr_arpcache_lru_push(struct sr_arpcache *cache, int i) {
+    struct sr_arpentry *entry = &(cache->entries[i]);
+    
+    entry->lru_prev = -1;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head >= 0)
+        cache->entries[cache->lru_head].lru_prev = i;
+    else
+        cache->lru_tail = i;
+    cache->lru_head = i;
+}
+
+/* Takes slot i out of the table, leaving a tombstone. Entries never move,
+   so callers may keep walking the LRU list from a saved next index. */
+static void sr_arpcache_remove(struct sr_arpcache *cache, int i) {
+    sr_arpcache_lru_unlink(cache, i);
+    cache->entries[i].valid = arp_slot_deleted;
+    cache->count--;
+}
+
+/* Claims the first free slot for ip, which must not already be cached. */
+static int sr_arpcache_claim(struct sr_arpcache *cache, uint32_t ip) {
+    unsigned int mask = cache->size - 1;
+    unsigned int i = sr_arpcache_hash(ip, cache->size);
+    
+    while (cache->entries[i].valid == arp_slot_valid)
+        i = (i + 1) & mask;
+    
+    if (cache->entries[i].valid == arp_slot_empty)
+        cache->used++;
+    cache->entries[i].valid = arp_slot_valid;
+    cache->entries[i].ip = ip;
+    cache->entries[i].referenced = 0;
+    cache->count++;
+    sr_arpcache_lru_push(cache, i);
+    
+    return i;
+}
+
+/* Rehashes into a table of size slots, dropping tombstones. The LRU order
+   is kept by reinserting from the tail. A bigger table is built in a new
+   array and the old one retired; the same size is rebuilt in place, so a
+   reader never sees an array smaller than the size it read. Returns 0 on
+   success. */
+static int sr_arpcache_resize(struct sr_arpcache *cache, unsigned int size) {
+    struct sr_arpcache_retired *retired = NULL;
+    struct sr_arpentry *old;
     int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+    
+    if (size > cache->size) {
+        struct sr_arpentry *entries;
+        
+        entries = (struct sr_arpentry *) calloc(size, sizeof(struct sr_arpentry));
+        retired = (struct sr_arpcache_retired *) malloc(sizeof(struct sr_arpcache_retired));
+        if (!entries || !retired) {
+            free(entries);
+            free(retired);
+            return -1;
+        }
+        
+        old = cache->entries;
+        retired->entries = old;
+        retired->next = cache->retired;
+        cache->retired = retired;
+        
+        /* Publish the array before the size that goes with it */
+        __atomic_store_n(&cache->entries, entries, __ATOMIC_RELEASE);
+        __atomic_store_n(&cache->size, size, __ATOMIC_RELEASE);
+    }
+    else {
+        old = (struct sr_arpentry *) malloc(cache->size * sizeof(struct sr_arpentry));
+        if (!old)
+            return -1;
+        memcpy(old, cache->entries, cache->size * sizeof(struct sr_arpentry));
+        memset(cache->entries, 0, cache->size * sizeof(struct sr_arpentry));
+    }
+    
+    i = cache->lru_tail;
+    cache->count = 0;
+    cache->used = 0;
+    cache->lru_head = cache->lru_tail = -1;
+    
+    for (; i >= 0; i = old[i].lru_prev) {
+        int j = sr_arpcache_claim(cache, old[i].ip);
+        memcpy(cache->entries[j].mac, old[i].mac, 6);
+        cache->entries[j].added = old[i].added;
+        cache->entries[j].referenced = old[i].referenced;
+    }
+    
+    if (!retired)
+        free(old);
+    return 0;
+}
+
+/* Drops the least recently used mapping. Referenced entries at the tail
+   are moved back to the head with the flag cleared; every entry is moved
+   at most once, so this ends within count steps. */
+static void sr_arpcache_evict(struct sr_arpcache *cache) {
+    int i = cache->lru_tail;
+    
+    while (i >= 0 && cache->entries[i].referenced) {
+        cache->entries[i].referenced = 0;
+        sr_arpcache_lru_unlink(cache, i);
+        sr_arpcache_lru_push(cache, i);
+        i = cache->lru_tail;
+    }
+    
+    if (i >= 0) {
+        sr_arpcache_remove(cache, i);
+        cache->evictions++;
+    }
+}
+
+/* Writer side of the seqlock. Makes seq odd before the table is touched
+   and even again once every change is visible. */
+static void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    pthread_mutex_lock(&(cache->table_lock));
+    __atomic_store_n(&cache->seq, cache->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&cache->seq, cache->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(cache->table_lock));
+}
+
+/* One lock free probe for ip. The result is only meaningful if seq did
+   not change around it, but it never faults or loops: the size is read
+   before the array (the writer publishes them in the opposite order) and
+   the probe is bounded by that size. */
+static int sr_arpcache_read(struct sr_arpcache *cache, uint32_t ip,
+                            struct sr_arpentry *copy) {
+    unsigned int size = __atomic_load_n(&cache->size, __ATOMIC_ACQUIRE);
+    struct sr_arpentry *entries = __atomic_load_n(&cache->entries, __ATOMIC_ACQUIRE);
+    unsigned int i = sr_arpcache_hash(ip, size);
+    unsigned int probes;
+    
+    for (probes = 0; probes < size; probes++, i = (i + 1) & (size - 1)) {
+        struct sr_arpentry *entry = &(entries[i]);
+        int valid = __atomic_load_n(&entry->valid, __ATOMIC_RELAXED);
+        
+        if (valid == arp_slot_empty)
+            break;
+        if ((valid == arp_slot_valid) && (entry->ip == ip)) {
+            memcpy(copy, entry, sizeof(struct sr_arpentry));
+            if (!entry->referenced)
+                __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+            return 1;
         }
     }
     
+    return 0;
+}
+
+/* Reader side of the seqlock: retry until a probe ran with no writer in
+   progress and none started before it finished. */
+static int sr_arpcache_read_consistent(struct sr_arpcache *cache, uint32_t ip,
+                                       struct sr_arpentry *copy) {
+    unsigned int seq;
+    int found;
+    
+    do {
+        while ((seq = __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE)) & 1)
+            sched_yield();
+        
+        found = sr_arpcache_read(cache, ip, copy);
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&cache->seq, __ATOMIC_RELAXED) != seq);
+    
+    return found;
+}
+
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   You must free the returned structure if it is not NULL. */
+struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arpentry entry, *copy = NULL;
+    
     /* Must return a copy b/c another thread could jump in and modify
        table after we return. */
-    if (entry) {
+    if (sr_arpcache_read_consistent(cache, ip, &entry)) {
         copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+        memcpy(copy, &entry, sizeof(struct sr_arpentry));
     }
-        
-    pthread_mutex_unlock(&(cache->lock));
     
     return copy;
 }
 
+/* Copies the MAC for ip into mac and returns 1, or returns 0 if ip is not
+   cached. Takes no lock and allocates nothing. */
+int sr_arpcache_lookup_mac(struct sr_arpcache *cache, uint32_t ip,
+                           unsigned char *mac) {
+    struct sr_arpentry entry;
+    
+    if (!sr_arpcache_read_consistent(cache, ip, &entry))
+        return 0;
+    
+    memcpy(mac, entry.mac, ETHER_ADDR_LEN);
+    return 1;
+}
+
+void sr_arpcache_prefetch(struct sr_arpcache *cache, uint32_t ip) {
+    unsigned int size = __atomic_load_n(&cache->size, __ATOMIC_RELAXED);
+    struct sr_arpentry *entries = __atomic_load_n(&cache->entries, __ATOMIC_RELAXED);
+    
+    /* a prefetch never faults, even on a table just retired */
+    __builtin_prefetch(&entries[sr_arpcache_hash(ip, size)]);
+}
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. You should free the passed *packet.
@@ -121,7 +374,26 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       struct sr_if *iface)
+{
+    struct sr_pbuf *pb = 0;
+    struct sr_arpreq *req;
+
+    /* a frame too big for a packet buffer is dropped, the request
+       still goes out */
+    if (packet && packet_len && iface)
+        pb = sr_pbuf_copy(packet, packet_len);
+
+    req = sr_arpcache_queuereq_pbuf(cache, ip, pb, iface);
+    sr_pbuf_free(pb);
+    return req;
+}
+
+/* Same, taking a reference to a frame in a packet buffer. */
+struct sr_arpreq *sr_arpcache_queuereq_pbuf(struct sr_arpcache *cache,
+                                            uint32_t ip,
+                                            struct sr_pbuf *pb,        /* borrowed */
+                                            struct sr_if *iface)
 {
     pthread_mutex_lock(&(cache->lock));
     
@@ -141,14 +413,14 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     }
     
     /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
+    if (pb && pb->len && iface) {
         struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
+        sr_pbuf_ref(pb);
+        new_pkt->pb = pb;
+        new_pkt->buf = pb->data;
+        new_pkt->len = pb->len;
+        new_pkt->iface = iface;
         new_pkt->next = req->packets;
         req->packets = new_pkt;
     }
@@ -185,20 +457,41 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         prev = req;
     }
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
+    pthread_mutex_unlock(&(cache->lock));
+    
+    sr_arpcache_write_begin(cache);
+    
+    int i = sr_arpcache_find(cache, ip);
+    
+    if (i < 0) {
+        /* Make room: evict at the cap, grow (or just clear out tombstones)
+           once more than half the slots are taken */
+        if (cache->count >= cache->max_entries)
+            sr_arpcache_evict(cache);
+        
+        if ((cache->used + 1) * 2 > cache->size) {
+            unsigned int size = cache->size;
+            while (size < (cache->count + 1) * 4)
+                size *= 2;
+            sr_arpcache_resize(cache, size);
+        }
+        
+        if ((cache->used + 1) < cache->size)
+            i = sr_arpcache_claim(cache, ip);
+    }
+    else {
+        /* Refreshed mapping counts as new */
+        cache->entries[i].referenced = 0;
+        sr_arpcache_lru_unlink(cache, i);
+        sr_arpcache_lru_push(cache, i);
     }
     
-    if (i != SR_ARPCACHE_SZ) {
+    if (i >= 0) {
         memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
         cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
     }
     
-    pthread_mutex_unlock(&(cache->lock));
+    sr_arpcache_write_end(cache);
     
     return req;
 }
@@ -230,10 +523,7 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
         
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
+            sr_pbuf_free(pkt->pb);
             free(pkt);
         }
         
@@ -245,41 +535,95 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache) {
+    pthread_mutex_lock(&(cache->table_lock));
+    
     fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
     
     int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    for (i = cache->lru_head; i >= 0; i = cache->entries[i].lru_next) {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
         fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
     }
     
+    fprintf(stderr, "%u/%u entries, %u slots, %lu evictions\n", cache->count,
+            cache->max_entries, cache->size, cache->evictions);
     fprintf(stderr, "\n");
+    
+    pthread_mutex_unlock(&(cache->table_lock));
+}
+
+/* Sets the cap on cached mappings, evicting down to it if needed. */
+void sr_arpcache_set_max_entries(struct sr_arpcache *cache, unsigned int max) {
+    sr_arpcache_write_begin(cache);
+    
+    cache->max_entries = max ? max : 1;
+    while (cache->count > cache->max_entries)
+        sr_arpcache_evict(cache);
+    
+    sr_arpcache_write_end(cache);
 }
 
 /* Initialize table + table lock. Returns 0 on success. */
 int sr_arpcache_init(struct sr_arpcache *cache) {  
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
-    
-    /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
+    /* Start out with every slot empty */
+    cache->entries = (struct sr_arpentry *) calloc(SR_ARPCACHE_SZ, sizeof(struct sr_arpentry));
+    if (!cache->entries)
+        return -1;
+    cache->size = SR_ARPCACHE_SZ;
+    cache->count = 0;
+    cache->used = 0;
+    cache->max_entries = SR_ARPCACHE_MAX;
+    cache->lru_head = cache->lru_tail = -1;
+    cache->evictions = 0;
+    cache->seq = 0;
+    cache->retired = NULL;
     cache->requests = NULL;
     
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
     pthread_mutexattr_settype(&(cache->attr), PTHREAD_MUTEX_RECURSIVE);
     int success = pthread_mutex_init(&(cache->lock), &(cache->attr));
+    if (success == 0)
+        success = pthread_mutex_init(&(cache->table_lock), NULL);
     
     return success;
 }
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    struct sr_arpcache_retired *retired, *next;
+    
+    for (retired = cache->retired; retired; retired = next) {
+        next = retired->next;
+        free(retired->entries);
+        free(retired);
+    }
+    cache->retired = NULL;
+    free(cache->entries);
+    cache->entries = NULL;
+    
+    pthread_mutex_destroy(&(cache->table_lock));
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
+/* Invalidates entries added more than SR_ARPCACHE_TO seconds before now. */
+void sr_arpcache_expire(struct sr_arpcache *cache, time_t now) {
+    int i, next;
+    
+    sr_arpcache_write_begin(cache);
+    
+    for (i = cache->lru_head; i >= 0; i = next) {
+        next = cache->entries[i].lru_next;
+        if (difftime(now, cache->entries[i].added) > SR_ARPCACHE_TO) {
+            sr_arpcache_remove(cache, i);
+        }
+    }
+    
+    sr_arpcache_write_end(cache);
+}
+
 /* Thread which sweeps through the cache and invalidates entries that were added
    more than SR_ARPCACHE_TO seconds ago. */
 void *sr_arpcache_timeout(void *sr_ptr) {
@@ -289,16 +633,11 @@ void *sr_arpcache_timeout(void *sr_ptr) {
     while (1) {
         sleep(1.0);
         
-        pthread_mutex_lock(&(cache->lock));
-    
-        time_t curtime = time(NULL);
+        sr_arpcache_expire(cache, time(NULL));
         
-        int i;    
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
-        }
+        /* Only the request queue is locked while requests are resent, so
+           lookups and ARP replies are not held up */
+        pthread_mutex_lock(&(cache->lock));
         
         sr_arpcache_sweepreqs(sr);
 
@@ -70,22 +70,35 @@
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
+#include "sr_pbuf.h"
 
-#define SR_ARPCACHE_SZ    100  
+#define SR_ARPCACHE_SZ    128     /* initial hash slots, a power of two */
+#define SR_ARPCACHE_MAX   4096    /* default cap on cached mappings */
 #define SR_ARPCACHE_TO    15.0
 
 struct sr_packet {
+    struct sr_pbuf *pb;         /* holds the frame, one reference */
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    struct sr_if *iface;        /* The outgoing interface */
     struct sr_packet *next;
 };
 
+enum sr_arpentry_state {
+    arp_slot_empty = 0,
+    arp_slot_valid = 1,
+    arp_slot_deleted = 2,       /* tombstone, keeps probe chains intact */
+};
+
 struct sr_arpentry {
     unsigned char mac[6]; 
     uint32_t ip;                /* IP addr in network byte order */
     time_t added;         
-    int valid;
+    int valid;                  /* enum sr_arpentry_state */
+    int referenced;             /* looked up since it was last considered
+                                   for eviction */
+    int lru_prev;               /* slot indexes on the LRU list, -1 at */
+    int lru_next;               /* either end */
 };
 
 struct sr_arpreq {
@@ -99,10 +112,41 @@ struct sr_arpreq {
     struct sr_arpreq *next;
 };
 
+/* Arrays replaced when the table grows. Lock free readers may still be
+   probing them, so they are only freed by sr_arpcache_destroy. The table
+   only ever doubles, so these add up to less than the live table. */
+struct sr_arpcache_retired {
+    struct sr_arpentry *entries;
+    struct sr_arpcache_retired *next;
+};
+
+/* The cache is an open addressed hash table on IP with linear probing. It
+   doubles when more than half the slots are in use, up to max_entries
+   mappings. Past that the least recently used mapping is evicted: entries
+   sit on a list ordered by insertion, lookups only set the referenced
+   flag, and eviction gives referenced entries at the tail a second chance
+   by moving them back to the head.
+
+   Lookups take no lock. Writers (insert, expiry, resize) serialize on
+   table_lock and bump seq before and after changing the table, so seq is
+   odd while a write is in progress; readers retry if seq was odd or
+   changed while they probed. The request queue has its own lock, so the
+   sweeper sending ARP requests and ICMP errors never holds up the table. */
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_arpentry *entries;
+    unsigned int size;          /* number of slots, a power of two, never
+                                   shrinks */
+    unsigned int count;         /* valid entries */
+    unsigned int used;          /* valid and deleted slots */
+    unsigned int max_entries;   /* cap on valid entries */
+    int lru_head;               /* most recently inserted or promoted */
+    int lru_tail;               /* next eviction candidate */
+    unsigned long evictions;    /* mappings dropped to stay under the cap */
+    unsigned int seq;           /* table version, odd during a write */
+    struct sr_arpcache_retired *retired;
+    pthread_mutex_t table_lock; /* serializes table writers */
     struct sr_arpreq *requests;
-    pthread_mutex_t lock;
+    pthread_mutex_t lock;       /* protects requests */
     pthread_mutexattr_t attr;
 };
 
@@ -110,6 +154,15 @@ struct sr_arpcache {
    You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
+/* Allocation free variant of sr_arpcache_lookup for the forwarding path.
+   If the IP (network byte order) is cached, copies its MAC into mac, which
+   must hold ETHER_ADDR_LEN bytes, and returns 1. Returns 0 otherwise. */
+int sr_arpcache_lookup_mac(struct sr_arpcache *cache, uint32_t ip,
+                           unsigned char *mac);
+
+/* Starts loading the slot ip hashes to, ahead of a lookup. */
+void sr_arpcache_prefetch(struct sr_arpcache *cache, uint32_t ip);
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. The packet argument should not be
@@ -121,7 +174,14 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         struct sr_if *iface);
+
+/* sr_arpcache_queuereq() for a frame already in a packet buffer: the
+   queue takes a reference to pb (which may be NULL) instead of a copy. */
+struct sr_arpreq *sr_arpcache_queuereq_pbuf(struct sr_arpcache *cache,
+                         uint32_t ip,
+                         struct sr_pbuf *pb,            /* borrowed */
+                         struct sr_if *iface);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -138,6 +198,10 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
+/* Sets the most mappings the cache will hold before it starts evicting the
+   least recently used ones. */
+void sr_arpcache_set_max_entries(struct sr_arpcache *cache, unsigned int max);
+
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
    a destructor, and a cleanup thread times out cache entries every 15
@@ -147,8 +211,14 @@ int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 
+/* Invalidates entries added more than SR_ARPCACHE_TO seconds before now.
+   Called by the cleanup thread; takes only the table lock. */
+void  sr_arpcache_expire(struct sr_arpcache *cache, time_t now);
+
 
-void handle_arpreq(struct sr_instance *, struct sr_arpreq *);
+int  handle_arpreq(struct sr_instance *, struct sr_arpreq *);
+int  sr_arpcache_queuereq_send(struct sr_instance *, uint32_t ,
+                               struct sr_pbuf *, struct sr_if *);
 void sr_arpcache_sweepreqs(struct sr_instance *); 
 void send_arp_requests(struct sr_instance *, struct sr_arpreq *);
 void send_icmp_to_packets(struct sr_instance *, struct sr_arpreq *);
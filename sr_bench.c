@@ -0,0 +1,3011 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_bench.c
+ *
+ * Description:
+ *
+ * Micro benchmarks for the router's data structures.  These run offline,
+ * no VNS server needed.
+ *
+ *   sr_bench fib      route lookups/sec, compiled FIB vs. list walk
+ *   sr_bench arp      ARP lookup latency with and without the sweeper
+ *   sr_bench cksum    IP checksum update and verify, old vs. new
+ *   sr_bench simd     cksum() kernels: differential test, then bytes/sec
+ *   sr_bench forward  sr_handlepacket forwarding rate by log setting
+ *   sr_bench nat      NAT mapping insert/lookup rates, indexes vs. list walk
+ *   sr_bench expire   NAT timeout cost per tick, timer wheel vs. table scan
+ *   sr_bench udp      NAT replay of a DNS-like trace, and UDP rewrite cost
+ *   sr_bench natfwd   NAT mode through the replay backend, pps by direction
+ *   sr_bench pcaplog  forwarding rate with -l, inline writes vs. writer thread
+ *   sr_bench pbuf     packet buffer pool vs. malloc, and pool use per packet
+ *   sr_bench engine   replay through 1 to 8 worker threads, pps and flow order
+ *   sr_bench vector   sr_handlepacket_vec vs. sr_handlepacket, pps and output
+ *   sr_bench ifname   interface by name and by address, hashed vs. list walk
+ *
+ * Build with optimization for meaningful numbers:
+ *
+ *   make OPTFLAGS=-O2 bench
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_if.h"
+#include "sr_log.h"
+#include "sr_nat.h"
+#include "sr_io.h"
+#include "sr_dumper.h"
+#include "sr_engine.h"
+#include "sr_vec.h"
+#include "sr_pkt.h"
+#include "vnscommand.h"
+
+static void usage(char* );
+static int bench_fib(int argc, char** argv);
+static int bench_arp(int argc, char** argv);
+static int bench_cksum(int argc, char** argv);
+static int bench_simd(int argc, char** argv);
+static int bench_forward(int argc, char** argv);
+static int bench_nat(int argc, char** argv);
+static int bench_expire(int argc, char** argv);
+static int bench_udp(int argc, char** argv);
+static int bench_natfwd(int argc, char** argv);
+static int bench_natmt(int argc, char** argv);
+static int bench_vnsrx(int argc, char** argv);
+static int bench_pcaplog(int argc, char** argv);
+static int bench_pbuf(int argc, char** argv);
+static int bench_engine(int argc, char** argv);
+static int bench_vector(int argc, char** argv);
+static int bench_ifname(int argc, char** argv);
+static void bench_router_init(struct sr_instance* sr);
+static unsigned int bench_forward_frame(uint8_t* pkt);
+
+struct bench_cmd
+{
+    const char* name;
+    int (*run)(int argc, char** argv);
+    const char* help;
+};
+
+static struct bench_cmd bench_cmds[] =
+{
+    { "fib", bench_fib, "route lookups/sec at 1k, 100k, 1M prefixes" },
+    { "arp", bench_arp, "ARP lookup and forwarding latency, sweeper idle vs. running" },
+    { "cksum", bench_cksum, "TTL decrement and header verify, ops/sec" },
+    { "simd", bench_simd, "cksum kernels vs. byte loop, correctness and GB/s" },
+    { "forward", bench_forward, "forwarded packets/sec, quiet vs. full logging" },
+    { "nat", bench_nat, "NAT insert/lookup rates at 1k, 10k, 60k mappings" },
+    { "expire", bench_expire, "NAT timeout tick cost at 10k, 100k, 1M connections" },
+    { "udp", bench_udp, "NAT replay of short-lived DNS flows, rewrite ops/sec" },
+    { "natfwd", bench_natfwd, "NAT mode pcap replay, packets/sec per direction" },
+    { "natmt", bench_natmt, "NAT translations/sec on 1 to 16 threads, 1 vs. sharded" },
+    { "vnsrx", bench_vnsrx, "VNS socket receive/send, packets/sec and syscalls/packet" },
+    { "pcaplog", bench_pcaplog, "forwarded packets/sec with a capture file, sync vs. async" },
+    { "pbuf", bench_pbuf, "packet buffer pool vs. malloc ns/buffer, pool use per packet" },
+    { "engine", bench_engine, "replay pps inline and on 1, 2, 4, 8 workers, flow order check" },
+    { "vector", bench_vector, "vector vs. scalar input path pps by vector size, same output check" },
+    { "ifname", bench_ifname, "interface lookups/sec by name and address, 3 to 4096 interfaces" },
+    { 0, 0, 0 }
+};
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char** argv)
+{
+    struct bench_cmd* cmd;
+
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (cmd = bench_cmds; cmd->name; cmd++)
+    {
+        if (strcmp(cmd->name, argv[1]) == 0)
+        { return cmd->run(argc - 1, argv + 1); }
+    }
+
+    usage(argv[0]);
+    return 1;
+} /* -- main -- */
+
+static void usage(char* argv0)
+{
+    struct bench_cmd* cmd;
+
+    printf("Format: %s <benchmark> [args]\n", argv0);
+    for (cmd = bench_cmds; cmd->name; cmd++)
+    { printf("   %-10s %s\n", cmd->name, cmd->help); }
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Helpers
+ *---------------------------------------------------------------------------*/
+
+/* results are folded in here so lookups are not optimized away */
+volatile uintptr_t bench_sink;
+
+static uint64_t bench_rand_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, deterministic so runs are comparable */
+static uint32_t bench_rand(void)
+{
+    bench_rand_state ^= bench_rand_state >> 12;
+    bench_rand_state ^= bench_rand_state << 25;
+    bench_rand_state ^= bench_rand_state >> 27;
+    return (uint32_t)((bench_rand_state * 2685821657736338717ULL) >> 32);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* sorts lat in place and prints p50/p99/p99.9/max */
+static void bench_print_latency(const char* label, uint32_t* lat, uint32_t n,
+                                double secs)
+{
+    qsort(lat, n, sizeof(uint32_t), bench_cmp_u32);
+    printf("%-28s %12.0f %8u %8u %8u %10u\n", label, n / secs,
+           lat[n / 2], lat[(uint32_t)(n * 0.99)], lat[(uint32_t)(n * 0.999)],
+           lat[n - 1]);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_fib(..)
+ *
+ * Random table shaped roughly like a BGP table (mostly /24, the rest spread
+ * over /8 - /32).  Half the lookups hit a loaded prefix, half are random.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int bench_fib_plen(void)
+{
+    uint32_t r = bench_rand() % 100;
+
+    if (r < 55) return 24;
+    if (r < 90) return 16 + bench_rand() % 8;
+    if (r < 95) return 8 + bench_rand() % 8;
+    return 25 + bench_rand() % 8;
+}
+
+static void bench_fib_run(uint32_t n)
+{
+    const uint32_t naddrs = 1 << 20;
+    struct sr_rt* routes;
+    struct sr_rt* list = 0;
+    struct sr_fib fib;
+    uint32_t* addrs;
+    uint32_t i, iters, lin_iters, mismatch = 0;
+    double t0, t_build, t_fib, t_lin;
+
+    routes = malloc(n * sizeof(struct sr_rt));
+    addrs = malloc(naddrs * sizeof(uint32_t));
+    if (!routes || !addrs)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        int plen = bench_fib_plen();
+        uint32_t mask = plen ? 0xffffffff << (32 - plen) : 0;
+
+        routes[i].dest.s_addr = htonl(bench_rand() & mask);
+        routes[i].mask.s_addr = htonl(mask);
+        routes[i].gw.s_addr = htonl(bench_rand());
+        strcpy(routes[i].interface, "eth1");
+        routes[i].next = list;
+        list = &routes[i];
+    }
+
+    for (i = 0; i < naddrs; i++)
+    {
+        if (i & 1)
+        { addrs[i] = htonl(bench_rand()); }
+        else
+        {
+            struct sr_rt* r = &routes[bench_rand() % n];
+            addrs[i] = r->dest.s_addr | (htonl(bench_rand()) & ~r->mask.s_addr);
+        }
+    }
+
+    sr_fib_init(&fib);
+    t0 = bench_now();
+    if (sr_fib_build(&fib, list) != 0)
+    {
+        fprintf(stderr, "sr_fib_build failed\n");
+        exit(1);
+    }
+    t_build = bench_now() - t0;
+
+    iters = 20000000;
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    { bench_sink += (uintptr_t)sr_fib_lookup(&fib, addrs[i & (naddrs - 1)]); }
+    t_fib = bench_now() - t0;
+
+    /* the list walk is O(n), keep its total work bounded */
+    lin_iters = 200000000 / n;
+    if (lin_iters < 20)
+    { lin_iters = 20; }
+    if (lin_iters > naddrs)
+    { lin_iters = naddrs; }
+    t0 = bench_now();
+    for (i = 0; i < lin_iters; i++)
+    { bench_sink += (uintptr_t)sr_rt_lookup_linear(list, addrs[i]); }
+    t_lin = bench_now() - t0;
+
+    for (i = 0; i < lin_iters; i++)
+    {
+        if (sr_rt_lookup_linear(list, addrs[i]) != sr_fib_lookup(&fib, addrs[i]))
+        { mismatch++; }
+    }
+
+    printf("%8u  %8.1f  %7.1f  %14.0f  %14.0f  %8.0fx  %u/%u\n",
+           n, t_build * 1000,
+           (fib.tbl8_size * SR_FIB_CHUNK_SZ + SR_FIB_TBL16_SZ) * 4 / 1048576.0,
+           iters / t_fib, lin_iters / t_lin,
+           (iters / t_fib) / (lin_iters / t_lin),
+           mismatch, lin_iters);
+
+    sr_fib_destroy(&fib);
+    free(addrs);
+    free(routes);
+}
+
+static int bench_fib(int argc, char** argv)
+{
+    uint32_t sizes[] = { 1000, 100000, 1000000 };
+    unsigned int i;
+
+    printf("%8s  %8s  %7s  %14s  %14s  %9s  %s\n", "prefixes", "build ms",
+           "mem MB", "fib lookups/s", "list lookups/s", "speedup",
+           "mismatches");
+
+    if (argc > 1)
+    {
+        bench_fib_run(atoi(argv[1]));
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    { bench_fib_run(sizes[i]); }
+
+    return 0;
+} /* -- bench_fib -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_arp(..)
+ *
+ * Times individual ARP lookups (what sr_handleIP does per forwarded packet)
+ * against a cache of 1024 neighbors.  The sweeper thread runs the same
+ * work as sr_arpcache_timeout every millisecond instead of once a second:
+ * an expiry pass over the table, a refreshed mapping as from an ARP reply,
+ * then sleeping 50us with the request queue lock held, like a blocking
+ * write() while resending ARP requests.  It is paced rather than run back
+ * to back so that it does the same work whichever way readers lock; the
+ * passes line says how much it got done.  "mutex" reads take the request
+ * queue lock around the lookup, which is what every lookup used to do.
+ *
+ * The second table times whole packets instead: sr_handlepacket on the
+ * bench_forward frame, which is routed off-net and so looks up the
+ * gateway's MAC, with the sweeper working on that router's cache.  The
+ * "mutex" rows hold the request queue lock around each packet, standing
+ * in for the lookup taking it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_ARP_NEIGHBORS 1024
+#define BENCH_ARP_SWEEP_US  1000
+
+struct bench_arp_state
+{
+    struct sr_arpcache* cache;
+    volatile int stop;
+    pthread_t thread;
+    unsigned long passes;
+};
+
+static void* bench_arp_sweeper(void* arg)
+{
+    struct bench_arp_state* st = arg;
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0 };
+    uint32_t n = 0;
+    double next = bench_now_ns();
+
+    while (!st->stop)
+    {
+        next += BENCH_ARP_SWEEP_US * 1000.0;
+        st->passes++;
+
+        sr_arpcache_expire(st->cache, time(NULL));
+
+        mac[5] = (unsigned char)n;
+        sr_arpcache_insert(st->cache, mac,
+                           htonl(0x0a000000 + (n++ % BENCH_ARP_NEIGHBORS)));
+
+        pthread_mutex_lock(&st->cache->lock);
+        usleep(50);
+        pthread_mutex_unlock(&st->cache->lock);
+
+        while (!st->stop && bench_now_ns() < next)
+        { usleep(100); }
+    }
+
+    return NULL;
+}
+
+static void bench_arp_sweeper_start(struct bench_arp_state* st)
+{
+    st->stop = 0;
+    st->passes = 0;
+    pthread_create(&st->thread, NULL, bench_arp_sweeper, st);
+    usleep(20000); /* let it get going before timing starts */
+}
+
+static void bench_arp_sweeper_stop(struct bench_arp_state* st)
+{
+    st->stop = 1;
+    pthread_join(st->thread, NULL);
+    printf("  %lu sweeper passes\n", st->passes);
+}
+
+static void bench_arp_run(struct bench_arp_state* st, const char* label,
+                          int sweeper, int locked, uint32_t* lat, uint32_t n)
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint32_t i, ip, misses = 0;
+    double t0, t1, start;
+
+    if (sweeper)
+    { bench_arp_sweeper_start(st); }
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        ip = htonl(0x0a000000 + bench_rand() % BENCH_ARP_NEIGHBORS);
+
+        t0 = bench_now_ns();
+        if (locked)
+        { pthread_mutex_lock(&st->cache->lock); }
+        if (!sr_arpcache_lookup_mac(st->cache, ip, mac))
+        { misses++; }
+        if (locked)
+        { pthread_mutex_unlock(&st->cache->lock); }
+        t1 = bench_now_ns();
+
+        lat[i] = (uint32_t)(t1 - t0);
+    }
+
+    bench_print_latency(label, lat, n, (bench_now_ns() - start) / 1e9);
+
+    if (sweeper)
+    { bench_arp_sweeper_stop(st); }
+    if (misses)
+    { printf("  %u misses\n", misses); }
+}
+
+static void bench_arp_fwd_run(struct bench_arp_state* st, struct sr_instance* sr,
+                              const char* label, int sweeper, int locked,
+                              uint32_t* lat, uint32_t n)
+{
+    uint8_t tmpl[2048], pkt[2048];
+    unsigned int len = bench_forward_frame(tmpl);
+    unsigned int total = sizeof(c_packet_header) + len;
+    uint32_t i;
+    double t0, t1, start;
+
+    if (sweeper)
+    { bench_arp_sweeper_start(st); }
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        memcpy(pkt, tmpl, total);
+
+        t0 = bench_now_ns();
+        if (locked)
+        { pthread_mutex_lock(&st->cache->lock); }
+        sr_handlepacket(sr, pkt + sizeof(c_packet_header), len,
+                        (char*)(pkt + sizeof(c_base)));
+        if (locked)
+        { pthread_mutex_unlock(&st->cache->lock); }
+        t1 = bench_now_ns();
+
+        lat[i] = (uint32_t)(t1 - t0);
+    }
+
+    bench_print_latency(label, lat, n, (bench_now_ns() - start) / 1e9);
+
+    if (sweeper)
+    { bench_arp_sweeper_stop(st); }
+}
+
+static int bench_arp(int argc, char** argv)
+{
+    struct bench_arp_state st;
+    struct sr_arpcache cache;
+    struct sr_instance sr;
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0 };
+    uint32_t n = (argc > 1) ? atoi(argv[1]) : 2000000;
+    uint32_t* lat = malloc(n * sizeof(uint32_t));
+    uint32_t i;
+
+    if (!lat)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    st.cache = &cache;
+    sr_arpcache_init(&cache);
+    for (i = 0; i < BENCH_ARP_NEIGHBORS; i++)
+    {
+        mac[5] = (unsigned char)i;
+        sr_arpcache_insert(&cache, mac, htonl(0x0a000000 + i));
+    }
+
+    printf("%-28s %12s %8s %8s %8s %10s\n", "lookup latency (ns)",
+           "lookups/s", "p50", "p99", "p99.9", "max");
+    bench_arp_run(&st, "lock free, sweeper idle", 0, 0, lat, n);
+    bench_arp_run(&st, "lock free, sweeper running", 1, 0, lat, n);
+    bench_arp_run(&st, "mutex, sweeper idle", 0, 1, lat, n);
+    bench_arp_run(&st, "mutex, sweeper running", 1, 1, lat, n);
+    sr_arpcache_destroy(&cache);
+
+    /* -- the gateway among as many neighbors, in the router's own cache -- */
+    bench_router_init(&sr);
+    st.cache = &sr.cache;
+    for (i = 0; i < BENCH_ARP_NEIGHBORS; i++)
+    {
+        mac[5] = (unsigned char)i;
+        sr_arpcache_insert(&sr.cache, mac, htonl(0x0a010000 + i));
+    }
+
+    printf("\n%-28s %12s %8s %8s %8s %10s\n", "forwarding latency (ns)",
+           "packets/s", "p50", "p99", "p99.9", "max");
+    bench_arp_fwd_run(&st, &sr, "lock free, sweeper idle", 0, 0, lat, n);
+    bench_arp_fwd_run(&st, &sr, "lock free, sweeper running", 1, 0, lat, n);
+    bench_arp_fwd_run(&st, &sr, "mutex, sweeper idle", 0, 1, lat, n);
+    bench_arp_fwd_run(&st, &sr, "mutex, sweeper running", 1, 1, lat, n);
+
+    close(sr.sockfd);
+    free(lat);
+    return 0;
+} /* -- bench_arp -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_cksum(..)
+ *
+ * The two checksum operations on the forwarding path, over a ring of
+ * random 20 byte IP headers: the TTL decrement (full recompute vs.
+ * ip_decrement_ttl) and the header check (validate_checksum as it used
+ * to be, with a malloc'd scratch copy, vs. cksum_verify).  Before timing,
+ * every incremental result is checked against a full recompute.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_CKSUM_HDRS 4096
+
+/* validate_checksum before it checked in place */
+static int bench_validate_copy(uint8_t* buf, unsigned int len)
+{
+    uint8_t* packet = malloc(len);
+    int result;
+
+    memcpy(packet, buf, len);
+    ((sr_ip_hdr_t*)packet)->ip_sum = 0;
+    result = (((sr_ip_hdr_t*)buf)->ip_sum == cksum(packet, len));
+    free(packet);
+    return result;
+}
+
+static void bench_cksum_fill(sr_ip_hdr_t* hdrs)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < BENCH_CKSUM_HDRS; i++)
+    {
+        uint8_t* raw = (uint8_t*)&hdrs[i];
+
+        for (j = 0; j < sizeof(sr_ip_hdr_t); j++)
+        { raw[j] = (uint8_t)bench_rand(); }
+        hdrs[i].ip_v = 4;
+        hdrs[i].ip_hl = 5;
+        hdrs[i].ip_ttl = 255;
+        hdrs[i].ip_sum = 0;
+        hdrs[i].ip_sum = cksum(&hdrs[i], sizeof(sr_ip_hdr_t));
+    }
+}
+
+static int bench_cksum(int argc, char** argv)
+{
+    uint32_t iters = (argc > 1) ? atoi(argv[1]) : 20000000;
+    sr_ip_hdr_t* hdrs = malloc(BENCH_CKSUM_HDRS * sizeof(sr_ip_hdr_t));
+    sr_ip_hdr_t* h;
+    uint32_t i, bad = 0;
+    double t0, t_full, t_incr, t_copy, t_verify;
+
+    if (!hdrs)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* incremental must agree with recomputing, all the way down to ttl 1 */
+    bench_cksum_fill(hdrs);
+    for (i = 0; i < BENCH_CKSUM_HDRS * 254; i++)
+    {
+        uint16_t sum;
+
+        h = &hdrs[i % BENCH_CKSUM_HDRS];
+        ip_decrement_ttl(h);
+        sum = h->ip_sum;
+        h->ip_sum = 0;
+        if (cksum(h, sizeof(sr_ip_hdr_t)) != sum)
+        { bad++; }
+        h->ip_sum = sum;
+        if (!cksum_verify(h, sizeof(sr_ip_hdr_t)) ||
+            !bench_validate_copy((uint8_t*)h, sizeof(sr_ip_hdr_t)))
+        { bad++; }
+    }
+
+    /* ttl wraps freely below, only the cost matters */
+    bench_cksum_fill(hdrs);
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        h = &hdrs[i & (BENCH_CKSUM_HDRS - 1)];
+        h->ip_ttl--;
+        h->ip_sum = 0;
+        h->ip_sum = cksum(h, h->ip_hl * 4);
+    }
+    t_full = bench_now() - t0;
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    { ip_decrement_ttl(&hdrs[i & (BENCH_CKSUM_HDRS - 1)]); }
+    t_incr = bench_now() - t0;
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        h = &hdrs[i & (BENCH_CKSUM_HDRS - 1)];
+        bench_sink += bench_validate_copy((uint8_t*)h, h->ip_hl * 4);
+    }
+    t_copy = bench_now() - t0;
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        h = &hdrs[i & (BENCH_CKSUM_HDRS - 1)];
+        bench_sink += cksum_verify(h, h->ip_hl * 4);
+    }
+    t_verify = bench_now() - t0;
+
+    printf("%-34s %14s %8s\n", "operation", "ops/s", "ns/op");
+    printf("%-34s %14.0f %8.1f\n", "ttl--, full cksum", iters / t_full,
+           t_full * 1e9 / iters);
+    printf("%-34s %14.0f %8.1f\n", "ttl--, ip_decrement_ttl", iters / t_incr,
+           t_incr * 1e9 / iters);
+    printf("%-34s %14.0f %8.1f\n", "verify, malloc + copy + cksum",
+           iters / t_copy, t_copy * 1e9 / iters);
+    printf("%-34s %14.0f %8.1f\n", "verify, cksum_verify", iters / t_verify,
+           t_verify * 1e9 / iters);
+    printf("incremental vs. full mismatches: %u/%u\n", bad,
+           BENCH_CKSUM_HDRS * 254);
+
+    free(hdrs);
+    return bad != 0;
+} /* -- bench_cksum -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_simd(..)
+ *
+ * Differential test of every cksum() kernel the CPU supports against the
+ * original byte-at-a-time loop: random lengths, start offsets and
+ * contents (including runs of 0x00 and 0xff, which stress the carries),
+ * then throughput per kernel at typical packet sizes.  Exits non-zero on
+ * any mismatch.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_SIMD_BUF 16384
+
+/* cksum before it was vectorized */
+static uint16_t bench_cksum_ref(const void* _data, int len)
+{
+    const uint8_t* data = _data;
+    uint32_t sum;
+
+    for (sum = 0; len >= 2; data += 2, len -= 2)
+    { sum += data[0] << 8 | data[1]; }
+    if (len > 0)
+    { sum += data[0] << 8; }
+    while (sum > 0xffff)
+    { sum = (sum >> 16) + (sum & 0xffff); }
+    sum = htons(~sum);
+    return sum ? sum : 0xffff;
+}
+
+static void bench_simd_fill(uint8_t* buf, uint32_t len)
+{
+    uint32_t i, kind = bench_rand() % 4;
+
+    for (i = 0; i < len; i++)
+    {
+        switch (kind)
+        {
+            case 0:  buf[i] = 0xff; break;
+            case 1:  buf[i] = (bench_rand() % 8) ? 0xff : 0; break;
+            case 2:  buf[i] = (bench_rand() % 8) ? 0 : (uint8_t)bench_rand(); break;
+            default: buf[i] = (uint8_t)bench_rand(); break;
+        }
+    }
+}
+
+static int bench_simd(int argc, char** argv)
+{
+    const char* impls[] = { "scalar", "sse2", "avx2" };
+    const int sizes[] = { 20, 64, 576, 1500, 9000 };
+    uint32_t cases = (argc > 1) ? atoi(argv[1]) : 200000;
+    uint8_t* buf = malloc(BENCH_SIMD_BUF + 64);
+    uint32_t i, j, k, bad = 0;
+    double t0, t;
+
+    if (!buf)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("%-8s %10s %10s\n", "kernel", "cases", "mismatches");
+    for (k = 0; k < sizeof(impls) / sizeof(impls[0]); k++)
+    {
+        uint32_t kbad = 0;
+
+        if (cksum_use(impls[k]) != 0)
+        {
+            printf("%-8s %10s\n", impls[k], "n/a");
+            continue;
+        }
+
+        for (i = 0; i < cases; i++)
+        {
+            uint32_t off = bench_rand() % 64;
+            uint32_t len = (i & 1) ? bench_rand() % 2048
+                                   : bench_rand() % BENCH_SIMD_BUF;
+
+            bench_simd_fill(buf + off, len);
+            if (cksum(buf + off, len) != bench_cksum_ref(buf + off, len))
+            { kbad++; }
+        }
+        printf("%-8s %10u %10u\n", impls[k], cases, kbad);
+        bad += kbad;
+    }
+
+    bench_simd_fill(buf, BENCH_SIMD_BUF);
+    printf("\n%-8s", "GB/s");
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+    { printf(" %8d", sizes[j]); }
+    printf("\n%-8s", "byte");
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+    {
+        uint32_t iters = 200000000 / (sizes[j] + 64);
+
+        t0 = bench_now();
+        for (i = 0; i < iters; i++)
+        { bench_sink += bench_cksum_ref(buf + (i & 63), sizes[j]); }
+        t = bench_now() - t0;
+        printf(" %8.2f", (double)iters * sizes[j] / t / 1e9);
+    }
+    for (k = 0; k < sizeof(impls) / sizeof(impls[0]); k++)
+    {
+        if (cksum_use(impls[k]) != 0)
+        { continue; }
+
+        printf("\n%-8s", impls[k]);
+        for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+        {
+            uint32_t iters = 200000000 / (sizes[j] + 64);
+
+            t0 = bench_now();
+            for (i = 0; i < iters; i++)
+            { bench_sink += cksum(buf + (i & 63), sizes[j]); }
+            t = bench_now() - t0;
+            printf(" %8.2f", (double)iters * sizes[j] / t / 1e9);
+        }
+    }
+    printf("\n");
+
+    cksum_use(0);
+    printf("default kernel: %s\n", cksum_impl());
+
+    free(buf);
+    return bad != 0;
+} /* -- bench_simd -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_forward(..)
+ *
+ * Feeds one UDP frame after another through sr_handlepacket on a two
+ * interface router whose next hop is already in the ARP cache, so every
+ * frame takes the forward path and is written to /dev/null.  stdout and
+ * stderr go to /dev/null too while timing, so the cost measured is that of
+ * formatting the log output, not of a terminal.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_FWD_PAYLOAD 64
+
+static void bench_router_init(struct sr_instance* sr)
+{
+    unsigned char mac1[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 1, 1 };
+    unsigned char mac2[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 2, 1 };
+    unsigned char gwmac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 2, 2 };
+    struct in_addr dest, gw, mask;
+
+    memset(sr, 0, sizeof(struct sr_instance));
+    sr->sockfd = open("/dev/null", O_WRONLY);
+    sr_fib_init(&sr->fib);
+    sr_arpcache_init(&sr->cache);
+
+    sr_add_interface(sr, "eth1");
+    sr_set_ether_addr(sr, mac1);
+    sr_set_ether_ip(sr, htonl(0x0a000101));
+    sr_add_interface(sr, "eth2");
+    sr_set_ether_addr(sr, mac2);
+    sr_set_ether_ip(sr, htonl(0x0a000201));
+
+    dest.s_addr = htonl(0x0a000100);
+    gw.s_addr = 0;
+    mask.s_addr = htonl(0xffffff00);
+    sr_add_rt_entry(sr, dest, gw, mask, "eth1");
+    dest.s_addr = 0;
+    gw.s_addr = htonl(0x0a000202);
+    mask.s_addr = 0;
+    sr_add_rt_entry(sr, dest, gw, mask, "eth2");
+    sr_fib_build(&sr->fib, sr->routing_table);
+
+    sr_arpcache_insert(&sr->cache, gwmac, gw.s_addr);
+}
+
+/* a VNSPACKET as sr_read_from_server_expect sees it: VNS header, then an
+   Ethernet frame from a host on eth1 headed off-net */
+static unsigned int bench_forward_frame(uint8_t* pkt)
+{
+    unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                       BENCH_FWD_PAYLOAD;
+    c_packet_header* vns = (c_packet_header*)pkt;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)(pkt + sizeof(c_packet_header));
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    unsigned char mac1[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 1, 1 };
+    unsigned char host[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 1, 2 };
+
+    memset(pkt, 0, sizeof(c_packet_header) + len);
+    vns->mLen = htonl(sizeof(c_packet_header) + len);
+    vns->mType = htonl(VNSPACKET);
+    strcpy(vns->mInterfaceName, "eth1");
+
+    memcpy(eth->ether_dhost, mac1, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, host, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + BENCH_FWD_PAYLOAD);
+    ip->ip_ttl = 64;
+    ip->ip_p = 17;
+    ip->ip_src = htonl(0x0a000102);
+    ip->ip_dst = htonl(0x08080808);
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    return len;
+}
+
+static double bench_forward_run(struct sr_instance* sr, uint32_t iters)
+{
+    uint8_t tmpl[2048], pkt[2048];
+    unsigned int len = bench_forward_frame(tmpl);
+    unsigned int total = sizeof(c_packet_header) + len;
+    int out = dup(1), err = dup(2);
+    int devnull = open("/dev/null", O_WRONLY);
+    uint32_t i;
+    double t0, t;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(devnull, 1);
+    dup2(devnull, 2);
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        memcpy(pkt, tmpl, total);
+        sr_handlepacket(sr, pkt + sizeof(c_packet_header), len,
+                        (char*)(pkt + sizeof(c_base)));
+    }
+    t = bench_now() - t0;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(out, 1);
+    dup2(err, 2);
+    close(out);
+    close(err);
+    close(devnull);
+
+    return iters / t;
+}
+
+static int bench_forward(int argc, char** argv)
+{
+    struct sr_instance sr;
+    uint32_t iters = (argc > 1) ? atoi(argv[1]) : 2000000;
+
+    bench_router_init(&sr);
+
+    printf("%-40s %12s\n", "log setting", "packets/s");
+
+    sr_log_level = SR_LOG_DEBUG;
+    sr_log_dump_rate = 1000000000;
+    printf("%-40s %12.0f\n", "-d 3, every header dumped (old output)",
+           bench_forward_run(&sr, iters / 10));
+
+    sr_log_dump_rate = 10;
+    printf("%-40s %12.0f\n", "-d 3 -D 10", bench_forward_run(&sr, iters / 10));
+
+    sr_log_level = SR_LOG_INFO;
+    sr_log_dump_rate = 0;
+    printf("%-40s %12.0f\n", "default", bench_forward_run(&sr, iters));
+
+    if (SR_LOG_LEVEL < SR_LOG_DEBUG)
+    { printf("(built with SR_LOG_LEVEL=%d)\n", SR_LOG_LEVEL); }
+
+    close(sr.sockfd);
+    return 0;
+} /* -- bench_forward -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_nat(..)
+ *
+ * Fills the NAT with n TCP mappings, then looks up random existing ones
+ * by internal (ip, port) and by external port through the _r calls,
+ * which fill in a binding on the stack.  The copy column is the external
+ * lookup that hands back a malloc'd mapping (freed here), the list
+ * column walks the mapping lists the way every lookup used to.  a/lk
+ * and a/cp are nat allocations per _r and per copying lookup.  One external
+ * address has 64512 ports per type, so that is as large as the table
+ * gets.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned long bench_nat_allocs(struct sr_nat* nat)
+{
+    struct sr_nat_stats st;
+
+    sr_nat_get_stats(nat, &st);
+    return st.allocs;
+}
+
+static struct sr_nat_mapping* bench_nat_list_lookup(struct sr_nat* nat,
+                                                    uint32_t ip, uint16_t aux)
+{
+    struct sr_nat_mapping* m = 0;
+    unsigned int i;
+
+    for (i = 0; i < nat->nshards && !m; i++)
+    {
+        pthread_mutex_lock(&nat->shards[i].lock);
+        for (m = nat->shards[i].mappings; m; m = m->next)
+        {
+            if (m->ip_int == ip && m->aux_int == aux && m->type == nat_mapping_tcp)
+            { break; }
+        }
+        pthread_mutex_unlock(&nat->shards[i].lock);
+    }
+    return m;
+}
+
+static void bench_nat_run(uint32_t n)
+{
+    const uint32_t iters = 2000000;
+    struct sr_nat nat;
+    struct sr_nat_binding b;
+    struct sr_nat_mapping* m;
+    uint32_t* ips = malloc(n * sizeof(uint32_t));
+    uint16_t* ports = malloc(n * sizeof(uint16_t));
+    uint16_t* exts = malloc(n * sizeof(uint16_t));
+    uint32_t i, j, lin_iters, missing = 0;
+    unsigned long allocs, allocs_r, allocs_copy;
+    double t0, t_ins, t_int, t_ext, t_copy, t_lin;
+
+    if (!ips || !ports || !exts)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    sr_nat_init(&nat);
+
+    /* a few hundred hosts with many flows each */
+    for (i = 0; i < n; i++)
+    {
+        ips[i] = htonl(0xc0a80000 | (bench_rand() % 512));
+        ports[i] = (uint16_t)i;
+    }
+
+    t0 = bench_now();
+    for (i = 0; i < n; i++)
+    {
+        if (sr_nat_insert_mapping_r(&nat, ips[i], ports[i], nat_mapping_tcp, &b) != 0)
+        {
+            fprintf(stderr, "insert %u failed\n", i);
+            exit(1);
+        }
+        exts[i] = b.aux_ext;
+    }
+    t_ins = bench_now() - t0;
+
+    allocs = bench_nat_allocs(&nat);
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        j = bench_rand() % n;
+        if (sr_nat_lookup_internal_r(&nat, ips[j], ports[j], nat_mapping_tcp, &b) != 0 ||
+            b.aux_ext != exts[j])
+        { missing++; }
+    }
+    t_int = bench_now() - t0;
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        j = bench_rand() % n;
+        if (sr_nat_lookup_external_r(&nat, exts[j], nat_mapping_tcp, &b) != 0 ||
+            b.ip_int != ips[j] || b.aux_int != ports[j])
+        { missing++; }
+    }
+    t_ext = bench_now() - t0;
+    allocs_r = bench_nat_allocs(&nat) - allocs;
+
+    /* the copying call, for comparison */
+    allocs = bench_nat_allocs(&nat);
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        j = bench_rand() % n;
+        m = sr_nat_lookup_external(&nat, exts[j], nat_mapping_tcp);
+        if (!m || m->ip_int != ips[j] || m->aux_int != ports[j])
+        { missing++; }
+        free(m);
+    }
+    t_copy = bench_now() - t0;
+    allocs_copy = bench_nat_allocs(&nat) - allocs;
+
+    lin_iters = 200000000 / n;
+    t0 = bench_now();
+    for (i = 0; i < lin_iters; i++)
+    {
+        j = bench_rand() % n;
+        bench_sink += (uintptr_t)bench_nat_list_lookup(&nat, ips[j], ports[j]);
+    }
+    t_lin = bench_now() - t0;
+
+    printf("%8u  %12.0f  %12.0f  %12.0f  %12.0f  %12.0f  %5.2f  %5.2f  %u\n", n,
+           n / t_ins, iters / t_int, iters / t_ext, iters / t_copy, lin_iters / t_lin,
+           (double)allocs_r / (2 * iters), (double)allocs_copy / iters, missing);
+
+    sr_nat_destroy(&nat);
+    free(ips);
+    free(ports);
+    free(exts);
+}
+
+/* Port allocator under churn: the ICMP pool is kept one short of full
+   while the oldest mapping is removed and a new one inserted, so every
+   allocation has to find the single free id.  One shard, so that the
+   pool is the whole range and the free id is always the new flow's. */
+static void bench_nat_churn(void)
+{
+    const uint32_t iters = 2000000;
+    struct sr_nat nat;
+    struct sr_nat_mapping* m;
+    uint32_t pool = SR_NAT_PORT_MAX - SR_NAT_PORT_MIN + 1;
+    uint16_t* ring = malloc(pool * sizeof(uint16_t));
+    uint32_t i, head = 0, tail = 0, failed = 0;
+    struct sr_nat_stats st;
+    double t0, t;
+
+    sr_nat_init_shards(&nat, 1);
+    nat.port_reuse_delay = 0;
+
+    for (i = 0; i < pool - 1; i++)
+    {
+        m = sr_nat_insert_mapping(&nat, htonl(0xc0a80000 | (i >> 8)),
+                                  (uint16_t)i, nat_mapping_icmp);
+        ring[tail++] = m->aux_ext;
+        free(m);
+    }
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    {
+        sr_nat_remove_mapping(&nat, ring[head], nat_mapping_icmp);
+        head = (head + 1) % pool;
+        m = sr_nat_insert_mapping(&nat, htonl(0xc0a90000 | (i >> 8)),
+                                  (uint16_t)i, nat_mapping_icmp);
+        if (!m)
+        {
+            failed++;
+            continue;
+        }
+        ring[tail] = m->aux_ext;
+        tail = (tail + 1) % pool;
+        free(m);
+    }
+    t = bench_now() - t0;
+
+    /* fill the last id, then one more must fail */
+    free(sr_nat_insert_mapping(&nat, htonl(0x0a0a0a0a), 1, nat_mapping_icmp));
+    m = sr_nat_insert_mapping(&nat, htonl(0x0a0a0a0a), 2, nat_mapping_icmp);
+    sr_nat_get_stats(&nat, &st);
+
+    printf("\nchurn at %u/%u ids: %.0f remove+insert/s, %u failed, "
+           "exhausted %lu (%s)\n", pool - 1, pool, iters / t, failed,
+           st.exhausted[nat_mapping_icmp],
+           m ? "WRONG, got an id" : "ok");
+
+    free(m);
+    sr_nat_destroy(&nat);
+    free(ring);
+}
+
+static int bench_nat(int argc, char** argv)
+{
+    uint32_t sizes[] = { 1000, 10000, 60000 };
+    unsigned int i;
+
+    printf("%8s  %12s  %12s  %12s  %12s  %12s  %5s  %5s  %s\n", "mappings",
+           "inserts/s", "int look/s", "ext look/s", "copy look/s", "list look/s",
+           "a/lk", "a/cp", "wrong");
+
+    if (argc > 1)
+    {
+        bench_nat_run(atoi(argv[1]));
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    { bench_nat_run(sizes[i]); }
+
+    bench_nat_churn();
+    return 0;
+} /* -- bench_nat -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_expire(..)
+ *
+ * Opens n established TCP connections through the NAT (up to 50000
+ * mappings, several peers each), then times the timeout thread's work:
+ * a second with nothing to expire, and the second in which 1% of the
+ * connections, reset earlier, run out their transitory timeout.  The
+ * scan column is one pass over every mapping and connection, which is
+ * what each tick cost before the timer wheel.  Time is driven through
+ * sr_nat_expire(), so nothing has to actually wait.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint32_t bench_expire_scan(struct sr_nat* nat, time_t now)
+{
+    struct sr_nat_mapping* m;
+    struct sr_nat_connection* c;
+    uint32_t due = 0;
+    unsigned int i;
+
+    for (i = 0; i < nat->nshards; i++)
+    {
+        pthread_mutex_lock(&nat->shards[i].lock);
+        for (m = nat->shards[i].mappings; m; m = m->next)
+        {
+            for (c = m->conns; c; c = c->next)
+            {
+                if (now - c->last_updated >= nat->tcp_trans_timeout &&
+                    c->state != connection_established)
+                { due++; }
+            }
+        }
+        pthread_mutex_unlock(&nat->shards[i].lock);
+    }
+    return due;
+}
+
+static void bench_expire_run(uint32_t n)
+{
+    const uint32_t idle_ticks = 200;
+    struct sr_nat nat;
+    struct sr_nat_mapping* m;
+    uint32_t nmap = n < 50000 ? n : 50000;
+    uint16_t* exts = malloc(nmap * sizeof(uint16_t));
+    uint32_t i, peer, nreset = n / 100, wrong = 0;
+    struct sr_nat_stats st;
+    unsigned int before, after;
+    time_t base;
+    double t0, t_idle, t_scan, t_exp;
+
+    if (!exts)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    sr_nat_init(&nat);
+
+    for (i = 0; i < nmap; i++)
+    {
+        m = sr_nat_insert_mapping(&nat, htonl(0xc0a80000 | (i >> 8)),
+                                  (uint16_t)i, nat_mapping_tcp);
+        exts[i] = m->aux_ext;
+        free(m);
+    }
+
+    /* connection i goes through mapping i % nmap to peer i / nmap */
+    for (i = 0; i < n; i++)
+    {
+        peer = htonl(0x08000000 | (i / nmap));
+        sr_nat_tcp_track(&nat, exts[i % nmap], peer, htons(80),
+                         TCP_SYN, SR_NAT_OUTBOUND);
+        sr_nat_tcp_track(&nat, exts[i % nmap], peer, htons(80),
+                         TCP_SYN | TCP_ACK, SR_NAT_INBOUND);
+        if (sr_nat_tcp_track(&nat, exts[i % nmap], peer, htons(80),
+                             TCP_ACK, SR_NAT_OUTBOUND) != connection_established)
+        { wrong++; }
+    }
+
+    /* reset the first 1%, spread over the mappings, at nat time base
+       (or base + 1 if the timeout thread gets in) */
+    base = time(NULL);
+    sr_nat_expire(&nat, base);
+    for (i = 0; i < nreset; i++)
+    {
+        peer = htonl(0x08000000 | (i / nmap));
+        if (sr_nat_tcp_track(&nat, exts[i % nmap], peer, htons(80),
+                             TCP_RST, SR_NAT_INBOUND) != connection_closed)
+        { wrong++; }
+    }
+
+    t0 = bench_now();
+    for (i = 1; i <= idle_ticks; i++)
+    { sr_nat_expire(&nat, base + i); }
+    t_idle = bench_now() - t0;
+
+    t0 = bench_now();
+    for (i = 1; i <= idle_ticks; i++)
+    { bench_sink += bench_expire_scan(&nat, base + i); }
+    t_scan = bench_now() - t0;
+
+    /* up to the second before the resets run out, then that second (or
+       two, if the clock ticked over while resetting) */
+    sr_nat_expire(&nat, base + nat.tcp_trans_timeout - 1);
+    sr_nat_get_stats(&nat, &st);
+    before = st.timers;
+
+    t0 = bench_now();
+    sr_nat_expire(&nat, base + nat.tcp_trans_timeout + 1);
+    t_exp = bench_now() - t0;
+
+    sr_nat_get_stats(&nat, &st);
+    after = st.timers;
+
+    /* a mapping goes with its last connection, so only those with a
+       single one are gone */
+    if (before - after != nreset ||
+        st.count != (n == nmap ? nmap - nreset : nmap))
+    { wrong++; }
+
+    printf("%8u  %12.0f  %12.0f  %8u  %12.0f  %u\n", n,
+           t_idle / idle_ticks * 1e9, t_scan / idle_ticks * 1e9,
+           before - after, t_exp / (nreset ? nreset : 1) * 1e9, wrong);
+
+    sr_nat_destroy(&nat);
+    free(exts);
+}
+
+static int bench_expire(int argc, char** argv)
+{
+    uint32_t sizes[] = { 10000, 100000, 1000000 };
+    unsigned int i;
+
+    printf("%8s  %12s  %12s  %8s  %12s  %s\n", "conns", "idle tick ns",
+           "scan tick ns", "expired", "ns/expired", "wrong");
+
+    if (argc > 1)
+    {
+        bench_expire_run(atoi(argv[1]));
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    { bench_expire_run(sizes[i]); }
+    return 0;
+} /* -- bench_expire -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_udp(..)
+ *
+ * Replays a DNS-like trace through the NAT the way the forwarding path
+ * uses it: each flow is a query from one of 1024 internal hosts (random
+ * source port) to 8.8.8.8:53, translated outbound (lookup, insert on a
+ * miss, rewrite of the source), and its answer, translated back (lookup
+ * by external port, rewrite of the destination).  Flows arrive at 1000
+ * per second of nat time and mappings idle out after 20 seconds, so the
+ * table churns through tens of thousands of short-lived mappings while
+ * the port pool cycles with its reuse delay.  Every 16th packet is
+ * checked against a full recompute of its checksums.
+ *
+ * Then times the rewrite alone, incremental vs. recomputing the
+ * transport checksum over pseudo-header and payload.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_UDP_PAYLOAD 40
+#define BENCH_UDP_PKT (sizeof(sr_ip_hdr_t) + sizeof(sr_udp_hdr_t) + BENCH_UDP_PAYLOAD)
+
+/* TCP or UDP checksum over pseudo-header and segment, as it should be
+   stored */
+static uint16_t bench_l4_cksum(const sr_ip_hdr_t* ip)
+{
+    uint8_t buf[12 + 1500];
+    uint16_t len = ntohs(ip->ip_len) - ip->ip_hl * 4;
+    size_t off = ip->ip_p == ip_protocol_tcp ? offsetof(sr_tcp_hdr_t, tcp_sum)
+                                             : offsetof(sr_udp_hdr_t, udp_sum);
+    uint16_t sum;
+
+    memcpy(buf, &ip->ip_src, 4);
+    memcpy(buf + 4, &ip->ip_dst, 4);
+    buf[8] = 0;
+    buf[9] = ip->ip_p;
+    buf[10] = len >> 8;
+    buf[11] = len & 0xff;
+    memcpy(buf + 12, (const uint8_t*)ip + ip->ip_hl * 4, len);
+    memset(buf + 12 + off, 0, 2);
+
+    sum = cksum(buf, 12 + len);
+    return (sum || ip->ip_p == ip_protocol_tcp) ? sum : 0xffff;
+}
+
+static int bench_udp_ok(const sr_ip_hdr_t* ip)
+{
+    const sr_udp_hdr_t* udp = (const sr_udp_hdr_t*)(ip + 1);
+
+    return cksum_verify(ip, sizeof(sr_ip_hdr_t)) &&
+           udp->udp_sum == bench_l4_cksum(ip);
+}
+
+static void bench_udp_build(uint8_t* pkt, uint32_t src, uint16_t sport)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)pkt;
+    sr_udp_hdr_t* udp = (sr_udp_hdr_t*)(ip + 1);
+    unsigned int i;
+
+    memset(pkt, 0, BENCH_UDP_PKT);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(BENCH_UDP_PKT);
+    ip->ip_ttl = 64;
+    ip->ip_p = ip_protocol_udp;
+    ip->ip_src = src;
+    ip->ip_dst = htonl(0x08080808);
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    udp->udp_sport = sport;
+    udp->udp_dport = htons(53);
+    udp->udp_len = htons(BENCH_UDP_PKT - sizeof(sr_ip_hdr_t));
+    for (i = 0; i < BENCH_UDP_PAYLOAD; i++)
+    { pkt[sizeof(sr_ip_hdr_t) + sizeof(sr_udp_hdr_t) + i] = (uint8_t)bench_rand(); }
+    udp->udp_sum = bench_l4_cksum(ip);
+}
+
+/* the answer: same packet with the endpoints swapped, sums still valid */
+static void bench_udp_answer(uint8_t* pkt)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)pkt;
+    sr_udp_hdr_t* udp = (sr_udp_hdr_t*)(ip + 1);
+    uint32_t a = ip->ip_src;
+    uint16_t p = udp->udp_sport;
+
+    ip->ip_src = ip->ip_dst;
+    ip->ip_dst = a;
+    udp->udp_sport = udp->udp_dport;
+    udp->udp_dport = p;
+}
+
+static int bench_udp(int argc, char** argv)
+{
+    uint32_t flows = (argc > 1) ? atoi(argv[1]) : 300000;
+    const uint32_t rate = 1000;
+    struct sr_nat nat;
+    struct sr_nat_binding b;
+    uint8_t* trace = malloc((size_t)flows * BENCH_UDP_PKT);
+    uint8_t* pkt;
+    sr_ip_hdr_t* ip;
+    sr_udp_hdr_t* udp;
+    uint32_t i, src, peak = 0, failed = 0, wrong = 0, bad = 0, iters;
+    uint16_t sport, ext;
+    struct sr_nat_stats st;
+    time_t base;
+    double t0, t_replay, t_incr, t_full;
+
+    if (!trace)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < flows; i++)
+    {
+        bench_udp_build(trace + (size_t)i * BENCH_UDP_PKT,
+                        htonl(0x0a000000 | (bench_rand() % 1024)),
+                        htons(1024 + bench_rand() % 64000));
+    }
+
+    sr_nat_init(&nat);
+    nat.ip_ext = htonl(0xb848680d);
+    nat.udp_timeout = 20;
+    base = time(NULL);
+    sr_nat_expire(&nat, base);
+
+    t0 = bench_now();
+    for (i = 0; i < flows; i++)
+    {
+        if (i % rate == 0)
+        {
+            sr_nat_expire(&nat, base + i / rate);
+            sr_nat_get_stats(&nat, &st);
+            if (st.count > peak)
+            { peak = st.count; }
+        }
+
+        pkt = trace + (size_t)i * BENCH_UDP_PKT;
+        ip = (sr_ip_hdr_t*)pkt;
+        udp = (sr_udp_hdr_t*)(ip + 1);
+        src = ip->ip_src;
+        sport = udp->udp_sport;
+
+        /* query, outbound */
+        if (sr_nat_lookup_internal_r(&nat, src, sport, nat_mapping_udp, &b) != 0 &&
+            sr_nat_insert_mapping_r(&nat, src, sport, nat_mapping_udp, &b) != 0)
+        {
+            failed++;
+            continue;
+        }
+        ip_rewrite_endpoint(ip, 0, b.ip_ext, htons(b.aux_ext));
+        if (i % 16 == 0 && !bench_udp_ok(ip))
+        { bad++; }
+
+        /* answer, inbound */
+        bench_udp_answer(pkt);
+        ext = ntohs(udp->udp_dport);
+        if (sr_nat_lookup_external_r(&nat, ext, nat_mapping_udp, &b) != 0)
+        {
+            wrong++;
+            continue;
+        }
+        ip_rewrite_endpoint(ip, 1, b.ip_int, b.aux_int);
+        if (ip->ip_dst != src || udp->udp_dport != sport)
+        { wrong++; }
+        if (i % 16 == 0 && !bench_udp_ok(ip))
+        { bad++; }
+    }
+    t_replay = bench_now() - t0;
+    sr_nat_get_stats(&nat, &st);
+
+    printf("replay: %u flows at %u/s of nat time, udp timeout %d s\n",
+           flows, rate, nat.udp_timeout);
+    printf("  %.0f flows/s (%.0f packets/s), peak %u mappings, %u left\n",
+           flows / t_replay, 2 * flows / t_replay, peak, st.count);
+    printf("  failed %u (exhausted %lu, cooling %lu), wrong %u, bad sums %u\n",
+           failed, st.exhausted[nat_mapping_udp],
+           st.cooling[nat_mapping_udp], wrong, bad);
+    printf("  %lu nat allocations over %u flows, one per new mapping\n",
+           st.allocs, flows);
+    sr_nat_destroy(&nat);
+
+    /* rewrite alone, back and forth on one packet */
+    iters = 20000000;
+    pkt = trace;
+    ip = (sr_ip_hdr_t*)pkt;
+    udp = (sr_udp_hdr_t*)(ip + 1);
+    src = ip->ip_src;
+
+    t0 = bench_now();
+    for (i = 0; i < iters; i++)
+    { ip_rewrite_endpoint(ip, 0, src ^ (i & 1), htons((uint16_t)i)); }
+    t_incr = bench_now() - t0;
+    if (!bench_udp_ok(ip))
+    { bad++; }
+
+    t0 = bench_now();
+    for (i = 0; i < iters / 10; i++)
+    {
+        ip->ip_src = src ^ (i & 1);
+        udp->udp_sport = htons((uint16_t)i);
+        ip->ip_sum = 0;
+        ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+        udp->udp_sum = bench_l4_cksum(ip);
+    }
+    t_full = bench_now() - t0;
+
+    printf("\nrewrite (%u byte datagram): incremental %.0f/s, recompute %.0f/s, "
+           "bad sums %u\n", (unsigned int)(BENCH_UDP_PKT - sizeof(sr_ip_hdr_t)),
+           iters / t_incr, iters / 10 / t_full, bad);
+
+    free(trace);
+    return 0;
+} /* -- bench_udp -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_natfwd(..)
+ *
+ * NAT mode end to end, through the pcap replay backend.  The bench router
+ * gets a private network 10.1.0.0/16 behind 10.0.1.2 on eth1 (inside);
+ * eth2 (10.0.2.1) is the outside and the external address.  n flows, half
+ * UDP, a quarter TCP SYNs and a quarter pings, go out to 93.184.216.0/24;
+ * their answers come back to the mapped ports.  Each direction is written
+ * to a pcap and replayed:
+ *
+ *   outbound, no NAT     the same frames, plain forwarding
+ *   outbound, new        first pass, every packet creates its mapping
+ *   outbound, mapped     further passes over existing mappings
+ *   inbound              answers, translated back
+ *
+ * Then one more pass of each direction is written out and every frame
+ * checked: IP and transport checksums against a full recompute, and the
+ * translated address.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_NATFWD_PASSES 5
+
+static const unsigned char bench_natfwd_inmac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 1, 2 };
+static const unsigned char bench_natfwd_outmac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 2, 2 };
+
+/* Ethernet + IP + transport frame with valid checksums; aux is the
+   source port or icmp id, peer_port the destination port */
+static unsigned int bench_natfwd_frame(uint8_t* buf, struct sr_instance* sr,
+                                       const char* iface, const unsigned char* smac,
+                                       uint8_t proto, uint32_t src, uint16_t aux,
+                                       uint32_t dst, uint16_t peer_port, uint8_t kind)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)buf;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    uint8_t* l4 = (uint8_t*)(ip + 1);
+    unsigned int l4len;
+
+    if (proto == ip_protocol_udp)
+    { l4len = sizeof(sr_udp_hdr_t) + 64; }
+    else if (proto == ip_protocol_tcp)
+    { l4len = sizeof(sr_tcp_hdr_t); }
+    else
+    { l4len = 8 + 56; }
+
+    memset(buf, 0, sizeof(*eth) + sizeof(*ip) + l4len);
+    memcpy(eth->ether_dhost, sr_get_interface(sr, iface)->addr, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, smac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(sizeof(*ip) + l4len);
+    ip->ip_ttl = 64;
+    ip->ip_p = proto;
+    ip->ip_src = src;
+    ip->ip_dst = dst;
+    ip->ip_sum = cksum(ip, sizeof(*ip));
+
+    if (proto == ip_protocol_udp)
+    {
+        sr_udp_hdr_t* udp = (sr_udp_hdr_t*)l4;
+        udp->udp_sport = aux;
+        udp->udp_dport = peer_port;
+        udp->udp_len = htons(l4len);
+        memset(udp + 1, 0x5a, l4len - sizeof(*udp));
+        udp->udp_sum = bench_l4_cksum(ip);
+    }
+    else if (proto == ip_protocol_tcp)
+    {
+        sr_tcp_hdr_t* tcp = (sr_tcp_hdr_t*)l4;
+        tcp->tcp_sport = aux;
+        tcp->tcp_dport = peer_port;
+        tcp->tcp_seq = htonl(bench_rand());
+        tcp->tcp_off = 5 << 4;
+        tcp->tcp_flags = kind;
+        tcp->tcp_win = htons(65535);
+        tcp->tcp_sum = bench_l4_cksum(ip);
+    }
+    else
+    {
+        sr_icmp_t8_hdr_t* icmp = (sr_icmp_t8_hdr_t*)l4;
+        icmp->icmp_type = kind;
+        icmp->identifier = aux;
+        icmp->sequence_num = htons(1);
+        memset(l4 + 8, 0x5a, l4len - 8);
+        icmp->icmp_sum = cksum(l4, l4len);
+    }
+
+    return sizeof(*eth) + sizeof(*ip) + l4len;
+}
+
+static void bench_natfwd_write(FILE* fp, const uint8_t* frame, unsigned int len)
+{
+    struct pcap_pkthdr h;
+
+    gettimeofday(&h.ts, 0);
+    h.caplen = h.len = len;
+    sr_dump(fp, &h, frame);
+}
+
+/* Replay pcap through sr; the backend prints the rate when done. */
+static void bench_natfwd_replay(struct sr_instance* sr, const char* label,
+                                const char* pcap, const char* out, int passes)
+{
+    printf("\n-- %s\n", label);
+    fflush(stdout);
+    if (sr_replay_open(sr, pcap, out, passes, 0) != 0)
+    {
+        fprintf(stderr, "replay of %s failed\n", pcap);
+        exit(1);
+    }
+    while (sr->io->read(sr) == 1);
+    sr->io->close(sr);
+    sr->io = 0;
+}
+
+/* Check every frame of a replay output pcap; inbound frames must be for
+   the private network, outbound ones from the external address. */
+static uint32_t bench_natfwd_check(const char* pcap, uint32_t ip_ext, int inbound,
+                                   uint32_t* nframes)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    uint8_t buf[2048];
+    uint32_t bad = 0;
+    FILE* fp = fopen(pcap, "rb");
+
+    *nframes = 0;
+    if (!fp || fread(&fh, sizeof(fh), 1, fp) != 1)
+    { return 1; }
+
+    while (fread(&ph, sizeof(ph), 1, fp) == 1)
+    {
+        sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+        uint8_t* l4 = (uint8_t*)ip + sizeof(sr_ip_hdr_t);
+        int ok;
+
+        if (ph.caplen > sizeof(buf) || fread(buf, ph.caplen, 1, fp) != 1)
+        {
+            bad++;
+            break;
+        }
+        (*nframes)++;
+
+        ok = cksum_verify(ip, ip->ip_hl * 4);
+        if (ip->ip_p == ip_protocol_icmp)
+        { ok = ok && cksum_verify(l4, ntohs(ip->ip_len) - ip->ip_hl * 4); }
+        else if (ip->ip_p == ip_protocol_udp)
+        { ok = ok && ((sr_udp_hdr_t*)l4)->udp_sum == bench_l4_cksum(ip); }
+        else
+        { ok = ok && ((sr_tcp_hdr_t*)l4)->tcp_sum == bench_l4_cksum(ip); }
+
+        if (inbound)
+        { ok = ok && (ntohl(ip->ip_dst) >> 16) == 0x0a01; }
+        else
+        { ok = ok && ip->ip_src == ip_ext; }
+
+        if (!ok)
+        { bad++; }
+    }
+
+    fclose(fp);
+    return bad;
+}
+
+static int bench_natfwd(int argc, char** argv)
+{
+    uint32_t n = (argc > 1) ? atoi(argv[1]) : 30000;
+    struct sr_instance sr;
+    struct sr_nat_binding b;
+    struct sr_nat_stats st;
+    struct in_addr dest, gw, mask;
+    unsigned long allocs;
+    char* inside[] = { "eth1" };
+    char out_pcap[64], in_pcap[64], res_pcap[64];
+    uint8_t frame[256];
+    unsigned int len;
+    uint32_t i, host, peer, frames, bad;
+    uint16_t aux, peer_port;
+    uint8_t proto;
+    FILE* fp;
+
+    bench_router_init(&sr);
+    dest.s_addr = htonl(0x0a010000);
+    gw.s_addr = htonl(0x0a000102);
+    mask.s_addr = htonl(0xffff0000);
+    sr_add_rt_entry(&sr, dest, gw, mask, "eth1");
+    sr_fib_build(&sr.fib, sr.routing_table);
+    sr_arpcache_insert(&sr.cache, (unsigned char*)bench_natfwd_inmac, gw.s_addr);
+
+    sprintf(out_pcap, "/tmp/sr_bench_nat_out.%d.pcap", (int)getpid());
+    sprintf(in_pcap, "/tmp/sr_bench_nat_in.%d.pcap", (int)getpid());
+    sprintf(res_pcap, "/tmp/sr_bench_nat_res.%d.pcap", (int)getpid());
+
+    /* flow i: host 10.1.x.y, source port/id from i, peer 93.184.216.z */
+    if ((fp = sr_dump_open(out_pcap, 0, 65535)) == 0)
+    { return 1; }
+    for (i = 0; i < n; i++)
+    {
+        host = htonl(0x0a010000 | (i % 4096));
+        peer = htonl(0x5db8d800 | (i % 250));
+        aux = htons(10000 + i / 4);
+        if (i % 4 < 2)
+        { len = bench_natfwd_frame(frame, &sr, "eth1", bench_natfwd_inmac, ip_protocol_udp,
+                                   host, aux, peer, htons(443), 0); }
+        else if (i % 4 == 2)
+        { len = bench_natfwd_frame(frame, &sr, "eth1", bench_natfwd_inmac, ip_protocol_tcp,
+                                   host, aux, peer, htons(80), TCP_SYN); }
+        else
+        { len = bench_natfwd_frame(frame, &sr, "eth1", bench_natfwd_inmac, ip_protocol_icmp,
+                                   host, aux, peer, 0, SR_NAT_ICMP_ECHO_REQUEST); }
+        bench_natfwd_write(fp, frame, len);
+    }
+    sr_dump_close(fp);
+
+    bench_natfwd_replay(&sr, "outbound, no NAT", out_pcap, 0, BENCH_NATFWD_PASSES);
+
+    if (sr_enable_nat(&sr, inside, 1) != 0)
+    { return 1; }
+    bench_natfwd_replay(&sr, "outbound, new mappings", out_pcap, 0, 1);
+    allocs = bench_nat_allocs(&sr.nat);
+    printf("nat allocations: %lu\n", allocs);
+    bench_natfwd_replay(&sr, "outbound, mapped", out_pcap, 0, BENCH_NATFWD_PASSES);
+    printf("nat allocations: %lu\n", bench_nat_allocs(&sr.nat) - allocs);
+
+    /* the answers, to whatever external ports the flows got */
+    if ((fp = sr_dump_open(in_pcap, 0, 65535)) == 0)
+    { return 1; }
+    for (i = 0; i < n; i++)
+    {
+        host = htonl(0x0a010000 | (i % 4096));
+        peer = htonl(0x5db8d800 | (i % 250));
+        aux = htons(10000 + i / 4);
+        proto = i % 4 < 2 ? ip_protocol_udp : i % 4 == 2 ? ip_protocol_tcp : ip_protocol_icmp;
+        if (sr_nat_lookup_internal_r(&sr.nat, host, aux,
+                                     proto == ip_protocol_udp ? nat_mapping_udp :
+                                     proto == ip_protocol_tcp ? nat_mapping_tcp :
+                                     nat_mapping_icmp, &b) != 0)
+        {
+            fprintf(stderr, "flow %u has no mapping\n", i);
+            return 1;
+        }
+        peer_port = htons(b.aux_ext);
+        if (proto == ip_protocol_icmp)
+        { len = bench_natfwd_frame(frame, &sr, "eth2", bench_natfwd_outmac, proto,
+                                   peer, peer_port, sr.nat.ip_ext, 0,
+                                   SR_NAT_ICMP_ECHO_REPLY); }
+        else
+        { len = bench_natfwd_frame(frame, &sr, "eth2", bench_natfwd_outmac, proto,
+                                   peer, proto == ip_protocol_udp ? htons(443) : htons(80),
+                                   sr.nat.ip_ext, peer_port, TCP_SYN | TCP_ACK); }
+        bench_natfwd_write(fp, frame, len);
+    }
+    sr_dump_close(fp);
+
+    allocs = bench_nat_allocs(&sr.nat);
+    bench_natfwd_replay(&sr, "inbound", in_pcap, 0, BENCH_NATFWD_PASSES);
+    printf("nat allocations: %lu\n", bench_nat_allocs(&sr.nat) - allocs);
+
+    sr_nat_get_stats(&sr.nat, &st);
+    printf("\nnat: outbound %lu translated %lu dropped, inbound %lu translated %lu dropped\n",
+           st.translated[SR_NAT_OUTBOUND], st.dropped[SR_NAT_OUTBOUND],
+           st.translated[SR_NAT_INBOUND], st.dropped[SR_NAT_INBOUND]);
+
+    /* one more pass each way, written out and checked */
+    bench_natfwd_replay(&sr, "outbound, checked", out_pcap, res_pcap, 1);
+    bad = bench_natfwd_check(res_pcap, sr.nat.ip_ext, 0, &frames);
+    printf("outbound: %u frames out, %u bad\n", frames, bad);
+    bench_natfwd_replay(&sr, "inbound, checked", in_pcap, res_pcap, 1);
+    bad = bench_natfwd_check(res_pcap, sr.nat.ip_ext, 1, &frames);
+    printf("inbound: %u frames out, %u bad\n", frames, bad);
+
+    unlink(out_pcap);
+    unlink(in_pcap);
+    unlink(res_pcap);
+    sr_nat_destroy(&sr.nat);
+    close(sr.sockfd);
+    return 0;
+} /* -- bench_natfwd -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_natmt(..)
+ *
+ * Translation throughput as threads are added.  Each thread owns 1024
+ * UDP flows from its own internal hosts and runs them through
+ * sr_nat_translate() outbound, then their answers inbound, which puts
+ * every packet back the way it was.  The mappings are made before the
+ * clock starts, so this is the steady state: lookup, rewrite and the
+ * lock.  A fixed amount of work is split over 1 to 16 threads, on a
+ * table of one shard (one lock, as before sharding) and of
+ * SR_NAT_SHARDS.  Wall-clock time, so on fewer cores than threads the
+ * columns show lock overhead rather than scaling.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_NATMT_FLOWS   1024
+#define BENCH_NATMT_THREADS 16
+
+struct bench_natmt_worker
+{
+    struct sr_nat* nat;
+    uint8_t* pkts;              /* BENCH_NATMT_FLOWS queries */
+    uint32_t rounds;
+    pthread_barrier_t* start;
+    uint32_t wrong;
+};
+
+static void* bench_natmt_thread(void* arg)
+{
+    struct bench_natmt_worker* w = (struct bench_natmt_worker*)arg;
+    sr_ip_hdr_t* ip;
+    sr_udp_hdr_t* udp;
+    uint32_t i, j, src;
+    uint16_t sport;
+
+    pthread_barrier_wait(w->start);
+
+    for (i = 0; i < w->rounds; i++)
+    {
+        for (j = 0; j < BENCH_NATMT_FLOWS; j++)
+        {
+            ip = (sr_ip_hdr_t*)(w->pkts + (size_t)j * BENCH_UDP_PKT);
+            udp = (sr_udp_hdr_t*)(ip + 1);
+            src = ip->ip_src;
+            sport = udp->udp_sport;
+
+            if (sr_nat_translate(w->nat, ip, BENCH_UDP_PKT, SR_NAT_OUTBOUND) != SR_NAT_OK)
+            { w->wrong++; }
+            bench_udp_answer((uint8_t*)ip);
+            if (sr_nat_translate(w->nat, ip, BENCH_UDP_PKT, SR_NAT_INBOUND) != SR_NAT_OK)
+            { w->wrong++; }
+            bench_udp_answer((uint8_t*)ip);
+
+            if (ip->ip_src != src || udp->udp_sport != sport)
+            { w->wrong++; }
+        }
+    }
+    return 0;
+}
+
+/* Translations per second with nthreads threads sharing total rounds. */
+static double bench_natmt_run(struct sr_nat* nat, uint8_t* pkts,
+                              unsigned int nthreads, uint32_t total,
+                              uint32_t* wrong)
+{
+    struct bench_natmt_worker w[BENCH_NATMT_THREADS];
+    pthread_t threads[BENCH_NATMT_THREADS];
+    pthread_barrier_t start;
+    unsigned int t;
+    double t0;
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (t = 0; t < nthreads; t++)
+    {
+        w[t].nat = nat;
+        w[t].pkts = pkts + (size_t)t * BENCH_NATMT_FLOWS * BENCH_UDP_PKT;
+        w[t].rounds = total / nthreads;
+        w[t].start = &start;
+        w[t].wrong = 0;
+        pthread_create(&threads[t], NULL, bench_natmt_thread, &w[t]);
+    }
+
+    pthread_barrier_wait(&start);
+    t0 = bench_now();
+    for (t = 0; t < nthreads; t++)
+    {
+        pthread_join(threads[t], NULL);
+        *wrong += w[t].wrong;
+    }
+    t0 = bench_now() - t0;
+    pthread_barrier_destroy(&start);
+
+    return 2.0 * BENCH_NATMT_FLOWS * (total / nthreads) * nthreads / t0;
+}
+
+static int bench_natmt(int argc, char** argv)
+{
+    uint32_t total = (argc > 1) ? atoi(argv[1]) : 1024;
+    unsigned int nshards[] = { 1, SR_NAT_SHARDS };
+    unsigned int threads[] = { 1, 2, 4, 8, 16 };
+    size_t size = (size_t)BENCH_NATMT_THREADS * BENCH_NATMT_FLOWS * BENCH_UDP_PKT;
+    uint8_t* pkts = malloc(size);
+    struct sr_nat nat[2];
+    struct sr_nat_stats st;
+    double pps[2];
+    uint32_t i, min, max, wrong = 0;
+    unsigned int s, t;
+
+    if (!pkts)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* thread t's flows come from hosts 10.t.x.y */
+    for (i = 0; i < BENCH_NATMT_THREADS * BENCH_NATMT_FLOWS; i++)
+    {
+        bench_udp_build(pkts + (size_t)i * BENCH_UDP_PKT,
+                        htonl(0x0a000000 | (i / BENCH_NATMT_FLOWS) << 16 |
+                              (bench_rand() % 256)),
+                        htons(1024 + i % BENCH_NATMT_FLOWS));
+    }
+
+    for (s = 0; s < 2; s++)
+    {
+        sr_nat_init_shards(&nat[s], nshards[s]);
+        nat[s].ip_ext = htonl(0xb848680d);
+    }
+
+    /* make every mapping up front */
+    bench_natmt_run(&nat[0], pkts, BENCH_NATMT_THREADS, BENCH_NATMT_THREADS, &wrong);
+    bench_natmt_run(&nat[1], pkts, BENCH_NATMT_THREADS, BENCH_NATMT_THREADS, &wrong);
+
+    printf("%8s  %14s  %14s  %8s\n", "threads", "1 shard/s",
+           "sharded/s", "speedup");
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+        for (s = 0; s < 2; s++)
+        { pps[s] = bench_natmt_run(&nat[s], pkts, threads[t], total, &wrong); }
+        printf("%8u  %14.0f  %14.0f  %8.2f\n", threads[t], pps[0], pps[1],
+               pps[1] / pps[0]);
+    }
+
+    /* how evenly the flow hash spread the mappings */
+    min = ~0U;
+    max = 0;
+    for (s = 0; s < nat[1].nshards; s++)
+    {
+        if (nat[1].shards[s].count < min)
+        { min = nat[1].shards[s].count; }
+        if (nat[1].shards[s].count > max)
+        { max = nat[1].shards[s].count; }
+    }
+    sr_nat_get_stats(&nat[1], &st);
+    printf("\n%u shards: %u mappings, %u to %u per shard, %lu dropped\n",
+           nat[1].nshards, st.count, min, max,
+           st.dropped[SR_NAT_OUTBOUND] + st.dropped[SR_NAT_INBOUND]);
+    printf("wrong: %u (%d cpus online)\n", wrong, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    sr_nat_destroy(&nat[0]);
+    sr_nat_destroy(&nat[1]);
+    free(pkts);
+    return 0;
+} /* -- bench_natmt -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_vnsrx(..)
+ *
+ * The VNS receive path end to end over a socketpair: a feeder thread
+ * streams n VNSPACKET frames (the forward bench's frame) into one end,
+ * the router reads them from the other and forwards each back out
+ * through it, where a drain thread throws them away.  The old reader,
+ * reproduced here, did a 4 byte recv(), a malloc() and a read() of the
+ * body per frame; sr_read_from_server now takes in as much as the
+ * socket holds per recv() and handles the frames in place.  With send
+ * batching (-B) the forwarded frames of one recv() also go back out
+ * with a single writev(), and with -V they are handled in vectors.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct bench_vnsrx_feed
+{
+    int fd;
+    uint32_t n;
+    int echo;                   /* pings to the router instead */
+};
+
+struct bench_vnsrx_sink
+{
+    int fd;
+    unsigned long bytes;
+};
+
+/* turn the forward frame into an echo request to eth1's address, from an
+   off-net host so the answer goes out through the cached gateway */
+static void bench_vnsrx_echo(uint8_t* frame)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(c_packet_header) +
+                                     sizeof(sr_ethernet_hdr_t));
+    uint8_t* icmp = (uint8_t*)(ip + 1);
+
+    ip->ip_p = ip_protocol_icmp;
+    ip->ip_src = htonl(0x08080404);
+    ip->ip_dst = htonl(0x0a000101);
+    ip->ip_sum = 0;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+    memset(icmp, 0, 4);
+    icmp[0] = SR_NAT_ICMP_ECHO_REQUEST;
+    ((sr_icmp_hdr_t*)icmp)->icmp_sum = cksum(icmp, BENCH_FWD_PAYLOAD);
+}
+
+static void* bench_vnsrx_feeder(void* arg)
+{
+    struct bench_vnsrx_feed* f = (struct bench_vnsrx_feed*)arg;
+    uint8_t frame[2048];
+    uint8_t* chunk = malloc(65536);
+    unsigned int len = sizeof(c_packet_header) + bench_forward_frame(frame);
+    unsigned int per = 65536 / len, k;
+    uint32_t sent;
+    ssize_t off, ret;
+
+    if (f->echo)
+    { bench_vnsrx_echo(frame); }
+
+    for (k = 0; k < per; k++)
+    { memcpy(chunk + k * len, frame, len); }
+
+    for (sent = 0; sent < f->n; sent += k)
+    {
+        k = f->n - sent < per ? f->n - sent : per;
+        for (off = 0; off < (ssize_t)(k * len); off += ret)
+        {
+            if ((ret = write(f->fd, chunk + off, k * len - off)) <= 0)
+            { break; }
+        }
+    }
+
+    shutdown(f->fd, SHUT_WR);
+    free(chunk);
+    return 0;
+}
+
+static void* bench_vnsrx_drain(void* arg)
+{
+    struct bench_vnsrx_sink* sink = (struct bench_vnsrx_sink*)arg;
+    uint8_t buf[65536];
+    ssize_t ret;
+
+    while ((ret = read(sink->fd, buf, sizeof(buf))) > 0)
+    { sink->bytes += ret; }
+    return 0;
+}
+
+/* the reader before the receive buffer: one frame per call */
+static int bench_vnsrx_legacy(struct sr_instance* sr, unsigned long* reads)
+{
+    uint8_t* buf;
+    int len = 0, ret, got;
+
+    for (got = 0; got < 4; got += ret)
+    {
+        (*reads)++;
+        if ((ret = recv(sr->sockfd, (uint8_t*)&len + got, 4 - got, 0)) <= 0)
+        { return -1; }
+    }
+    len = ntohl(len);
+    if ((buf = malloc(len)) == 0)
+    { return -1; }
+    *((int*)buf) = htonl(len);
+    for (got = 0; got < len - 4; got += ret)
+    {
+        (*reads)++;
+        if ((ret = read(sr->sockfd, buf + 4 + got, len - 4 - got)) <= 0)
+        {
+            free(buf);
+            return -1;
+        }
+    }
+    sr_handlepacket(sr, buf + sizeof(c_packet_header),
+                    len - sizeof(c_packet_header),
+                    (char*)(buf + sizeof(c_base)));
+    free(buf);
+    return 1;
+}
+
+static double bench_vnsrx_run(struct sr_instance* sr, uint32_t n, int legacy,
+                              int batch, int echo, unsigned long* reads,
+                              unsigned long* writes, unsigned long* out)
+{
+    struct bench_vnsrx_feed feed;
+    struct bench_vnsrx_sink sink;
+    pthread_t feeder, drain;
+    int fds[2], err = dup(2), devnull = open("/dev/null", O_WRONLY);
+    double t0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    sr->sockfd = fds[0];
+    memset(&sr->rx, 0, sizeof(sr->rx));
+    memset(&sr->tx, 0, sizeof(sr->tx));
+    sr->tx.enabled = batch;
+    feed.fd = fds[1];
+    feed.n = n;
+    feed.echo = echo;
+    sink.fd = fds[1];
+    sink.bytes = 0;
+    *reads = 0;
+
+    /* the new reader reports the end of the stream */
+    fflush(stderr);
+    dup2(devnull, 2);
+
+    t0 = bench_now();
+    pthread_create(&drain, NULL, bench_vnsrx_drain, &sink);
+    pthread_create(&feeder, NULL, bench_vnsrx_feeder, &feed);
+    if (legacy)
+    { while (bench_vnsrx_legacy(sr, reads) == 1); }
+    else
+    {
+        while (sr_read_from_server(sr) == 1);
+        *reads = sr->rx.reads;
+    }
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(feeder, NULL);
+    pthread_join(drain, NULL);
+    t0 = bench_now() - t0;
+    *writes = sr->tx.writes;
+    *out = sr->tx.frames;
+
+    dup2(err, 2);
+    close(err);
+    close(devnull);
+    if (!legacy && sr->rx.packets != n)
+    { fprintf(stderr, "got %lu of %u packets\n", sr->rx.packets, n); }
+    free(sr->rx.data);
+    free(sr->rx.vec);
+    close(fds[0]);
+    close(fds[1]);
+    return n / t0;
+}
+
+static int bench_vnsrx(int argc, char** argv)
+{
+    uint32_t n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    struct sr_instance sr;
+    unsigned long reads, writes, out;
+    double pps;
+
+    bench_router_init(&sr);
+    close(sr.sockfd);
+
+    printf("%-30s %12s %10s %10s %8s %8s\n", "reader", "packets/s", "reads/pkt",
+           "writes/pkt", "mallocs", "out");
+    pps = bench_vnsrx_run(&sr, n, 1, 0, 0, &reads, &writes, &out);
+    printf("%-30s %12.0f %10.3f %10.3f %8.3f %8lu\n", "recv len, malloc, read body",
+           pps, (double)reads / n, (double)writes / n, 1.0, out);
+    pps = bench_vnsrx_run(&sr, n, 0, 0, 0, &reads, &writes, &out);
+    printf("%-30s %12.0f %10.3f %10.3f %8.3f %8lu\n", "receive buffer", pps,
+           (double)reads / n, (double)writes / n, 0.0, out);
+    pps = bench_vnsrx_run(&sr, n, 0, 1, 0, &reads, &writes, &out);
+    printf("%-30s %12.0f %10.3f %10.3f %8.3f %8lu\n", "receive buffer, batched sends",
+           pps, (double)reads / n, (double)writes / n, 0.0, out);
+    sr.vector = 1;
+    pps = bench_vnsrx_run(&sr, n, 0, 1, 0, &reads, &writes, &out);
+    sr.vector = 0;
+    printf("%-30s %12.0f %10.3f %10.3f %8.3f %8lu\n", "batched sends, vectors (-V)",
+           pps, (double)reads / n, (double)writes / n, 0.0, out);
+
+    /* the router answers these from a buffer of its own, which is
+       copied into the batch */
+    pps = bench_vnsrx_run(&sr, n, 0, 0, 1, &reads, &writes, &out);
+    printf("%-30s %12.0f %10.3f %10.3f %8s %8lu\n", "pings, receive buffer", pps,
+           (double)reads / n, (double)writes / n, "-", out);
+    pps = bench_vnsrx_run(&sr, n, 0, 1, 1, &reads, &writes, &out);
+    printf("%-30s %12.0f %10.3f %10.3f %8s %8lu\n", "pings, batched sends", pps,
+           (double)reads / n, (double)writes / n, "-", out);
+    return 0;
+} /* -- bench_vnsrx -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_pcaplog(..)
+ *
+ * The forward benchmark with -l: every frame sent is written to a pcap
+ * file, inline (sr_dump and fflush per frame) or through the writer
+ * thread with a ring of -q slots, dropping or (-K) blocking when it is
+ * full.  The file is read back afterwards: its record count must match
+ * what was captured, so a capture queued is a capture written.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_PCAPLOG_FILE "/tmp/sr_bench_pcaplog.pcap"
+
+static void bench_pcaplog_run(struct sr_instance* sr, const char* label,
+                              uint32_t iters, int capture, unsigned int slots,
+                              int block)
+{
+    uint8_t frame[2048];
+    unsigned int rec = sizeof(struct pcap_sf_pkthdr) + bench_forward_frame(frame);
+    unsigned long captured = 0, dropped = 0, flushes = 0;
+    unsigned long records = 0;
+    long size;
+    double pps;
+    FILE* fp;
+
+    sr->logfile = 0;
+    sr->logq = 0;
+    if (capture)
+    {
+        sr->logfile = sr_dump_open(BENCH_PCAPLOG_FILE, 0, PACKET_DUMP_SIZE);
+        if (!sr->logfile)
+        {
+            perror(BENCH_PCAPLOG_FILE);
+            exit(1);
+        }
+        if (slots)
+        { sr->logq = sr_dump_async_open(sr->logfile, slots, PACKET_DUMP_SIZE, block); }
+    }
+
+    pps = bench_forward_run(sr, iters);
+
+    if (sr->logq)
+    {
+        captured = sr->logq->captured;
+        dropped = sr->logq->dropped;
+        flushes = sr->logq->flushes;   /* less the final one */
+        sr_dump_async_close(sr->logq);
+    }
+    else if (capture)
+    {
+        captured = iters;
+        flushes = iters;
+    }
+    if (capture)
+    {
+        sr_dump_close(sr->logfile);
+        fp = fopen(BENCH_PCAPLOG_FILE, "r");
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fclose(fp);
+        records = (size - sizeof(struct pcap_file_header)) / rec;
+        unlink(BENCH_PCAPLOG_FILE);
+    }
+
+    printf("%-30s %12.0f %10lu %10lu %10lu %10lu%s\n", label, pps, captured,
+           dropped, records, flushes, records == captured ? "" : "  MISMATCH");
+    sr->logfile = 0;
+    sr->logq = 0;
+}
+
+static int bench_pcaplog(int argc, char** argv)
+{
+    struct sr_instance sr;
+    uint32_t iters = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+    bench_router_init(&sr);
+    sr_log_level = SR_LOG_INFO;
+    sr_log_dump_rate = 0;
+
+    printf("%-30s %12s %10s %10s %10s %10s\n", "capture", "packets/s",
+           "captured", "dropped", "in file", "flushes");
+    bench_pcaplog_run(&sr, "none", iters, 0, 0, 0);
+    bench_pcaplog_run(&sr, "-l, inline (-q 0)", iters, 1, 0, 0);
+    bench_pcaplog_run(&sr, "-l, -q 4096, drop", iters, 1, 4096, 0);
+    bench_pcaplog_run(&sr, "-l, -q 4096 -K, block", iters, 1, 4096, 1);
+    bench_pcaplog_run(&sr, "-l, -q 64, drop", iters, 1, 64, 0);
+
+    close(sr.sockfd);
+    return 0;
+} /* -- bench_pcaplog -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_pbuf(..)
+ *
+ * Cost of getting and returning a frame buffer, from the pool and from
+ * malloc, one at a time and in bursts of 64 (a send batch), on 1 and 4
+ * threads.  Then the router itself: pings answered from packet buffers,
+ * and forwarded frames, which need none, with the pool in strict mode
+ * after a warm-up.  Growing the pool would abort; the table shows pool
+ * allocations per packet and that every buffer came back.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_PBUF_BURST   64
+#define BENCH_PBUF_THREADS 4
+
+struct bench_pbuf_worker
+{
+    int pool;                   /* sr_pbuf, else malloc */
+    unsigned int burst;
+    uint32_t rounds;
+    pthread_barrier_t* start;
+};
+
+static void* bench_pbuf_thread(void* arg)
+{
+    struct bench_pbuf_worker* w = (struct bench_pbuf_worker*)arg;
+    void* bufs[BENCH_PBUF_BURST];
+    struct sr_pbuf* pb;
+    uint32_t i;
+    unsigned int j;
+
+    pthread_barrier_wait(w->start);
+    for (i = 0; i < w->rounds; i++)
+    {
+        for (j = 0; j < w->burst; j++)
+        {
+            if (w->pool)
+            {
+                pb = sr_pbuf_alloc();
+                pb->data[0] = j;
+                bufs[j] = pb;
+            }
+            else
+            {
+                bufs[j] = malloc(SR_PBUF_SIZE);
+                ((uint8_t*)bufs[j])[SR_PBUF_HEADROOM] = j;
+            }
+        }
+        for (j = 0; j < w->burst; j++)
+        {
+            if (w->pool)
+            { sr_pbuf_free((struct sr_pbuf*)bufs[j]); }
+            else
+            { free(bufs[j]); }
+        }
+    }
+    return 0;
+}
+
+/* ns per buffer allocated and freed, over nthreads */
+static double bench_pbuf_run(int pool, unsigned int burst, unsigned int nthreads,
+                             uint32_t total)
+{
+    struct bench_pbuf_worker w[BENCH_PBUF_THREADS];
+    pthread_t threads[BENCH_PBUF_THREADS];
+    pthread_barrier_t start;
+    unsigned int t;
+    double t0;
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (t = 0; t < nthreads; t++)
+    {
+        w[t].pool = pool;
+        w[t].burst = burst;
+        w[t].rounds = total / burst / nthreads;
+        w[t].start = &start;
+        pthread_create(&threads[t], NULL, bench_pbuf_thread, &w[t]);
+    }
+    pthread_barrier_wait(&start);
+    t0 = bench_now_ns();
+    for (t = 0; t < nthreads; t++)
+    { pthread_join(threads[t], NULL); }
+    t0 = bench_now_ns() - t0;
+    pthread_barrier_destroy(&start);
+
+    return t0 / ((double)(total / burst / nthreads) * burst * nthreads);
+}
+
+/* n frames through sr_handlepacket; pings if echo, else forwarded */
+static void bench_pbuf_router(struct sr_instance* sr, const char* label,
+                              uint32_t n, int echo)
+{
+    uint8_t tmpl[2048], pkt[2048];
+    unsigned int len = bench_forward_frame(tmpl);
+    unsigned int total = sizeof(c_packet_header) + len;
+    struct sr_pbuf_stats st0, st1;
+    int err = dup(2), devnull = open("/dev/null", O_WRONLY);
+    uint32_t i;
+    double t0;
+
+    if (echo)
+    { bench_vnsrx_echo(tmpl); }
+
+    fflush(stderr);
+    dup2(devnull, 2);
+    sr_pbuf_get_stats(&st0);
+    t0 = bench_now();
+    for (i = 0; i < n; i++)
+    {
+        memcpy(pkt, tmpl, total);
+        sr_handlepacket(sr, pkt + sizeof(c_packet_header), len,
+                        (char*)(pkt + sizeof(c_base)));
+    }
+    t0 = bench_now() - t0;
+    sr_pbuf_get_stats(&st1);
+    dup2(err, 2);
+    close(err);
+    close(devnull);
+
+    printf("%-30s %12.0f %10.3f %10lu %10lu %10lu\n", label, n / t0,
+           (double)(st1.allocs - st0.allocs) / n, st1.grows - st0.grows,
+           st1.bufs, st1.in_use);
+}
+
+static int bench_pbuf(int argc, char** argv)
+{
+    uint32_t n = (argc > 1) ? atoi(argv[1]) : 4000000;
+    unsigned int threads[2] = { 1, BENCH_PBUF_THREADS };
+    struct sr_instance sr;
+    char label[64];
+    int i;
+
+    printf("%-30s %12s %12s\n", "ns per buffer", "pool", "malloc");
+    for (i = 0; i < 2; i++)
+    {
+        sprintf(label, "%u thread%s, one at a time", threads[i],
+                threads[i] > 1 ? "s" : "");
+        printf("%-30s %12.1f %12.1f\n", label,
+               bench_pbuf_run(1, 1, threads[i], n),
+               bench_pbuf_run(0, 1, threads[i], n));
+        sprintf(label, "%u thread%s, bursts of %d", threads[i],
+                threads[i] > 1 ? "s" : "", BENCH_PBUF_BURST);
+        printf("%-30s %12.1f %12.1f\n", label,
+               bench_pbuf_run(1, BENCH_PBUF_BURST, threads[i], n),
+               bench_pbuf_run(0, BENCH_PBUF_BURST, threads[i], n));
+    }
+
+    bench_router_init(&sr);
+    sr_log_level = SR_LOG_INFO;
+    sr_log_dump_rate = 0;
+
+    printf("\n%-30s %12s %10s %10s %10s %10s\n", "router, strict pool", "packets/s",
+           "allocs/pkt", "grows", "buffers", "in use");
+    bench_pbuf_router(&sr, "warm-up pings", 1000, 1);
+    sr_pbuf_strict(1);
+    bench_pbuf_router(&sr, "pings", n / 4, 1);
+    bench_pbuf_router(&sr, "forwarded", n / 4, 0);
+    sr_pbuf_strict(0);
+
+    close(sr.sockfd);
+    return 0;
+} /* -- bench_pbuf -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_engine(..)
+ *
+ * A trace of UDP frames from 4096 flows, in random order, forwarded
+ * through the replay backend inline and through 1, 2, 4 and 8 workers.
+ * The spread column is the busiest worker's share of the frames against
+ * an even split.  Each frame carries its flow and a per-flow sequence
+ * number; one more pass per setting is written out and checked that
+ * every frame came out, and that each flow's came out in order.  Wall
+ * clock, so with fewer cores than workers this shows the cost of the
+ * hand-off rather than scaling.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_ENGINE_FLOWS  4096
+#define BENCH_ENGINE_PASSES 5
+
+static double bench_engine_run(struct sr_instance* sr, const char* pcap,
+                               const char* out, int passes, unsigned int workers,
+                               uint32_t n, double* spread)
+{
+    int saved = dup(1), devnull = open("/dev/null", O_WRONLY);
+    unsigned long most = 0;
+    unsigned int i;
+    double t0;
+
+    fflush(stdout);
+    dup2(devnull, 1);
+
+    if (workers && sr_engine_start(sr, workers) != 0)
+    {
+        fprintf(stderr, "could not start %u workers\n", workers);
+        exit(1);
+    }
+    if (sr_replay_open(sr, pcap, out, passes, 0) != 0)
+    {
+        fprintf(stderr, "replay of %s failed\n", pcap);
+        exit(1);
+    }
+
+    t0 = bench_now();
+    while (sr->io->read(sr) == 1);
+    *spread = 1.0;
+    if (sr->engine)
+    {
+        sr_engine_drain(sr->engine);
+        for (i = 0; i < workers; i++)
+        {
+            if (sr->engine->workers[i].packets > most)
+            { most = sr->engine->workers[i].packets; }
+        }
+        *spread = (double)most * workers / sr->engine->dispatched;
+        sr_engine_stop(sr);
+    }
+    t0 = bench_now() - t0;
+    sr->io->close(sr);
+    sr->io = 0;
+
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    close(devnull);
+    return (double)n * passes / t0;
+}
+
+/* frames in an output pcap, and how many came before an earlier frame
+   of their flow */
+static uint32_t bench_engine_check(const char* pcap, uint32_t* reordered)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    uint8_t buf[2048];
+    uint32_t* last = calloc(BENCH_ENGINE_FLOWS, sizeof(uint32_t));
+    uint32_t frames = 0, flow, seq;
+    uint8_t* payload = buf + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                       sizeof(sr_udp_hdr_t);
+    FILE* fp = fopen(pcap, "rb");
+
+    *reordered = 0;
+    if (!fp || fread(&fh, sizeof(fh), 1, fp) != 1)
+    { return 0; }
+
+    while (fread(&ph, sizeof(ph), 1, fp) == 1)
+    {
+        if (ph.caplen > sizeof(buf) || fread(buf, ph.caplen, 1, fp) != 1)
+        { break; }
+        frames++;
+        memcpy(&flow, payload, 4);
+        memcpy(&seq, payload + 4, 4);
+        if (flow >= BENCH_ENGINE_FLOWS || seq <= last[flow])
+        { (*reordered)++; }
+        else
+        { last[flow] = seq; }
+    }
+
+    fclose(fp);
+    free(last);
+    return frames;
+}
+
+static int bench_engine(int argc, char** argv)
+{
+    uint32_t n = (argc > 1) ? atoi(argv[1]) : 200000;
+    unsigned int workers[] = { 0, 1, 2, 4, 8 };
+    struct sr_instance sr;
+    uint32_t* seqs = calloc(BENCH_ENGINE_FLOWS, sizeof(uint32_t));
+    char in_pcap[64], res_pcap[64], label[32];
+    uint8_t frame[256];
+    sr_udp_hdr_t* udp = (sr_udp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t) +
+                                        sizeof(sr_ip_hdr_t));
+    unsigned int len, w;
+    uint32_t i, flow, frames, reordered;
+    double pps, spread;
+    FILE* fp;
+
+    bench_router_init(&sr);
+    sr_log_level = SR_LOG_INFO;
+    sr_log_dump_rate = 0;
+
+    sprintf(in_pcap, "/tmp/sr_bench_engine_in.%d.pcap", (int)getpid());
+    sprintf(res_pcap, "/tmp/sr_bench_engine_res.%d.pcap", (int)getpid());
+
+    /* flow f: 10.0.1.x:port to 93.184.216.y:443, payload (flow, seq) */
+    if ((fp = sr_dump_open(in_pcap, 0, 65535)) == 0)
+    { return 1; }
+    for (i = 0; i < n; i++)
+    {
+        flow = bench_rand() % BENCH_ENGINE_FLOWS;
+        len = bench_natfwd_frame(frame, &sr, "eth1", bench_natfwd_inmac, ip_protocol_udp,
+                                 htonl(0x0a000100 | (2 + flow % 250)),
+                                 htons(20000 + flow), htonl(0x5db8d800 | (flow % 250)),
+                                 htons(443), 0);
+        seqs[flow]++;
+        memcpy(udp + 1, &flow, 4);
+        memcpy((uint8_t*)(udp + 1) + 4, &seqs[flow], 4);
+        udp->udp_sum = 0;
+        bench_natfwd_write(fp, frame, len);
+    }
+    sr_dump_close(fp);
+
+    printf("%-12s %12s %8s %10s %10s\n", "workers", "packets/s", "spread",
+           "out", "reordered");
+    for (w = 0; w < sizeof(workers) / sizeof(workers[0]); w++)
+    {
+        pps = bench_engine_run(&sr, in_pcap, 0, BENCH_ENGINE_PASSES, workers[w], n,
+                               &spread);
+        bench_engine_run(&sr, in_pcap, res_pcap, 1, workers[w], n, &spread);
+        frames = bench_engine_check(res_pcap, &reordered);
+        if (workers[w])
+        { sprintf(label, "%u", workers[w]); }
+        else
+        { strcpy(label, "inline"); }
+        printf("%-12s %12.0f %8.2f %10u %10u%s\n", label, pps, spread, frames,
+               reordered, frames == n && reordered == 0 ? "" : "  WRONG");
+    }
+
+    unlink(in_pcap);
+    unlink(res_pcap);
+    free(seqs);
+    close(sr.sockfd);
+    return 0;
+} /* -- bench_engine -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_vector(..)
+ *
+ * A trace of frames arriving on eth1, most of them UDP forwarded to
+ * random /24 routes, with pings to the router, TTL expiry, bad checksums
+ * and a route whose next hop is not cached mixed in.  Handed to
+ * sr_handlepacket one by one, and to sr_handlepacket_vec in vectors of 1
+ * to 256 frames, on a small table (64 routes, 3 next hops) that stays in
+ * cache and a large one (64K routes, 1024 next hops) that does not.
+ *
+ * Frames go to a backend that only counts them, so what is timed is the
+ * handling and not write(); nor is copying the frames back in between
+ * passes.  The timed router also has the odd next hop and the hosts on
+ * eth1 (which ICMP replies go to) cached, or the ARP queue would grow
+ * without end with no sweeper to expire it.  Then each
+ * way runs once more on a fresh router whose backend records every
+ * frame, and the records must match byte for byte: the same frames, ICMP
+ * messages and ARP requests out of the same interfaces, in the same
+ * order.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_VECTOR_SLOT   192     /* bytes per frame in the trace, packed
+                                       close as in the receive buffer */
+#define BENCH_VECTOR_ROOM   64      /* in front of the frame, for the VNS header */
+#define BENCH_VECTOR_PASSES 20
+#define BENCH_VECTOR_SIZES  5       /* scalar, then vectors of 1 to 256 */
+#define BENCH_VECTOR_ODD_GW 0x0a000209  /* 10.0.2.9, the next hop of the
+                                           last route */
+
+static char bench_vector_eth1[sr_IFACE_NAMELEN] = "eth1";
+
+/* what went out: interface, length and frame, one after the other */
+static struct
+{
+    int record;
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+    uint32_t frames;
+} bench_vector_sink;
+
+static int bench_vector_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                             const char* iface)
+{
+    size_t need = sr_IFACE_NAMELEN + sizeof(len) + len;
+
+    bench_vector_sink.frames++;
+    if (!bench_vector_sink.record)
+    { return 0; }
+
+    if (bench_vector_sink.len + need > bench_vector_sink.cap)
+    {
+        bench_vector_sink.cap = 2 * (bench_vector_sink.cap + need);
+        bench_vector_sink.buf = realloc(bench_vector_sink.buf, bench_vector_sink.cap);
+    }
+    memset(bench_vector_sink.buf + bench_vector_sink.len, 0, sr_IFACE_NAMELEN);
+    strncpy((char*)bench_vector_sink.buf + bench_vector_sink.len, iface, sr_IFACE_NAMELEN);
+    memcpy(bench_vector_sink.buf + bench_vector_sink.len + sr_IFACE_NAMELEN, &len, sizeof(len));
+    memcpy(bench_vector_sink.buf + bench_vector_sink.len + sr_IFACE_NAMELEN + sizeof(len),
+           buf, len);
+    bench_vector_sink.len += need;
+    return 0;
+} /* -- bench_vector_send -- */
+
+static const struct sr_io_ops bench_vector_io = { "bench", 0, bench_vector_send, 0 };
+
+/* bench_router_init plus 100.k.0/24 (k < nroutes, k taking up two
+   octets) via eth2, to ngw next hops 10.2.x.y, all cached.  The last
+   route goes to BENCH_VECTOR_ODD_GW instead; that and the hosts on eth1
+   are cached only if all_cached. */
+static void bench_vector_init(struct sr_instance* sr, uint32_t nroutes, uint32_t ngw,
+                              int all_cached)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 2, 0 };
+    struct sr_rt* routes = calloc(nroutes, sizeof(struct sr_rt));
+    uint32_t k, g;
+
+    bench_router_init(sr);
+    sr->io = &bench_vector_io;
+
+    for (k = 0; k < nroutes; k++)
+    {
+        g = (k + 1 == nroutes) ? BENCH_VECTOR_ODD_GW : 0x0a020000 | (k % ngw);
+        routes[k].dest.s_addr = htonl(0x64000000 | (k << 8));
+        routes[k].mask.s_addr = htonl(0xffffff00);
+        routes[k].gw.s_addr = htonl(g);
+        strcpy(routes[k].interface, "eth2");
+        routes[k].out = sr_get_interface(sr, "eth2");
+        routes[k].next = sr->routing_table;
+        sr->routing_table = &routes[k];
+    }
+    sr_fib_build(&sr->fib, sr->routing_table);
+
+    for (g = 0; g < ngw; g++)
+    {
+        mac[4] = g >> 8;
+        mac[5] = g;
+        sr_arpcache_insert(&sr->cache, mac, htonl(0x0a020000 | g));
+    }
+    if (!all_cached)
+    { return; }
+
+    sr_arpcache_insert(&sr->cache, mac, htonl(BENCH_VECTOR_ODD_GW));
+    for (g = 2; g < 252; g++)
+    { sr_arpcache_insert(&sr->cache, (unsigned char*)bench_natfwd_inmac, htonl(0x0a000100 | g)); }
+} /* -- bench_vector_init -- */
+
+/* Handle n frames from tmpl, copied into work SR_VEC_MAX at a time and
+   handed over vsize at a time (0 is one sr_handlepacket call each);
+   returns the ns spent handling them. */
+static double bench_vector_pass(struct sr_instance* sr, struct sr_vec* v,
+                                const uint8_t* tmpl, uint8_t* work,
+                                const unsigned int* lens, uint32_t n,
+                                unsigned int vsize)
+{
+    uint32_t base, i, end;
+    uint8_t* frame;
+    double t = 0, t0;
+
+    for (base = 0; base < n; base += SR_VEC_MAX)
+    {
+        end = (base + SR_VEC_MAX < n) ? base + SR_VEC_MAX : n;
+        for (i = base; i < end; i++)
+        {
+            memcpy(work + (size_t)i * BENCH_VECTOR_SLOT + BENCH_VECTOR_ROOM,
+                   tmpl + (size_t)i * BENCH_VECTOR_SLOT + BENCH_VECTOR_ROOM, lens[i]);
+        }
+
+        t0 = bench_now_ns();
+        for (i = base; i < end; i++)
+        {
+            frame = work + (size_t)i * BENCH_VECTOR_SLOT + BENCH_VECTOR_ROOM;
+            if (vsize == 0)
+            {
+                sr_handlepacket(sr, frame, lens[i], bench_vector_eth1);
+                continue;
+            }
+            /* what the VNS reader does per frame */
+            sr_pkt_parse(&v->pkt[v->n], frame, lens[i],
+                         sr_get_interface(sr, bench_vector_eth1));
+            if (++v->n == vsize || i + 1 == end)
+            { sr_handlepacket_vec(sr, v); }
+        }
+        t += bench_now_ns() - t0;
+    }
+    return t;
+} /* -- bench_vector_pass -- */
+
+static void bench_vector_table(uint32_t n, uint32_t nroutes, uint32_t ngw)
+{
+    unsigned int vsizes[BENCH_VECTOR_SIZES] = { 0, 1, 8, 32, 256 };
+    double best[BENCH_VECTOR_SIZES];
+    struct sr_instance sr, fresh;
+    struct sr_vec* v = calloc(1, sizeof(struct sr_vec));
+    uint8_t* tmpl = malloc((size_t)n * BENCH_VECTOR_SLOT);
+    uint8_t* work = malloc((size_t)n * BENCH_VECTOR_SLOT);
+    unsigned int* lens = malloc(n * sizeof(unsigned int));
+    uint8_t* scalar_out = 0;
+    size_t scalar_len = 0;
+    uint32_t scalar_frames = 0;
+    char label[32];
+    uint8_t* frame;
+    sr_ip_hdr_t* ip;
+    uint32_t i, r, k;
+    unsigned int s, p;
+    double t;
+
+    bench_vector_init(&sr, nroutes, ngw, 1);
+
+    for (i = 0; i < n; i++)
+    {
+        frame = tmpl + (size_t)i * BENCH_VECTOR_SLOT + BENCH_VECTOR_ROOM;
+        ip = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        r = bench_rand() % 100;
+        if (r < 2)
+        {
+            lens[i] = bench_natfwd_frame(frame, &sr, "eth1", bench_natfwd_inmac,
+                                         ip_protocol_icmp, htonl(0x0a000102), htons(7),
+                                         htonl(0x0a000101), 0, ICMP_ECHO);
+            continue;
+        }
+
+        k = bench_rand() % nroutes;
+        lens[i] = bench_natfwd_frame(frame, &sr, "eth1", bench_natfwd_inmac, ip_protocol_udp,
+                                     htonl(0x0a000100 | (2 + bench_rand() % 250)),
+                                     htons(20000 + i % 4096),
+                                     htonl(0x64000000 | (k << 8) | (bench_rand() % 250)),
+                                     htons(53), 0);
+        if (r < 4)
+        {
+            ip->ip_ttl = 1;
+            ip->ip_sum = 0;
+            ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+        }
+        else if (r < 5)
+        { ip->ip_sum ^= htons(1); }
+    }
+
+    /* the sizes take turns, so that they see the same noise; the best
+       pass of each counts */
+    for (s = 0; s < BENCH_VECTOR_SIZES; s++)
+    { best[s] = 1e30; }
+    for (p = 0; p <= BENCH_VECTOR_PASSES; p++)
+    {
+        for (s = 0; s < BENCH_VECTOR_SIZES; s++)
+        {
+            t = bench_vector_pass(&sr, v, tmpl, work, lens, n, vsizes[s]);
+            if (p > 0 && t < best[s])
+            { best[s] = t; }
+        }
+    }
+
+    printf("%u routes, %u next hops, %u frames\n", nroutes, ngw, n);
+    printf("%-12s %12s %12s %10s\n", "vector", "packets/s", "ns/packet", "frames out");
+    for (s = 0; s < BENCH_VECTOR_SIZES; s++)
+    {
+        t = best[s];
+
+        /* once more, recorded, on a router that has not seen the trace */
+        bench_vector_init(&fresh, nroutes, ngw, 0);
+        bench_vector_sink.record = 1;
+        bench_vector_sink.len = 0;
+        bench_vector_sink.frames = 0;
+        bench_vector_pass(&fresh, v, tmpl, work, lens, n, vsizes[s]);
+        bench_vector_sink.record = 0;
+        close(fresh.sockfd);
+
+        if (vsizes[s] == 0)
+        {
+            scalar_out = malloc(bench_vector_sink.len);
+            memcpy(scalar_out, bench_vector_sink.buf, bench_vector_sink.len);
+            scalar_len = bench_vector_sink.len;
+            scalar_frames = bench_vector_sink.frames;
+            strcpy(label, "scalar");
+        }
+        else
+        { sprintf(label, "%u", vsizes[s]); }
+
+        printf("%-12s %12.0f %12.1f %10u%s\n", label, n / (t / 1e9), t / n,
+               bench_vector_sink.frames,
+               vsizes[s] == 0 ? "" :
+               bench_vector_sink.frames == scalar_frames &&
+               bench_vector_sink.len == scalar_len &&
+               memcmp(bench_vector_sink.buf, scalar_out, scalar_len) == 0 ?
+               "  same" : "  DIFFERENT");
+    }
+
+    close(sr.sockfd);
+    free(scalar_out);
+    free(v);
+    free(tmpl);
+    free(work);
+    free(lens);
+} /* -- bench_vector_table -- */
+
+static int bench_vector(int argc, char** argv)
+{
+    uint32_t n = (argc > 1) ? atoi(argv[1]) : 4096;
+
+    sr_log_level = SR_LOG_INFO;
+    sr_log_dump_rate = 0;
+
+    bench_vector_table(n, 64, 3);
+    printf("\n");
+    bench_vector_table(n, 65536, 1024);
+
+    free(bench_vector_sink.buf);
+    return 0;
+} /* -- bench_vector -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_ifname(..)
+ * Scope:  Local
+ *
+ * Interface lookups on routers with 3 to 4096 interfaces (eth0 on
+ * 10.0.1.1, eth1 on 10.0.2.1, ...), in random order, against walking
+ * sr->if_list as both used to:
+ *
+ *   by name     sr_get_interface, which the VNS reader calls per frame
+ *   by address  sr_if_addr_lookup, every IP packet and ARP request; half
+ *               the addresses looked up are not the router's
+ *
+ * Each router is then checked: every name and address finds its
+ * interface, ids run 0 to n - 1 in the order added, flags stick, unknown
+ * names and addresses find nothing, and a second interface with a taken
+ * name leaves the first one in place.
+ *
+ *---------------------------------------------------------------------------*/
+
+#define BENCH_IFNAME_IP(i) htonl(0x0a000001 | ((i) + 1) << 8)
+
+static struct sr_if* bench_ifname_walk(struct sr_instance* sr, const char* name)
+{
+    struct sr_if* iface;
+
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        if (!strncmp(iface->name, name, sr_IFACE_NAMELEN))
+        { return iface; }
+    }
+    return 0;
+}
+
+static struct sr_if* bench_ifname_walk_ip(struct sr_instance* sr, uint32_t ip)
+{
+    struct sr_if* iface;
+
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        if (iface->ip == ip)
+        { return iface; }
+    }
+    return 0;
+}
+
+static int bench_ifname_check(struct sr_instance* sr, char (*names)[sr_IFACE_NAMELEN],
+                              uint32_t n)
+{
+    const struct sr_if_addr* addr;
+    struct sr_if* iface;
+    uint32_t i;
+
+    for (i = 0, iface = sr->if_list; i < n; i++, iface = iface->next)
+    {
+        addr = sr_if_addr_lookup(sr, BENCH_IFNAME_IP(i));
+        if (iface->id != i || sr_get_interface_id(sr, i) != iface ||
+            sr_get_interface(sr, names[i]) != iface ||
+            addr == 0 || addr->iface != iface || addr->flags != 0)
+        { return 0; }
+    }
+    if (sr_get_interface(sr, "nosuch0") || sr_get_interface_id(sr, n) ||
+        sr_if_addr_lookup(sr, BENCH_IFNAME_IP(n)) || sr_if_addr_lookup(sr, 0))
+    { return 0; }
+
+    if (sr_if_addr_set_flags(sr, BENCH_IFNAME_IP(n - 1), SR_IF_ADDR_NAT_EXT) != 0 ||
+        sr_if_addr_set_flags(sr, BENCH_IFNAME_IP(n), SR_IF_ADDR_NAT_EXT) != -1)
+    { return 0; }
+
+    /* a duplicate name, and a rebuild of the address table */
+    sr_add_interface(sr, names[0]);
+    sr_set_ether_ip(sr, BENCH_IFNAME_IP(0));
+    return sr_get_interface(sr, names[0]) == sr->if_list &&
+           sr_get_interface_id(sr, n)->id == n &&
+           sr_if_addr_lookup(sr, BENCH_IFNAME_IP(0))->iface == sr->if_list &&
+           sr_if_addr_lookup(sr, BENCH_IFNAME_IP(n - 1))->flags == SR_IF_ADDR_NAT_EXT;
+}
+
+static int bench_ifname(int argc, char** argv)
+{
+    uint32_t sizes[] = { 3, 16, 256, 4096 };
+    const uint32_t nlookups = 1 << 16;
+    char (*names)[sr_IFACE_NAMELEN];
+    uint32_t* order;
+    uint32_t* ips;
+    struct sr_instance sr;
+    struct sr_if* iface;
+    uint32_t s, i, n, iters, walk_iters, it;
+    double t0, t_build, t_name, t_name_walk, t_ip, t_ip_walk;
+
+    names = malloc(4096 * sizeof(*names));
+    order = malloc(nlookups * sizeof(uint32_t));
+    ips = malloc(nlookups * sizeof(uint32_t));
+    if (!names || !order || !ips)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("%-10s %9s %12s %12s %12s %12s %6s\n", "", "", "by name", "",
+           "by address", "", "");
+    printf("%-10s %9s %12s %12s %12s %12s %6s\n", "interfaces", "build ms",
+           "hash/s", "list walk/s", "hash/s", "list walk/s", "check");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        n = sizes[s];
+        memset(&sr, 0, sizeof(sr));
+        for (i = 0; i < n; i++)
+        { sprintf(names[i], "eth%u", i); }
+
+        t0 = bench_now();
+        for (i = 0; i < n; i++)
+        {
+            sr_add_interface(&sr, names[i]);
+            sr_set_ether_ip(&sr, BENCH_IFNAME_IP(i));
+        }
+        t_build = bench_now() - t0;
+
+        for (i = 0; i < nlookups; i++)
+        {
+            order[i] = bench_rand() % n;
+            ips[i] = BENCH_IFNAME_IP(order[i]) + (bench_rand() & 1 ? htonl(1) : 0);
+        }
+        iters = n > 256 ? 4 : 64;
+        walk_iters = n > 256 ? 1 : iters;
+
+        t0 = bench_now();
+        for (it = 0; it < iters; it++)
+        {
+            for (i = 0; i < nlookups; i++)
+            { bench_sink += (uintptr_t)sr_get_interface(&sr, names[order[i]]); }
+        }
+        t_name = (bench_now() - t0) / iters;
+
+        t0 = bench_now();
+        for (it = 0; it < walk_iters; it++)
+        {
+            for (i = 0; i < nlookups; i++)
+            { bench_sink += (uintptr_t)bench_ifname_walk(&sr, names[order[i]]); }
+        }
+        t_name_walk = (bench_now() - t0) / walk_iters;
+
+        t0 = bench_now();
+        for (it = 0; it < iters; it++)
+        {
+            for (i = 0; i < nlookups; i++)
+            { bench_sink += (uintptr_t)sr_if_addr_lookup(&sr, ips[i]); }
+        }
+        t_ip = (bench_now() - t0) / iters;
+
+        t0 = bench_now();
+        for (it = 0; it < walk_iters; it++)
+        {
+            for (i = 0; i < nlookups; i++)
+            { bench_sink += (uintptr_t)bench_ifname_walk_ip(&sr, ips[i]); }
+        }
+        t_ip_walk = (bench_now() - t0) / walk_iters;
+
+        printf("%-10u %9.2f %12.0f %12.0f %12.0f %12.0f %6s\n", n, t_build * 1e3,
+               nlookups / t_name, nlookups / t_name_walk,
+               nlookups / t_ip, nlookups / t_ip_walk,
+               bench_ifname_check(&sr, names, n) ? "ok" : "FAILED");
+
+        while ((iface = sr.if_list) != 0)
+        {
+            sr.if_list = iface->next;
+            free(iface);
+        }
+        free(sr.ifs.by_id);
+        free(sr.ifs.named);
+        free(sr.ifs.disp);
+        free(sr.ifs.slot);
+        free(sr.ifs.addrs);
+    }
+
+    free(names);
+    free(order);
+    free(ips);
+    return 0;
+} /* -- bench_ifname -- */
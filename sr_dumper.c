@@ -2,6 +2,10 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
 #include "sr_dumper.h"
 
 static void
@@ -69,3 +73,202 @@ sr_dump_close(FILE *fp)
   fclose(fp);
 }
 
+
+/*
+ * One slot of the capture ring.  seq says whose turn it is: equal to the
+ * slot's position when free for the producer claiming that position, one
+ * more once the capture is in and the writer may take it.  The captured
+ * bytes follow the header.
+ */
+struct sr_dump_slot {
+        unsigned long seq;
+        struct pcap_sf_pkthdr hdr;
+};
+
+#define SR_DUMP_SLOT(q, pos) \
+        ((struct sr_dump_slot *)((q)->slots + ((pos) & ((q)->nslots - 1)) * (q)->stride))
+
+/* writer states while it waits on the condition variable */
+#define SR_DUMP_IDLE    1       /* everything written and flushed */
+#define SR_DUMP_LINGER  2       /* written, flush held back a little */
+
+/* a lingering writer is woken every this many captures (or slots/2) */
+#define SR_DUMP_WAKE_BATCH 64
+
+/* how long the writer holds back a flush, and sleeps when idle, in ns */
+#define SR_DUMP_LINGER_NS  1000000
+#define SR_DUMP_IDLE_NS    100000000
+
+/*
+ * Wake the writer for the capture at pos: always if it is idle, only at
+ * every wake_mask + 1 captures while it lingers, so a busy stream costs a
+ * signal per batch rather than per capture.
+ */
+static void
+sr_dump_async_wake(struct sr_dump_async *q, unsigned long pos)
+{
+        int state = __atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST);
+
+        if (state == SR_DUMP_IDLE ||
+            (state == SR_DUMP_LINGER && (pos & q->wake_mask) == q->wake_mask)) {
+                pthread_mutex_lock(&q->lock);
+                pthread_cond_signal(&q->wake);
+                pthread_mutex_unlock(&q->lock);
+        }
+}
+
+/*
+ * Queue a capture: claim the next slot, copy the capture in, publish it.
+ */
+int
+sr_dump_async(struct sr_dump_async *q, const struct pcap_pkthdr *h,
+              const unsigned char *sp)
+{
+        struct sr_dump_slot *slot;
+        unsigned long pos, seq;
+        uint32_t caplen = min(h->caplen, q->snaplen);
+
+        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        for (;;) {
+                slot = SR_DUMP_SLOT(q, pos);
+                seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+                if (seq == pos) {
+                        if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 0,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                                break;
+                } else if ((long)(seq - pos) < 0) {
+                        /* full: the writer has not got to this slot yet */
+                        if (!q->block) {
+                                __atomic_fetch_add(&q->dropped, 1, __ATOMIC_RELAXED);
+                                return -1;
+                        }
+                        sr_dump_async_wake(q, q->wake_mask);
+                        sched_yield();
+                        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+                } else {
+                        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+                }
+        }
+
+        slot->hdr.ts.tv_sec  = h->ts.tv_sec;
+        slot->hdr.ts.tv_usec = h->ts.tv_usec;
+        slot->hdr.caplen     = caplen;
+        slot->hdr.len        = h->len;
+        memcpy(slot + 1, sp, caplen);
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+        __atomic_fetch_add(&q->captured, 1, __ATOMIC_RELAXED);
+        sr_dump_async_wake(q, pos);
+        return 0;
+}
+
+/*
+ * Writer thread: write out slots in order.  When the ring runs dry it
+ * lingers for up to SR_DUMP_LINGER_NS before flushing, so a steady stream
+ * is flushed once per stdio buffer or lull rather than once per batch,
+ * then sleeps until a producer wakes it.  The timed waits also cover a
+ * wakeup lost to a full ring's blocked producer.
+ */
+static void *
+sr_dump_async_writer(void *arg)
+{
+        struct sr_dump_async *q = (struct sr_dump_async *)arg;
+        struct sr_dump_slot *slot;
+        struct timespec ts;
+        unsigned long pending = 0;
+        int state;
+
+        for (;;) {
+                slot = SR_DUMP_SLOT(q, q->head);
+                if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == q->head + 1) {
+                        (void)fwrite(&slot->hdr, sizeof(slot->hdr) + slot->hdr.caplen, 1, q->fp);
+                        __atomic_store_n(&slot->seq, q->head + q->nslots, __ATOMIC_RELEASE);
+                        q->head++;
+                        pending++;
+                        continue;
+                }
+
+                state = pending ? SR_DUMP_LINGER : SR_DUMP_IDLE;
+                pthread_mutex_lock(&q->lock);
+                __atomic_store_n(&q->sleeping, state, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == q->head + 1) {
+                        state = 0;
+                } else if (q->stop) {
+                        pthread_mutex_unlock(&q->lock);
+                        break;
+                } else {
+                        clock_gettime(CLOCK_REALTIME, &ts);
+                        ts.tv_nsec += state == SR_DUMP_LINGER ?
+                                SR_DUMP_LINGER_NS : SR_DUMP_IDLE_NS;
+                        if (ts.tv_nsec >= 1000000000) {
+                                ts.tv_sec++;
+                                ts.tv_nsec -= 1000000000;
+                        }
+                        pthread_cond_timedwait(&q->wake, &q->lock, &ts);
+                }
+                __atomic_store_n(&q->sleeping, 0, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&q->lock);
+
+                /* nothing arrived while lingering: flush */
+                if (state == SR_DUMP_LINGER &&
+                    __atomic_load_n(&SR_DUMP_SLOT(q, q->head)->seq, __ATOMIC_ACQUIRE) != q->head + 1) {
+                        fflush(q->fp);
+                        q->flushes++;
+                        pending = 0;
+                }
+        }
+        if (pending) {
+                fflush(q->fp);
+                q->flushes++;
+        }
+        return NULL;
+}
+
+struct sr_dump_async *
+sr_dump_async_open(FILE *fp, unsigned int nslots, unsigned int snaplen, int block)
+{
+        struct sr_dump_async *q;
+        unsigned int n = 1, i;
+
+        while (n < nslots)
+                n <<= 1;
+
+        if ((q = calloc(1, sizeof(struct sr_dump_async))) == NULL)
+                return NULL;
+        q->fp = fp;
+        q->nslots = n;
+        q->snaplen = snaplen;
+        q->stride = (sizeof(struct sr_dump_slot) + snaplen + 63) & ~63U;
+        q->block = block;
+        q->wake_mask = (n / 2 < SR_DUMP_WAKE_BATCH ? (n > 1 ? n / 2 : 1) : SR_DUMP_WAKE_BATCH) - 1;
+        if ((q->slots = malloc((size_t)n * q->stride)) == NULL) {
+                free(q);
+                return NULL;
+        }
+        for (i = 0; i < n; i++)
+                SR_DUMP_SLOT(q, i)->seq = i;
+
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->wake, NULL);
+        if (pthread_create(&q->thread, NULL, sr_dump_async_writer, q) != 0) {
+                free(q->slots);
+                free(q);
+                return NULL;
+        }
+        return q;
+}
+
+void
+sr_dump_async_close(struct sr_dump_async *q)
+{
+        pthread_mutex_lock(&q->lock);
+        q->stop = 1;
+        pthread_cond_signal(&q->wake);
+        pthread_mutex_unlock(&q->lock);
+        pthread_join(q->thread, NULL);
+
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->wake);
+        free(q->slots);
+        free(q);
+}
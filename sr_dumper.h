@@ -13,6 +13,8 @@
 #endif /* _DARWIN_ */
 
 #include <sys/time.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #define PCAP_VERSION_MAJOR 2
 #define PCAP_VERSION_MINOR 4
@@ -77,3 +79,54 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+/**
+ * Asynchronous writer for a dump file.  Captures are copied into a ring
+ * of fixed size slots, which several threads may fill at once (a slot is
+ * claimed with one compare-and-swap), and a writer thread of its own
+ * moves them to the file, flushing whenever it has emptied the ring.
+ * When the ring is full a capture is dropped and counted, or, with
+ * block set, the capturing thread waits for a free slot.
+ */
+struct sr_dump_async {
+  FILE *fp;
+  unsigned char *slots;
+  unsigned int nslots;    /* power of two */
+  unsigned int stride;    /* bytes per slot */
+  unsigned int snaplen;
+  int block;
+  unsigned int wake_mask; /* signal a busy writer every wake_mask + 1 captures */
+
+  unsigned long tail;     /* next slot to claim, shared by producers */
+  char pad[64];
+  unsigned long head;     /* next slot to write, writer thread only */
+
+  int sleeping;           /* writer is waiting on wake, and how */
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+
+  unsigned long captured;
+  unsigned long dropped;
+  unsigned long flushes;
+};
+
+/**
+ * Start a writer for fp with a ring of nslots (rounded up to a power of
+ * two) captures of up to snaplen bytes.  NULL if out of memory.
+ */
+struct sr_dump_async *sr_dump_async_open(FILE *fp, unsigned int nslots,
+                                         unsigned int snaplen, int block);
+
+/**
+ * Queue a capture.  Returns 0, or -1 if it was dropped.
+ */
+int sr_dump_async(struct sr_dump_async *q, const struct pcap_pkthdr *h,
+                  const unsigned char *sp);
+
+/**
+ * Write out everything queued, stop the writer and free q.  The file
+ * stays open.
+ */
+void sr_dump_async_close(struct sr_dump_async *q);
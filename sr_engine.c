@@ -0,0 +1,258 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_engine.c
+ *
+ * Description:
+ *
+ * Flow-hashed dispatch of input frames to worker threads (see
+ * sr_engine.h).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "sr_engine.h"
+#include "sr_router.h"
+#include "sr_pbuf.h"
+#include "sr_vec.h"
+
+/* polls of an empty ring before a worker goes to sleep */
+#define SR_ENGINE_SPIN 64
+
+/*---------------------------------------------------------------------
+ * Method: sr_engine_worker(..)
+ * Scope:  Local
+ *
+ * Handles what is queued on one ring, in order; with -V as vectors of
+ * whatever has piled up (up to SR_VEC_MAX frames).  head moves on only
+ * after the frames have been handled, which is what sr_engine_drain
+ * waits for.  An empty ring is polled a little, then the worker sleeps until
+ * the reader wakes it (the timeout only guards against a missed wakeup).
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_engine_worker(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_engine* engine = w->engine;
+    struct sr_vec* vec = w->vec;
+    struct sr_engine_slot* slot;
+    struct timespec ts;
+    unsigned long head = w->head, tail, i, n;
+    int spin = 0;
+
+    for (;;)
+    {
+        if (head != (tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)))
+        {
+            n = (tail - head < SR_VEC_MAX) ? tail - head : SR_VEC_MAX;
+            for (i = 0; i < n; i++)
+            {
+                slot = &w->ring[(head + i) & (SR_ENGINE_RING - 1)];
+                if (vec == 0)
+                { sr_handle_pkt(engine->sr, &slot->pkt); }
+                else
+                { vec->pkt[i] = slot->pkt; }
+            }
+            if (vec)
+            {
+                vec->n = n;
+                sr_handlepacket_vec(engine->sr, vec);
+            }
+
+            for (i = 0; i < n; i++)
+            { sr_pbuf_free(w->ring[(head + i) & (SR_ENGINE_RING - 1)].pb); }
+            w->packets += n;
+            head += n;
+            __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
+            spin = 0;
+            continue;
+        }
+
+        if (++spin < SR_ENGINE_SPIN)
+        {
+            sched_yield();
+            continue;
+        }
+        spin = 0;
+
+        pthread_mutex_lock(&w->lock);
+        __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (head == __atomic_load_n(&w->tail, __ATOMIC_SEQ_CST))
+        {
+            if (engine->stop)
+            {
+                pthread_mutex_unlock(&w->lock);
+                break;
+            }
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&w->wake, &w->lock, &ts);
+        }
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return 0;
+} /* -- sr_engine_worker -- */
+
+static void sr_engine_wake(struct sr_worker* w)
+{
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+} /* -- sr_engine_wake -- */
+
+int sr_engine_start(struct sr_instance* sr, unsigned int nworkers)
+{
+    struct sr_engine* engine;
+    unsigned int i;
+
+    if (nworkers == 0 || nworkers > SR_ENGINE_MAX_WORKERS)
+    { return -1; }
+
+    if ((engine = (struct sr_engine*)calloc(1, sizeof(struct sr_engine))) == 0)
+    { return -1; }
+    if ((engine->workers = (struct sr_worker*)calloc(nworkers, sizeof(struct sr_worker))) == 0)
+    {
+        free(engine);
+        return -1;
+    }
+    engine->sr = sr;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        struct sr_worker* w = &engine->workers[i];
+
+        w->engine = engine;
+        if (sr->vector &&
+            (w->vec = (struct sr_vec*)malloc(sizeof(struct sr_vec))) == 0)
+        {
+            sr->engine = engine;
+            sr_engine_stop(sr);
+            return -1;
+        }
+        pthread_mutex_init(&w->lock, 0);
+        pthread_cond_init(&w->wake, 0);
+        if (pthread_create(&w->thread, 0, sr_engine_worker, w) != 0)
+        {
+            /* -- not counted in nworkers yet, so stop won't see it -- */
+            pthread_mutex_destroy(&w->lock);
+            pthread_cond_destroy(&w->wake);
+            free(w->vec);
+            sr->engine = engine;
+            sr_engine_stop(sr);
+            return -1;
+        }
+        engine->nworkers++;
+    }
+
+    sr->engine = engine;
+    return 0;
+} /* -- sr_engine_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_engine_input(..)
+ * Scope:  Global
+ *
+ * Queues a frame for the worker its flow hashes to.  The frame is copied
+ * into a packet buffer, which keeps the headroom sr_handlepacket expects
+ * for sending in place; the descriptor goes along, pointed at the copy.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_engine_input(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+    struct sr_engine* engine = sr->engine;
+    struct sr_worker* w;
+    struct sr_engine_slot* slot;
+    struct sr_pbuf* pb;
+    unsigned long tail;
+
+    if (engine == 0)
+    {
+        sr_handle_pkt(sr, pkt);
+        return;
+    }
+
+    if (pkt->in == 0 || (pb = sr_pbuf_copy(pkt->frame, pkt->len)) == 0)
+    {
+        engine->dropped++;
+        return;
+    }
+
+    w = &engine->workers[((uint64_t)pkt->hash * engine->nworkers) >> 32];
+
+    tail = w->tail;
+    if (tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == SR_ENGINE_RING)
+    {
+        w->full++;
+        sr_engine_wake(w);
+        while (tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == SR_ENGINE_RING)
+        { sched_yield(); }
+    }
+
+    slot = &w->ring[tail & (SR_ENGINE_RING - 1)];
+    slot->pb = pb;
+    slot->pkt = *pkt;
+    slot->pkt.frame = pb->data;
+    __atomic_store_n(&w->tail, tail + 1, __ATOMIC_SEQ_CST);
+    engine->dispatched++;
+
+    sr_engine_wake(w);
+} /* -- sr_engine_input -- */
+
+void sr_engine_drain(struct sr_engine* engine)
+{
+    struct sr_worker* w;
+    unsigned int i;
+
+    for (i = 0; i < engine->nworkers; i++)
+    {
+        w = &engine->workers[i];
+        while (__atomic_load_n(&w->head, __ATOMIC_ACQUIRE) != w->tail)
+        {
+            sr_engine_wake(w);
+            sched_yield();
+        }
+    }
+} /* -- sr_engine_drain -- */
+
+void sr_engine_stop(struct sr_instance* sr)
+{
+    struct sr_engine* engine = sr->engine;
+    struct sr_worker* w;
+    unsigned int i;
+
+    if (engine == 0)
+    { return; }
+
+    sr_engine_drain(engine);
+    engine->stop = 1;
+    for (i = 0; i < engine->nworkers; i++)
+    {
+        w = &engine->workers[i];
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, 0);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->wake);
+        free(w->vec);
+    }
+
+    sr->engine = 0;
+    free(engine->workers);
+    free(engine);
+} /* -- sr_engine_stop -- */
@@ -0,0 +1,106 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_engine.h
+ *
+ * Description:
+ *
+ * Multi-threaded forwarding (-w).  The thread reading frames (from the VNS
+ * server or a replay) no longer handles them: it copies each frame into a
+ * packet buffer and queues it, with its descriptor, for the worker that
+ * the descriptor's flow hash picks.  Workers run sr_handlepacket (with -V sr_handlepacket_vec,
+ * over whatever is queued for them) and send the result themselves.
+ *
+ * Each worker has its own single producer, single consumer ring, so
+ * queueing is two plain loads and a release store.  A flow is always
+ * hashed to the same worker and the ring is FIFO, so the frames of a flow
+ * are handled, and sent, in the order they arrived.  When a worker's ring
+ * is full the reader waits for room rather than drop or reorder.
+ *
+ * The flow is the IPv4 5-tuple (addresses, protocol and, for an unfragmented
+ * TCP or UDP packet, ports); an ARP frame is hashed on the address it
+ * asks about or answers for (see sr_pkt_parse).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_ENGINE_H
+#define sr_ENGINE_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_pkt.h"
+
+#define SR_ENGINE_MAX_WORKERS 64
+#define SR_ENGINE_RING        1024  /* frames queued per worker, power of two */
+
+struct sr_instance;
+struct sr_pbuf;
+struct sr_vec;
+
+struct sr_engine_slot
+{
+    struct sr_pbuf* pb;
+    struct sr_pkt pkt;          /* describes pb's frame */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_worker
+ *
+ * tail is written only by the reader, head only by the worker, after it
+ * has handled the frame; they sit on cache lines of their own.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_worker
+{
+    struct sr_engine* engine;
+    pthread_t thread;
+    struct sr_vec* vec;         /* the worker's frames in hand, with -V */
+    struct sr_engine_slot ring[SR_ENGINE_RING];
+
+    unsigned long tail;         /* next slot to fill */
+    unsigned long full;         /* times the reader found the ring full */
+    char pad1[64];
+
+    unsigned long head;         /* next slot to handle */
+    unsigned long packets;      /* frames handled */
+    char pad2[64];
+
+    int sleeping;               /* waiting on wake for an empty ring */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+struct sr_engine
+{
+    struct sr_instance* sr;
+    unsigned int nworkers;
+    struct sr_worker* workers;
+    int stop;
+    unsigned long dispatched;   /* frames queued */
+    unsigned long dropped;      /* no packet buffer, or unknown interface */
+};
+
+/* Start nworkers worker threads for sr and route its input through them.
+   Returns -1 when out of memory or threads. */
+int  sr_engine_start(struct sr_instance* sr, unsigned int nworkers);
+
+/* Wait until every frame queued so far has been handled. */
+void sr_engine_drain(struct sr_engine* engine);
+
+/* Drain, stop the workers and free the engine; sr's input is handled
+   inline again. */
+void sr_engine_stop(struct sr_instance* sr);
+
+/* Input from the reading thread: queued for a worker when an engine is
+   running, handled right here otherwise.  The frame is copied, so it need
+   not outlive the call. */
+void sr_engine_input(struct sr_instance* sr, struct sr_pkt* pkt);
+
+#endif /* -- sr_ENGINE_H -- */
@@ -0,0 +1,321 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * Compiles the routing table list into a 16/8/8 multibit trie (see
+ * sr_fib.h) and performs lookups on it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fib.h"
+#include "sr_rt.h"
+
+/* route plus the information needed to install it in order */
+struct sr_fib_route
+{
+    struct sr_rt* rt;
+    uint32_t prefix;    /* host byte order, already masked */
+    int      plen;
+    int      order;     /* position in the routing table list */
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_prefix_len(..)
+ * Scope:  Local
+ *
+ * Returns the prefix length of a netmask (network byte order) or -1 if
+ * the mask is not contiguous and so cannot be represented in the trie.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_prefix_len(uint32_t mask_nbo)
+{
+    uint32_t mask = ntohl(mask_nbo);
+    int plen = 0;
+
+    while (mask & 0x80000000)
+    {
+        mask <<= 1;
+        plen++;
+    }
+
+    return mask ? -1 : plen;
+} /* -- sr_fib_prefix_len -- */
+
+/* Install shorter prefixes first so longer ones overwrite them.  Among
+   equal prefixes the list walk picks the first one, so install those in
+   reverse list order. */
+static int sr_fib_route_cmp(const void* a, const void* b)
+{
+    const struct sr_fib_route* ra = a;
+    const struct sr_fib_route* rb = b;
+
+    if (ra->plen != rb->plen)
+    { return ra->plen - rb->plen; }
+    return rb->order - ra->order;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_chunk(..)
+ * Scope:  Local
+ *
+ * Hand out a new 256 entry chunk with every slot set to leaf (the value
+ * that is being pushed down from the parent).  Returns the chunk number
+ * or -1 when out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+static int32_t sr_fib_chunk(struct sr_fib* fib, uint32_t leaf)
+{
+    uint32_t* chunk;
+    int i;
+
+    if (fib->tbl8_used == fib->tbl8_size)
+    {
+        uint32_t size = fib->tbl8_size ? fib->tbl8_size * 2 : 64;
+        uint32_t* tbl8;
+
+        if (size > (SR_FIB_CHILD >> 8))
+        { return -1; }
+
+        tbl8 = realloc(fib->tbl8, (size_t)size * SR_FIB_CHUNK_SZ * sizeof(uint32_t));
+        if (!tbl8)
+        { return -1; }
+        fib->tbl8 = tbl8;
+        fib->tbl8_size = size;
+    }
+
+    chunk = fib->tbl8 + (size_t)fib->tbl8_used * SR_FIB_CHUNK_SZ;
+    for (i = 0; i < SR_FIB_CHUNK_SZ; i++)
+    { chunk[i] = leaf; }
+
+    return fib->tbl8_used++;
+} /* -- sr_fib_chunk -- */
+
+/* Returns the chunk below *slot, creating it if slot is still a leaf.
+   slot is given as an index since tbl8 may move while growing. */
+static int32_t sr_fib_descend(struct sr_fib* fib, uint32_t* tbl, size_t slot)
+{
+    uint32_t entry = tbl[slot];
+    int32_t chunk;
+
+    if (entry & SR_FIB_CHILD)
+    { return entry & ~SR_FIB_CHILD; }
+
+    chunk = sr_fib_chunk(fib, entry);
+    if (chunk < 0)
+    { return -1; }
+
+    /* tbl may have been tbl8, which sr_fib_chunk can reallocate */
+    if (tbl != fib->tbl16)
+    { tbl = fib->tbl8; }
+    tbl[slot] = SR_FIB_CHILD | chunk;
+
+    return chunk;
+}
+
+static void sr_fib_fill(uint32_t* tbl, size_t first, size_t count,
+                        uint32_t value)
+{
+    size_t i;
+
+    for (i = first; i < first + count; i++)
+    { tbl[i] = value; }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_install(..)
+ * Scope:  Local
+ *
+ * Write value into every slot covered by prefix/plen.  Routes must be
+ * installed in increasing prefix length order.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_install(struct sr_fib* fib, uint32_t prefix, int plen,
+                          uint32_t value)
+{
+    int32_t chunk;
+    size_t slot;
+
+    if (plen <= 16)
+    {
+        sr_fib_fill(fib->tbl16, prefix >> 16, (size_t)1 << (16 - plen), value);
+        return 0;
+    }
+
+    if ((chunk = sr_fib_descend(fib, fib->tbl16, prefix >> 16)) < 0)
+    { return -1; }
+    slot = ((size_t)chunk << 8) | ((prefix >> 8) & 0xff);
+
+    if (plen <= 24)
+    {
+        sr_fib_fill(fib->tbl8, slot, (size_t)1 << (24 - plen), value);
+        return 0;
+    }
+
+    if ((chunk = sr_fib_descend(fib, fib->tbl8, slot)) < 0)
+    { return -1; }
+    slot = ((size_t)chunk << 8) | (prefix & 0xff);
+
+    sr_fib_fill(fib->tbl8, slot, (size_t)1 << (32 - plen), value);
+    return 0;
+} /* -- sr_fib_install -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_init(..)
+ * Scope:  Global
+ *
+ * Start out with an empty (uncompiled) table.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_init(struct sr_fib* fib)
+{
+    assert(fib);
+    memset(fib, 0, sizeof(struct sr_fib));
+} /* -- sr_fib_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_build(..)
+ * Scope:  Global
+ *
+ * Compile the routing table list rt into fib, replacing whatever was
+ * there.  Lookups return the same entry the list walk in
+ * sr_rt_lookup_linear would.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if the table has a non-contiguous mask or memory ran out; fib is
+ *  left uncompiled in that case
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_build(struct sr_fib* fib, struct sr_rt* rt)
+{
+    struct sr_fib_route* routes = 0;
+    struct sr_rt* rt_walker = 0;
+    uint32_t count = 0;
+    uint32_t i;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    sr_fib_destroy(fib);
+
+    for (rt_walker = rt; rt_walker; rt_walker = rt_walker->next)
+    { count++; }
+
+    fib->tbl16 = calloc(SR_FIB_TBL16_SZ, sizeof(uint32_t));
+    fib->nh = malloc((count ? count : 1) * sizeof(struct sr_rt*));
+    routes = malloc((count ? count : 1) * sizeof(struct sr_fib_route));
+    if (!fib->tbl16 || !fib->nh || !routes)
+    { goto fail; }
+
+    for (i = 0, rt_walker = rt; rt_walker; rt_walker = rt_walker->next, i++)
+    {
+        routes[i].rt = rt_walker;
+        routes[i].plen = sr_fib_prefix_len(rt_walker->mask.s_addr);
+        routes[i].order = i;
+        if (routes[i].plen < 0)
+        {
+            fprintf(stderr, "sr_fib_build: non-contiguous mask, "
+                    "using routing table list\n");
+            goto fail;
+        }
+        routes[i].prefix = ntohl(rt_walker->dest.s_addr & rt_walker->mask.s_addr);
+    }
+
+    qsort(routes, count, sizeof(struct sr_fib_route), sr_fib_route_cmp);
+
+    for (i = 0; i < count; i++)
+    {
+        fib->nh[i] = routes[i].rt;
+        if (sr_fib_install(fib, routes[i].prefix, routes[i].plen, i + 1) != 0)
+        {
+            fprintf(stderr, "sr_fib_build: out of memory\n");
+            goto fail;
+        }
+    }
+    fib->nh_count = count;
+
+    free(routes);
+    return 0;
+
+fail:
+    free(routes);
+    sr_fib_destroy(fib);
+    return -1;
+} /* -- sr_fib_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_destroy(..)
+ * Scope:  Global
+ *
+ * Free the compiled table.  Lookups fall back to the list afterwards.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    assert(fib);
+
+    free(fib->tbl16);
+    free(fib->tbl8);
+    free(fib->nh);
+    sr_fib_init(fib);
+} /* -- sr_fib_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope:  Global
+ *
+ * At most three table reads: tbl16, then up to two tbl8 chunks.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip)
+{
+    uint32_t addr = ntohl(ip);
+    uint32_t entry = fib->tbl16[addr >> 16];
+
+    if (entry & SR_FIB_CHILD)
+    {
+        entry = fib->tbl8[((entry & ~SR_FIB_CHILD) << 8) | ((addr >> 8) & 0xff)];
+        if (entry & SR_FIB_CHILD)
+        {
+            entry = fib->tbl8[((entry & ~SR_FIB_CHILD) << 8) | (addr & 0xff)];
+        }
+    }
+
+    return entry ? fib->nh[entry - 1] : 0;
+} /* -- sr_fib_lookup -- */
+
+void sr_fib_prefetch(const struct sr_fib* fib, uint32_t ip, int depth)
+{
+    uint32_t addr = ntohl(ip);
+    uint32_t entry;
+
+    if (fib->tbl16 == 0)
+    { return; }
+
+    if (depth == 0)
+    {
+        __builtin_prefetch(&fib->tbl16[addr >> 16]);
+        return;
+    }
+
+    entry = fib->tbl16[addr >> 16];
+    if (entry & SR_FIB_CHILD)
+    { __builtin_prefetch(&fib->tbl8[((entry & ~SR_FIB_CHILD) << 8) | ((addr >> 8) & 0xff)]); }
+} /* -- sr_fib_prefetch -- */
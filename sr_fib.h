@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ *
+ * Description:
+ *
+ * Compiled forwarding table.  The routing table list (struct sr_rt) is
+ * compiled into a multibit trie with strides 16/8/8.  Shorter prefixes are
+ * pushed down into the leaves of longer ones when a child table is created,
+ * so a lookup never backtracks and touches at most three table entries no
+ * matter how many prefixes are loaded.
+ *
+ * Table entries are 32 bits wide:
+ *
+ *   0                      no route
+ *   SR_FIB_CHILD | n       descend into second/third level chunk n
+ *   i (i > 0)              next hop is nh[i - 1]
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FIB_H
+#define sr_FIB_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_FIB_CHILD      0x80000000
+#define SR_FIB_TBL16_SZ   (1 << 16)
+#define SR_FIB_CHUNK_SZ   256
+
+struct sr_rt;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib
+ *
+ * Compiled form of the routing table.  tbl16 == 0 means the table has not
+ * been compiled (or could not be) and callers should walk the list instead.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib
+{
+    uint32_t* tbl16;        /* first level, indexed by the top 16 bits */
+    uint32_t* tbl8;         /* second and third level chunks */
+    uint32_t  tbl8_used;    /* chunks handed out */
+    uint32_t  tbl8_size;    /* chunks allocated */
+    struct sr_rt** nh;      /* next hop table, one slot per route */
+    uint32_t  nh_count;
+};
+
+void sr_fib_init(struct sr_fib* fib);
+int  sr_fib_build(struct sr_fib* fib, struct sr_rt* rt);
+void sr_fib_destroy(struct sr_fib* fib);
+
+/* Longest prefix match on ip (network byte order).  Returns 0 when no
+   route covers ip. */
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip);
+
+/* Start loading what a lookup of ip will read, ahead of the lookup:
+   the first level entry (depth 0), or the second level entry the first
+   one leads to (depth 1, which reads the first, so prefetch that with
+   depth 0 some time before). */
+void sr_fib_prefetch(const struct sr_fib* fib, uint32_t ip, int depth);
+
+#endif  /* --  sr_FIB_H -- */
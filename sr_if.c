@@ -25,6 +25,179 @@
 #include "sr_if.h"
 #include "sr_router.h"
 
+/* tries per bucket before the hash table is made bigger */
+#define SR_IF_HASH_TRIES 4096
+
+/* FNV-1a over a name, as far as sr_IFACE_NAMELEN or its NUL */
+static uint32_t sr_if_name_hash(const char* name)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < sr_IFACE_NAMELEN && name[i]; i++)
+    { h = (h ^ (uint8_t)name[i]) * 16777619u; }
+    return h;
+} /* -- sr_if_name_hash -- */
+
+/* slot, before masking, of a name hash displaced by d */
+static uint32_t sr_if_slot(uint32_t h, uint32_t d)
+{
+    h ^= d * 0x9e3779b9;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h;
+} /* -- sr_if_slot -- */
+
+/* Put the n names keys[] (of one bucket) where displacement d sends
+   them; 0, with nothing placed, if one lands on a taken slot. */
+static int sr_if_hash_place(struct sr_if_table* t, const uint32_t* h,
+                            const unsigned int* keys, unsigned int n,
+                            uint32_t d)
+{
+    unsigned int i, j, s;
+
+    for (i = 0; i < n; i++)
+    {
+        s = sr_if_slot(h[keys[i]], d) & (t->nslots - 1);
+        if (t->slot[s])
+        {
+            for (j = 0; j < i; j++)
+            { t->slot[sr_if_slot(h[keys[j]], d) & (t->nslots - 1)] = 0; }
+            return 0;
+        }
+        t->slot[s] = t->named[keys[i]];
+    }
+    return 1;
+} /* -- sr_if_hash_place -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_hash_build(..)
+ * Scope: Local
+ *
+ * Hash and displace: names fall into nbuckets buckets by their hash,
+ * and each bucket gets the displacement that puts all of its names on
+ * free slots, fullest buckets first.  With twice as many slots as names
+ * that takes a few tries per bucket; when some bucket runs out of tries
+ * the table doubles, and if that never works (names whose 32 bit hashes
+ * collide) there is no hash and lookups walk the list.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_hash_build(struct sr_if_table* t)
+{
+    uint32_t* h = 0;
+    unsigned int* start = 0;    /* bucket b's names are keys[start[b]..start[b + 1]) */
+    unsigned int* keys = 0;
+    unsigned int i, b, n, size, most;
+    uint32_t d;
+
+    free(t->slot);
+    free(t->disp);
+    t->slot = 0;
+    t->disp = 0;
+    if (t->nnamed == 0)
+    { return; }
+
+    for (t->nbuckets = 1; t->nbuckets * 2 < t->nnamed; t->nbuckets <<= 1);
+    h = (uint32_t*)malloc(t->nnamed * sizeof(uint32_t));
+    keys = (unsigned int*)malloc(t->nnamed * sizeof(unsigned int));
+    start = (unsigned int*)calloc(t->nbuckets + 1, sizeof(unsigned int));
+    if (h == 0 || keys == 0 || start == 0)
+    { goto done; }
+
+    /* -- names grouped by bucket -- */
+    for (i = 0; i < t->nnamed; i++)
+    {
+        h[i] = sr_if_name_hash(t->named[i]->name);
+        start[(h[i] & (t->nbuckets - 1)) + 1]++;
+    }
+    most = 0;
+    for (b = 0; b < t->nbuckets; b++)
+    {
+        if (start[b + 1] > most)
+        { most = start[b + 1]; }
+        start[b + 1] += start[b];
+    }
+    for (i = 0; i < t->nnamed; i++)
+    { keys[start[h[i] & (t->nbuckets - 1)]++] = i; }
+    for (b = t->nbuckets; b > 0; b--)
+    { start[b] = start[b - 1]; }
+    start[0] = 0;
+
+    for (t->nslots = 2; t->nslots < 2 * t->nnamed; t->nslots <<= 1);
+    for (; t->nslots <= 32 * t->nnamed; t->nslots <<= 1)
+    {
+        free(t->slot);
+        free(t->disp);
+        t->slot = (struct sr_if**)calloc(t->nslots, sizeof(struct sr_if*));
+        t->disp = (uint32_t*)calloc(t->nbuckets, sizeof(uint32_t));
+        if (t->slot == 0 || t->disp == 0)
+        { break; }
+
+        for (size = most; size > 0; size--)
+        {
+            for (b = 0; b < t->nbuckets; b++)
+            {
+                n = start[b + 1] - start[b];
+                if (n != size)
+                { continue; }
+                for (d = 0; d < SR_IF_HASH_TRIES; d++)
+                {
+                    if (sr_if_hash_place(t, h, keys + start[b], n, d))
+                    { break; }
+                }
+                if (d == SR_IF_HASH_TRIES)
+                { break; }
+                t->disp[b] = d;
+            }
+            if (b < t->nbuckets)
+            { break; }
+        }
+        if (size == 0)
+        { goto done; }
+    }
+
+    free(t->slot);
+    free(t->disp);
+    t->slot = 0;
+    t->disp = 0;
+done:
+    free(h);
+    free(keys);
+    free(start);
+} /* -- sr_if_hash_build -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_table_add(..)
+ * Scope: Local
+ *
+ * Give a new interface the next id and, unless an earlier interface has
+ * its name (which sr_get_interface keeps finding), a place in the hash.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_table_add(struct sr_instance* sr, struct sr_if* iface)
+{
+    struct sr_if_table* t = &sr->ifs;
+    struct sr_if* found = sr_get_interface(sr, iface->name);
+
+    t->by_id = (struct sr_if**)realloc(t->by_id,
+                                       (t->n + 1) * sizeof(struct sr_if*));
+    assert(t->by_id);
+    iface->id = t->n;
+    t->by_id[t->n++] = iface;
+
+    if (found && found != iface)
+    { return; }
+
+    t->named = (struct sr_if**)realloc(t->named,
+                                       (t->nnamed + 1) * sizeof(struct sr_if*));
+    assert(t->named);
+    t->named[t->nnamed++] = iface;
+    sr_if_hash_build(t);
+} /* -- sr_if_table_add -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
  * Scope: Global
@@ -36,12 +209,25 @@
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 {
+    struct sr_if_table* t = 0;
     struct sr_if* if_walker = 0;
+    uint32_t h;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
+    t = &sr->ifs;
+    if (t->slot)
+    {
+        h = sr_if_name_hash(name);
+        if_walker = t->slot[sr_if_slot(h, t->disp[h & (t->nbuckets - 1)]) &
+                            (t->nslots - 1)];
+        if (if_walker && !strncmp(if_walker->name, name, sr_IFACE_NAMELEN))
+        { return if_walker; }
+        return 0;
+    }
+
     if_walker = sr->if_list;
 
     while(if_walker)
@@ -54,6 +240,118 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
     return 0;
 } /* -- sr_get_interface -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_get_interface_id
+ * Scope: Global
+ *
+ * The interface with id, 0 if there is none.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_id(struct sr_instance* sr, unsigned int id)
+{
+    return id < sr->ifs.n ? sr->ifs.by_id[id] : 0;
+} /* -- sr_get_interface_id -- */
+
+/* slot an address hashes to in a table of size slots, a power of two
+   of at least 8 (Fibonacci hashing: the top bits of ip * 2^32 / phi) */
+static unsigned int sr_if_addr_hash(uint32_t ip, unsigned int size)
+{
+    return (uint32_t)(ip * 0x9e3779b9u) >> (32 - __builtin_ctz(size));
+} /* -- sr_if_addr_hash -- */
+
+static struct sr_if_addr* sr_if_addr_find(struct sr_if_addr* addrs,
+                                          unsigned int size, uint32_t ip)
+{
+    unsigned int i;
+
+    if (addrs == 0 || ip == 0)
+    { return 0; }
+
+    for (i = sr_if_addr_hash(ip, size); addrs[i].ip; i = (i + 1) & (size - 1))
+    {
+        if (addrs[i].ip == ip)
+        { return &addrs[i]; }
+    }
+    return 0;
+} /* -- sr_if_addr_find -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_addr_build(..)
+ * Scope: Local
+ *
+ * Rebuild the address table from the interface list.  An address set on
+ * several interfaces belongs to the first, as sr_search_interface_by_ip
+ * always had it; flags stay with addresses that are still there.  Out of
+ * memory, the old table is kept.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_addr_build(struct sr_instance* sr)
+{
+    struct sr_if_table* t = &sr->ifs;
+    struct sr_if_addr* addrs;
+    struct sr_if_addr* old;
+    struct sr_if* if_walker;
+    unsigned int n = 0, size, i;
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    { n++; }
+    for (size = 8; size < 4 * n; size <<= 1);
+
+    addrs = (struct sr_if_addr*)calloc(size, sizeof(struct sr_if_addr));
+    if (addrs == 0)
+    { return; }
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        if (if_walker->ip == 0 || sr_if_addr_find(addrs, size, if_walker->ip))
+        { continue; }
+
+        for (i = sr_if_addr_hash(if_walker->ip, size); addrs[i].ip;
+             i = (i + 1) & (size - 1));
+        addrs[i].ip = if_walker->ip;
+        addrs[i].iface = if_walker;
+        if ((old = sr_if_addr_find(t->addrs, t->naddrs, if_walker->ip)) != 0)
+        { addrs[i].flags = old->flags; }
+    }
+
+    free(t->addrs);
+    t->addrs = addrs;
+    t->naddrs = size;
+} /* -- sr_if_addr_build -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_addr_lookup
+ * Scope: Global
+ *
+ * The router's own address ip_nbo, 0 if it is not one.
+ *
+ *---------------------------------------------------------------------*/
+
+const struct sr_if_addr* sr_if_addr_lookup(struct sr_instance* sr, uint32_t ip_nbo)
+{
+    return sr_if_addr_find(sr->ifs.addrs, sr->ifs.naddrs, ip_nbo);
+} /* -- sr_if_addr_lookup -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_addr_set_flags
+ * Scope: Global
+ *
+ * Add flags to the router's address ip_nbo.  -1 if it is not one.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_if_addr_set_flags(struct sr_instance* sr, uint32_t ip_nbo, unsigned int flags)
+{
+    struct sr_if_addr* addr = sr_if_addr_find(sr->ifs.addrs, sr->ifs.naddrs, ip_nbo);
+
+    if (addr == 0)
+    { return -1; }
+    addr->flags |= flags;
+    return 0;
+} /* -- sr_if_addr_set_flags -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_add_interface(..)
  * Scope: Global
@@ -76,7 +374,10 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->nat_inside = 0;
+        sr->if_list->ip = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr_if_table_add(sr, sr->if_list);
         return;
     }
 
@@ -89,7 +390,10 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->nat_inside = 0;
+    if_walker->ip = 0;
     if_walker->next = 0;
+    sr_if_table_add(sr, if_walker);
 } /* -- sr_add_interface -- */ 
 
 /*--------------------------------------------------------------------- 
@@ -120,7 +424,8 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
  * Method: sr_set_ether_ip(..)
  * Scope: Global
  *
- * set the IP address of the LAST interface in the interface list
+ * set the IP address of the LAST interface in the interface list, and
+ * bring the address table up to date
  *
  *---------------------------------------------------------------------*/
 
@@ -137,6 +442,7 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_if_addr_build(sr);
 
 } /* -- sr_set_ether_ip -- */
 
@@ -38,13 +38,61 @@ struct sr_instance;
 struct sr_if
 {
   char name[sr_IFACE_NAMELEN];
+  unsigned int id;  /* index into sr->ifs.by_id, in the order added */
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  int nat_inside;   /* NAT mode: the private side */
   struct sr_if* next;
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_if_addr
+ *
+ * One of the router's own IPv4 addresses, with what else it is used for.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_if_addr
+{
+  uint32_t ip;              /* network byte order, 0 in an empty slot */
+  unsigned int flags;       /* SR_IF_ADDR_* */
+  struct sr_if* iface;      /* the first interface with the address */
+};
+
+#define SR_IF_ADDR_NAT_EXT 0x1  /* NAT's external address (sr_enable_nat) */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_if_table
+ *
+ * The interface list again, by id and by name.  Ids are dense and never
+ * change once sr_add_interface (from sr_handle_hwinfo) has handed them out.
+ * Names go through a perfect hash, rebuilt as interfaces are added, so
+ * sr_get_interface is one hash, one probe and one compare.  The
+ * interfaces' IPv4 addresses are in an open addressing table, rebuilt as
+ * they are set and kept at most a quarter full, so "is this one of the
+ * router's addresses" is a single probe almost always.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_if_table
+{
+  struct sr_if** by_id;     /* n of them */
+  unsigned int n;
+  struct sr_if** named;     /* the first interface of each name */
+  unsigned int nnamed;
+  uint32_t* disp;           /* displacement per bucket */
+  unsigned int nbuckets;    /* power of two */
+  struct sr_if** slot;      /* 0 if there is no hash: walk the list */
+  unsigned int nslots;      /* power of two */
+  struct sr_if_addr* addrs; /* by address, 0 until one is set */
+  unsigned int naddrs;      /* slots, power of two */
+};
+
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
+struct sr_if* sr_get_interface_id(struct sr_instance* sr, unsigned int id);
+const struct sr_if_addr* sr_if_addr_lookup(struct sr_instance* sr, uint32_t ip_nbo);
+int  sr_if_addr_set_flags(struct sr_instance* sr, uint32_t ip_nbo, unsigned int flags);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
@@ -0,0 +1,50 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.h
+ *
+ * Description:
+ *
+ * Pluggable packet source/sink for the router.  By default (sr->io == 0)
+ * frames come from and go to the VNS server through sr_vns_comm.c.  A
+ * backend set in sr->io takes over both directions: its read() is called
+ * by the main loop in place of sr_read_from_server, and sr_send_packet /
+ * sr_send_packet_inplace hand it each outgoing frame after their usual
+ * checks and logging.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_IO_H
+#define sr_IO_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
+struct sr_io_ops
+{
+    const char* name;
+
+    /* Deliver input to sr_handlepacket.  Same contract as
+       sr_read_from_server: 1 to be called again, 0 when the input is
+       done, -1 on error. */
+    int  (*read)(struct sr_instance* sr);
+
+    /* Transmit one Ethernet frame.  May be called from the ARP thread. */
+    int  (*send)(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                 const char* iface);
+
+    /* Report and free whatever the backend holds */
+    void (*close)(struct sr_instance* sr);
+};
+
+/* -- sr_replay.c -- */
+int sr_replay_load_ifaces(struct sr_instance* sr, const char* filename);
+int sr_replay_open(struct sr_instance* sr, const char* in_pcap,
+                   const char* out_pcap, int loops, int timed);
+
+#endif /* -- sr_IO_H -- */
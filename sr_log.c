@@ -0,0 +1,68 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Output side of sr_log.h.  Errors and warnings go to stderr, the rest to
+ * stdout like the router's other chatter.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "sr_log.h"
+
+int sr_log_level = SR_LOG_INFO;
+int sr_log_dump_rate = 0;
+
+/* dump budget for the current second; races between threads only make
+   the limit a little loose */
+static time_t sr_log_dump_window;
+static int sr_log_dump_used;
+static unsigned long sr_log_dump_dropped;
+
+void sr_log_print(int level, const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(level <= SR_LOG_WARN ? stderr : stdout, fmt, ap);
+    va_end(ap);
+} /* -- sr_log_print -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_dump_ok(..)
+ * Scope:  Global
+ *
+ * Returns 1 if another header dump fits in this second's budget.  The
+ * number of dumps skipped is reported when the next second starts.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_log_dump_ok(void)
+{
+    time_t now = time(NULL);
+
+    if (now != sr_log_dump_window)
+    {
+        if (sr_log_dump_dropped)
+        {
+            fprintf(stderr, "(%lu header dumps suppressed)\n",
+                    sr_log_dump_dropped);
+        }
+        sr_log_dump_window = now;
+        sr_log_dump_used = 0;
+        sr_log_dump_dropped = 0;
+    }
+
+    if (sr_log_dump_used < sr_log_dump_rate)
+    {
+        sr_log_dump_used++;
+        return 1;
+    }
+
+    sr_log_dump_dropped++;
+    return 0;
+} /* -- sr_log_dump_ok -- */
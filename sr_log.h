@@ -0,0 +1,55 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Leveled logging for the router.  A message is printed when its level is
+ * at or below both the compile time ceiling SR_LOG_LEVEL and the runtime
+ * level sr_log_level (-d on the command line).  Anything above the ceiling
+ * compiles to nothing, so a build with
+ *
+ *   make OPTFLAGS="-O2 -DSR_LOG_LEVEL=SR_LOG_INFO"
+ *
+ * carries no per-packet logging code at all.
+ *
+ * Header dumps (print_hdrs and friends) are a separate category wrapped in
+ * sr_log_dump(..).  They are off unless -D gives a rate, and then limited
+ * to that many per second so a busy link cannot flood the terminal.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_LOG_H
+#define sr_LOG_H
+
+#define SR_LOG_ERROR  0
+#define SR_LOG_WARN   1
+#define SR_LOG_INFO   2
+#define SR_LOG_DEBUG  3
+
+#ifndef SR_LOG_LEVEL
+#define SR_LOG_LEVEL  SR_LOG_DEBUG
+#endif
+
+extern int sr_log_level;        /* runtime level, SR_LOG_INFO by default */
+extern int sr_log_dump_rate;    /* header dumps per second, 0 is off */
+
+void sr_log_print(int level, const char* fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+int  sr_log_dump_ok(void);
+
+#define sr_log(level, fmt, args...) \
+    do { if ((level) <= SR_LOG_LEVEL && (level) <= sr_log_level) \
+             sr_log_print(level, fmt, ## args); } while (0)
+
+#define sr_log_error(fmt, args...)  sr_log(SR_LOG_ERROR, fmt, ## args)
+#define sr_log_warn(fmt, args...)   sr_log(SR_LOG_WARN, fmt, ## args)
+#define sr_log_info(fmt, args...)   sr_log(SR_LOG_INFO, fmt, ## args)
+#define sr_log_debug(fmt, args...)  sr_log(SR_LOG_DEBUG, fmt, ## args)
+
+/* runs stmt (a print_hdrs call or similar) when dumps are on and the
+   rate limit allows it */
+#define sr_log_dump(stmt) \
+    do { if (SR_LOG_LEVEL >= SR_LOG_DEBUG && sr_log_dump_rate && \
+             sr_log_dump_ok()) { stmt; } } while (0)
+
+#endif /* -- sr_LOG_H -- */
@@ -32,6 +32,10 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_log.h"
+#include "sr_io.h"
+#include "sr_engine.h"
+#include "sr_vec.h"
 
 extern char* optarg;
 
@@ -44,12 +48,15 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define DEFAULT_NAT_INSIDE "eth1"
+#define SR_LOG_SLOTS 4096
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static void sr_engine_report(struct sr_instance* );
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -65,11 +72,30 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    unsigned int arp_max = 0;
+    char *replay = 0;
+    char *replay_out = 0;
+    char *ifaces = 0;
+    int replay_loops = 1;
+    int replay_timed = 0;
+    int nat = 0;
+    char *nat_inside[SR_NAT_MAX_INSIDE];
+    int nat_ninside = 0;
+    int icmp_timeout = SR_NAT_ICMP_TIMEOUT;
+    int tcp_est_timeout = SR_NAT_TCP_EST_TIMEOUT;
+    int tcp_trans_timeout = SR_NAT_TCP_TRANS_TIMEOUT;
+    int udp_timeout = SR_NAT_UDP_TIMEOUT;
+    int batch_sends = 0;
+    unsigned int log_slots = SR_LOG_SLOTS;
+    int log_block = 0;
+    unsigned int pbufs = 0;
+    unsigned int workers = 0;
+    int vector_input = 0;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:c:d:D:P:W:F:L:SnN:I:E:R:U:Bq:KZ:w:V")) != EOF)
     {
         switch (c)
         {
@@ -101,11 +127,89 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'c':
+                arp_max = atoi((char *) optarg);
+                break;
+            case 'd':
+                sr_log_level = atoi((char *) optarg);
+                break;
+            case 'D':
+                sr_log_dump_rate = atoi((char *) optarg);
+                break;
+            case 'P':
+                replay = optarg;
+                break;
+            case 'W':
+                replay_out = optarg;
+                break;
+            case 'F':
+                ifaces = optarg;
+                break;
+            case 'L':
+                replay_loops = atoi((char *) optarg);
+                break;
+            case 'S':
+                replay_timed = 1;
+                break;
+            case 'n':
+                nat = 1;
+                break;
+            case 'N':
+                if(nat_ninside == SR_NAT_MAX_INSIDE)
+                {
+                    fprintf(stderr,"At most %d inside interfaces\n", SR_NAT_MAX_INSIDE);
+                    exit(1);
+                }
+                nat_inside[nat_ninside++] = optarg;
+                break;
+            case 'I':
+                icmp_timeout = atoi((char *) optarg);
+                break;
+            case 'E':
+                tcp_est_timeout = atoi((char *) optarg);
+                break;
+            case 'R':
+                tcp_trans_timeout = atoi((char *) optarg);
+                break;
+            case 'U':
+                udp_timeout = atoi((char *) optarg);
+                break;
+            case 'B':
+                batch_sends = 1;
+                break;
+            case 'q':
+                log_slots = atoi((char *) optarg);
+                break;
+            case 'K':
+                log_block = 1;
+                break;
+            case 'Z':
+                pbufs = atoi((char *) optarg);
+                break;
+            case 'w':
+                workers = atoi((char *) optarg);
+                break;
+            case 'V':
+                vector_input = 1;
+                break;
         } /* switch */
     } /* -- while -- */
 
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    sr.tx.enabled = batch_sends;
+    sr.vector = vector_input;
+
+    /* -- every packet buffer up front, growing the pool is fatal -- */
+    if(pbufs)
+    {
+        if(sr_pbuf_reserve(pbufs) != 0)
+        {
+            fprintf(stderr,"Cannot allocate %u packet buffers\n", pbufs);
+            exit(1);
+        }
+        sr_pbuf_strict(1);
+    }
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -133,40 +237,137 @@ int main(int argc, char **argv)
                     logfile);
             exit(1);
         }
+        if(log_slots)
+        {
+            sr.logq = sr_dump_async_open(sr.logfile, log_slots,
+                                         PACKET_DUMP_SIZE, log_block);
+            if(!sr.logq)
+            {
+                fprintf(stderr,"Error starting dump file writer\n");
+                exit(1);
+            }
+        }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(replay)
     {
-        return 1;
+        /* -- offline: interfaces from a file, packets from a pcap -- */
+        if(!ifaces || sr_replay_load_ifaces(&sr, ifaces) != 0)
+        {
+            fprintf(stderr,"Replay needs an interface file (-F)\n");
+            return 1;
+        }
+        if(sr.routing_table == 0)
+        { sr_load_rt_wrap(&sr, rtable); }
+        if(sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr,"Routing table not consistent with interfaces\n");
+            return 1;
+        }
+        if(sr_replay_open(&sr, replay, replay_out, replay_loops,
+                          replay_timed) != 0)
+        { return 1; }
     }
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
-    }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
+        else {
+          /* Read from specified routing table */
+          sr_load_rt_wrap(&sr, rtable);
+        }
     }
 
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    if(arp_max)
+    { sr_arpcache_set_max_entries(&sr.cache, arp_max); }
+
+    if(nat)
+    {
+        if(nat_ninside == 0)
+        { nat_inside[nat_ninside++] = DEFAULT_NAT_INSIDE; }
+        sr.nat_opts.enabled = 1;
+        memcpy(sr.nat_opts.inside, nat_inside, sizeof(nat_inside));
+        sr.nat_opts.ninside = nat_ninside;
+        sr.nat_opts.icmp_timeout = icmp_timeout;
+        sr.nat_opts.tcp_est_timeout = tcp_est_timeout;
+        sr.nat_opts.tcp_trans_timeout = tcp_trans_timeout;
+        sr.nat_opts.udp_timeout = udp_timeout;
+    }
+
+    /* -- with VNS the interfaces arrive in HWINFO, NAT starts there -- */
+    if(sr.if_list && sr_start_nat(&sr) != 0)
+    {
+        fprintf(stderr,"Could not set up NAT\n");
+        return 1;
+    }
+
+    if(workers && sr_engine_start(&sr, workers) != 0)
+    {
+        fprintf(stderr,"Could not start %u workers\n", workers);
+        return 1;
+    }
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(sr.io)
+    {
+        while( sr.io->read(&sr) == 1);
+        sr_engine_report(&sr);
+        sr_engine_stop(&sr);
+        sr.io->close(&sr);
+    }
+    else
+    {
+        while( sr_read_from_server(&sr) == 1);
+        sr_engine_report(&sr);
+        sr_engine_stop(&sr);
+    }
 
     sr_destroy_instance(&sr);
 
     return 0;
 }/* -- main -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_engine_report(..)
+ * Scope: Local
+ *
+ * How the input was spread over the workers, if there are any.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_engine_report(struct sr_instance* sr)
+{
+    struct sr_engine* engine = sr->engine;
+    unsigned int i;
+
+    if(!engine)
+    { return; }
+
+    sr_engine_drain(engine);
+    printf("engine: %lu frames to %u workers, %lu dropped:",
+           engine->dispatched, engine->nworkers, engine->dropped);
+    for(i = 0; i < engine->nworkers; i++)
+    { printf(" %lu", engine->workers[i].packets); }
+    printf("\n");
+} /* -- sr_engine_report -- */
+
 /*-----------------------------------------------------------------------------
  * Method: usage(..)
  * Scope: local
@@ -178,7 +379,19 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file [-q capture queue slots, 0 to write inline]\n");
+    printf("            [-K (block when the capture queue is full)]] \n");
+    printf("           [-c arp cache entries] \n");
+    printf("           [-d log level 0-3] [-D header dumps/sec] \n");
+    printf("           [-B (batch sends to the server)] \n");
+    printf("           [-Z packet buffers (preallocate, abort if more are needed)] \n");
+    printf("           [-w worker threads (flow-hashed, 0 to handle input inline)] \n");
+    printf("           [-V (handle input in vectors of up to %d frames)] \n", SR_VEC_MAX);
+    printf("           [-P replay pcap -F interface file [-W out pcap]\n");
+    printf("            [-L passes] [-S (captured timing)]] \n");
+    printf("           [-n (NAT) [-N inside interface]... [-I icmp timeout]\n");
+    printf("            [-E tcp established timeout] [-R tcp transitory timeout]\n");
+    printf("            [-U udp timeout]] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -220,11 +433,52 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
+    if(sr->logq)
+    {
+        printf("pcap: %lu captured, %lu dropped\n",
+               sr->logq->captured, sr->logq->dropped);
+        sr_dump_async_close(sr->logq);
+    }
     if(sr->logfile)
     {
         sr_dump_close(sr->logfile);
     }
 
+    if(sr->rx.packets)
+    {
+        printf("vns: %lu packets in %lu reads, %.2f reads/packet; "
+               "%lu frames out in %lu writes\n",
+               sr->rx.packets, sr->rx.reads,
+               (double)sr->rx.reads / sr->rx.packets,
+               sr->tx.frames, sr->tx.writes);
+    }
+    free(sr->rx.data);
+
+    {
+        struct sr_pbuf_stats ps;
+
+        sr_pbuf_get_stats(&ps);
+        if(ps.allocs)
+        {
+            printf("pbuf: %lu allocs, %lu failed, %lu buffers in %lu mallocs, "
+                   "%lu in use\n", ps.allocs, ps.failed, ps.bufs, ps.grows,
+                   ps.in_use);
+        }
+    }
+
+    if(sr->nat_enabled)
+    {
+        struct sr_nat_stats st;
+
+        sr_nat_get_stats(&sr->nat, &st);
+        printf("nat: outbound %lu translated %lu dropped, "
+               "inbound %lu translated %lu dropped, %lu allocations\n",
+               st.translated[SR_NAT_OUTBOUND], st.dropped[SR_NAT_OUTBOUND],
+               st.translated[SR_NAT_INBOUND], st.dropped[SR_NAT_INBOUND],
+               st.allocs);
+        sr_nat_destroy(&sr->nat);
+    }
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -247,61 +501,22 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
+    memset(&sr->ifs, 0, sizeof(sr->ifs));
     sr->routing_table = 0;
+    sr_fib_init(&sr->fib);
     sr->logfile = 0;
+    sr->logq = 0;
+    sr->io = 0;
+    sr->io_data = 0;
+    sr->nat_enabled = 0;
+    memset(&sr->nat_opts, 0, sizeof(sr->nat_opts));
+    memset(&sr->rx, 0, sizeof(sr->rx));
+    memset(&sr->tx, 0, sizeof(sr->tx));
+    pthread_mutex_init(&sr->tx.lock, 0);
+    sr->engine = 0;
+    sr->vector = 0;
 } /* -- sr_init_instance -- */
 
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
-    {
-        return 999; /* doh! */
-    }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
-
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
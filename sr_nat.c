@@ -2,19 +2,468 @@
 #include <signal.h>
 #include <assert.h>
 #include "sr_nat.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <arpa/inet.h>
+
+/* murmur3 finalizer, same mixing as the ARP cache */
+static uint32_t sr_nat_mix(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+static uint32_t sr_nat_flow_hash(uint32_t ip_int, uint16_t aux_int,
+    sr_nat_mapping_type type) {
+  return sr_nat_mix(sr_nat_mix(ip_int) ^ ((uint32_t)aux_int << 2 | type));
+}
+
+static unsigned int sr_nat_hash_int(uint32_t ip_int, uint16_t aux_int,
+    sr_nat_mapping_type type, unsigned int size) {
+  return sr_nat_flow_hash(ip_int, aux_int, type) & (size - 1);
+}
+
+static unsigned int sr_nat_hash_ext(uint16_t aux_ext,
+    sr_nat_mapping_type type, unsigned int size) {
+  return sr_nat_mix((uint32_t)aux_ext << 2 | type) & (size - 1);
+}
+
+/* Shard of an internal endpoint, from the top bits of its flow hash (the
+   bucket index within the shard uses the bottom ones). */
+static struct sr_nat_shard *sr_nat_shard_int(struct sr_nat *nat,
+    uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type) {
+  uint64_t h = sr_nat_flow_hash(ip_int, aux_int, type);
+
+  return &nat->shards[(h * nat->nshards) >> 32];
+}
+
+/* Shard whose part of the port range holds aux_ext, NULL if none does. */
+static struct sr_nat_shard *sr_nat_shard_ext(struct sr_nat *nat, uint16_t aux_ext) {
+  unsigned int i;
+
+  if (aux_ext < nat->port_lo || aux_ext > nat->port_hi)
+    return NULL;
+  i = (aux_ext - nat->port_lo) / nat->port_span;
+  if (i >= nat->nshards)
+    i = nat->nshards - 1;
+  return &nat->shards[i];
+}
+
+/* Lookups in the two indexes.  Caller holds the shard lock. */
+static struct sr_nat_mapping *sr_nat_find_internal(struct sr_nat_shard *shard,
+    uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type) {
+  struct sr_nat_mapping *mapping;
+
+  mapping = shard->int_hash[sr_nat_hash_int(ip_int, aux_int, type, shard->hash_size)];
+  for (; mapping != NULL; mapping = mapping->int_next) {
+    if (mapping->ip_int == ip_int && mapping->aux_int == aux_int && mapping->type == type)
+      return mapping;
+  }
+  return NULL;
+}
+
+static struct sr_nat_mapping *sr_nat_find_external(struct sr_nat_shard *shard,
+    uint16_t aux_ext, sr_nat_mapping_type type) {
+  struct sr_nat_mapping *mapping;
+
+  mapping = shard->ext_hash[sr_nat_hash_ext(aux_ext, type, shard->hash_size)];
+  for (; mapping != NULL; mapping = mapping->ext_next) {
+    if (mapping->aux_ext == aux_ext && mapping->type == type)
+      return mapping;
+  }
+  return NULL;
+}
+
+/* Put mapping on the list and in both indexes. */
+static void sr_nat_link(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping) {
+  unsigned int i;
+
+  mapping->prev = NULL;
+  mapping->next = shard->mappings;
+  if (shard->mappings)
+    shard->mappings->prev = mapping;
+  shard->mappings = mapping;
+
+  i = sr_nat_hash_int(mapping->ip_int, mapping->aux_int, mapping->type, shard->hash_size);
+  mapping->int_next = shard->int_hash[i];
+  shard->int_hash[i] = mapping;
+
+  i = sr_nat_hash_ext(mapping->aux_ext, mapping->type, shard->hash_size);
+  mapping->ext_next = shard->ext_hash[i];
+  shard->ext_hash[i] = mapping;
+
+  shard->count++;
+}
+
+/* Take mapping off the list and out of both indexes; the caller frees it. */
+static void sr_nat_unlink(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping) {
+  struct sr_nat_mapping **pp;
+
+  if (mapping->prev)
+    mapping->prev->next = mapping->next;
+  else
+    shard->mappings = mapping->next;
+  if (mapping->next)
+    mapping->next->prev = mapping->prev;
+
+  pp = &shard->int_hash[sr_nat_hash_int(mapping->ip_int, mapping->aux_int,
+                                        mapping->type, shard->hash_size)];
+  while (*pp != mapping)
+    pp = &(*pp)->int_next;
+  *pp = mapping->int_next;
+
+  pp = &shard->ext_hash[sr_nat_hash_ext(mapping->aux_ext, mapping->type, shard->hash_size)];
+  while (*pp != mapping)
+    pp = &(*pp)->ext_next;
+  *pp = mapping->ext_next;
+
+  shard->count--;
+}
+
+static void sr_nat_free_mapping(struct sr_nat_mapping *mapping) {
+  struct sr_nat_connection *conn, *next;
+
+  for (conn = mapping->conns; conn != NULL; conn = next) {
+    next = conn->next;
+    free(conn);
+  }
+  free(mapping);
+}
+
+/* Rebuild both indexes with size buckets.  Returns -1 (and leaves the
+   old indexes in place) when out of memory. */
+static int sr_nat_rehash(struct sr_nat_shard *shard, unsigned int size) {
+  struct sr_nat_mapping **int_hash = calloc(size, sizeof(struct sr_nat_mapping *));
+  struct sr_nat_mapping **ext_hash = calloc(size, sizeof(struct sr_nat_mapping *));
+  struct sr_nat_mapping *mapping;
+  unsigned int i;
+
+  if (!int_hash || !ext_hash) {
+    free(int_hash);
+    free(ext_hash);
+    return -1;
+  }
+
+  for (mapping = shard->mappings; mapping != NULL; mapping = mapping->next) {
+    i = sr_nat_hash_int(mapping->ip_int, mapping->aux_int, mapping->type, size);
+    mapping->int_next = int_hash[i];
+    int_hash[i] = mapping;
+
+    i = sr_nat_hash_ext(mapping->aux_ext, mapping->type, size);
+    mapping->ext_next = ext_hash[i];
+    ext_hash[i] = mapping;
+  }
+
+  free(shard->int_hash);
+  free(shard->ext_hash);
+  shard->int_hash = int_hash;
+  shard->ext_hash = ext_hash;
+  shard->hash_size = size;
+  return 0;
+}
+
+/* (Re)build a port pool holding every port in lo..hi. */
+static int sr_nat_ports_init(struct sr_nat_ports *ports, uint16_t lo, uint16_t hi) {
+  unsigned int n = (unsigned int)hi - lo + 1;
+  uint16_t *ring = malloc(n * sizeof(uint16_t));
+  time_t *released = calloc(n, sizeof(time_t));
+  unsigned int i;
+
+  if (!ring || !released) {
+    free(ring);
+    free(released);
+    return -1;
+  }
+
+  for (i = 0; i < n; i++)
+    ring[i] = (uint16_t)(lo + i);
+
+  free(ports->ring);
+  free(ports->released);
+  ports->lo = lo;
+  ports->hi = hi;
+  ports->ring = ring;
+  ports->released = released;
+  ports->head = 0;
+  ports->nfree = n;
+  return 0;
+}
+
+
+/* Hand out the port that has been free longest.  Fails (returns 0) when
+   none is free, or when even that one was released less than
+   port_reuse_delay seconds ago, so a late packet for the old flow cannot
+   land on a new one. */
+static int sr_nat_port_alloc(struct sr_nat_shard *shard, sr_nat_mapping_type type,
+    uint16_t *port, time_t now) {
+  struct sr_nat_ports *ports = &shard->ports[type];
+  unsigned int n = (unsigned int)ports->hi - ports->lo + 1;
+  uint16_t candidate;
+  time_t released;
+
+  if (ports->nfree == 0) {
+    ports->exhausted++;
+    return 0;
+  }
+
+  candidate = ports->ring[ports->head];
+  released = ports->released[candidate - ports->lo];
+  if (released && now - released < shard->nat->port_reuse_delay) {
+    ports->cooling++;
+    return 0;
+  }
+
+  ports->head = (ports->head + 1) % n;
+  ports->nfree--;
+  *port = candidate;
+  return 1;
+}
+
+static void sr_nat_port_release(struct sr_nat_shard *shard, sr_nat_mapping_type type,
+    uint16_t port, time_t now) {
+  struct sr_nat_ports *ports = &shard->ports[type];
+  unsigned int n = (unsigned int)ports->hi - ports->lo + 1;
+
+  ports->ring[(ports->head + ports->nfree) % n] = port;
+  ports->nfree++;
+  ports->released[port - ports->lo] = now;
+}
+
+/* Split lo..hi into one run per shard and (re)build every shard's port
+   pools on its run.  Caller holds every shard lock, or is init. */
+static int sr_nat_partition(struct sr_nat *nat, uint16_t lo, uint16_t hi) {
+  unsigned int span = ((unsigned int)hi - lo + 1) / nat->nshards;
+  unsigned int i, first, last;
+  int t;
+
+  if (span == 0)
+    return -1;
+
+  for (i = 0; i < nat->nshards; i++) {
+    first = lo + i * span;
+    last = (i == nat->nshards - 1) ? hi : first + span - 1;
+    for (t = 0; t < SR_NAT_NTYPES; t++) {
+      if (sr_nat_ports_init(&nat->shards[i].ports[t], first, last) != 0)
+        return -1;
+    }
+  }
+
+  nat->port_lo = lo;
+  nat->port_hi = hi;
+  nat->port_span = span;
+  return 0;
+}
+
+/* Remove mapping from the table, give back its port and free it. */
+static void sr_nat_drop(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping, time_t now) {
+  struct sr_nat_connection *conn;
+
+  sr_timer_del(&shard->timers, &mapping->timer);
+  for (conn = mapping->conns; conn != NULL; conn = conn->next)
+    sr_timer_del(&shard->timers, &conn->timer);
+  sr_nat_unlink(shard, mapping);
+  sr_nat_port_release(shard, mapping->type, mapping->aux_ext, now);
+  sr_nat_free_mapping(mapping);
+}
+
+/* malloc, counted in shard->allocs.  Caller holds the shard lock. */
+static void *sr_nat_alloc(struct sr_nat_shard *shard, size_t size) {
+  shard->allocs++;
+  return malloc(size);
+}
+
+static struct sr_nat_mapping *sr_nat_copy(struct sr_nat_shard *shard,
+    const struct sr_nat_mapping *mapping) {
+  struct sr_nat_mapping *copy = (struct sr_nat_mapping *) sr_nat_alloc(shard, sizeof(struct sr_nat_mapping));
+
+  if (copy) {
+    memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
+    copy->conns = NULL; /* stays with the table */
+  }
+  return copy;
+}
+
+static void sr_nat_bind(const struct sr_nat_mapping *mapping, struct sr_nat_binding *b) {
+  b->type = mapping->type;
+  b->ip_int = mapping->ip_int;
+  b->ip_ext = mapping->ip_ext;
+  b->aux_int = mapping->aux_int;
+  b->aux_ext = mapping->aux_ext;
+}
+
+/* The shard's clock: the last second expired, which inside a timer
+   callback is the tick being run. */
+static time_t sr_nat_tick(struct sr_nat_shard *shard) {
+  return shard->timers.now - 1;
+}
+
+static int sr_nat_conn_timeout(struct sr_nat *nat, tcp_connection_state state) {
+  return state == connection_established ? nat->tcp_est_timeout : nat->tcp_trans_timeout;
+}
+
+/* Idle timeout of a mapping; for TCP, one that has no connections. */
+static int sr_nat_idle_timeout(struct sr_nat *nat, sr_nat_mapping_type type) {
+  switch (type) {
+    case nat_mapping_icmp:
+      return nat->icmp_timeout;
+    case nat_mapping_udp:
+      return nat->udp_timeout;
+    default:
+      return nat->tcp_trans_timeout;
+  }
+}
+
+/* Take conn off its mapping and free it. */
+static void sr_nat_conn_free(struct sr_nat_shard *shard, struct sr_nat_connection *conn) {
+  struct sr_nat_connection **pp = &conn->mapping->conns;
+
+  while (*pp != conn)
+    pp = &(*pp)->next;
+  *pp = conn->next;
+  sr_timer_del(&shard->timers, &conn->timer);
+  free(conn);
+}
+
+/* Timer callbacks, run with the shard locked.  Traffic only moves
+   last_updated forward, it does not touch the wheel, so a timer that
+   comes due on a busy entry is simply re-armed for the real deadline. */
+static void sr_nat_mapping_expired(struct sr_timer *timer, void *arg) {
+  struct sr_nat_shard *shard = (struct sr_nat_shard *)arg;
+  struct sr_nat_mapping *mapping = (struct sr_nat_mapping *)timer->data;
+  time_t now = sr_nat_tick(shard);
+  time_t deadline;
+
+  deadline = mapping->last_updated + sr_nat_idle_timeout(shard->nat, mapping->type);
+  if (deadline > now) {
+    sr_timer_add(&shard->timers, timer, deadline);
+    return;
+  }
+  sr_nat_drop(shard, mapping, now);
+}
+
+/* A TCP mapping lives as long as it has connections. */
+static void sr_nat_conn_expired(struct sr_timer *timer, void *arg) {
+  struct sr_nat_shard *shard = (struct sr_nat_shard *)arg;
+  struct sr_nat_connection *conn = (struct sr_nat_connection *)timer->data;
+  struct sr_nat_mapping *mapping = conn->mapping;
+  time_t now = sr_nat_tick(shard);
+  time_t deadline;
+
+  deadline = conn->last_updated + sr_nat_conn_timeout(shard->nat, conn->state);
+  if (deadline > now) {
+    sr_timer_add(&shard->timers, timer, deadline);
+    return;
+  }
+  sr_nat_conn_free(shard, conn);
+  if (mapping->conns == NULL)
+    sr_nat_drop(shard, mapping, now);
+}
+
+/* Connection state after a segment with flags has gone through in
+   direction dir.  Both ends opening (syn_sent or listen, then
+   syn_received) need the final ACK to be established; either end
+   closing goes through fin_wait_1 or close_wait, both FINs to closing or
+   last_ack, and the ACK after that to time_wait.  RST closes, and a new
+   SYN on a closed or time_wait connection opens it again. */
+static tcp_connection_state sr_nat_tcp_next(tcp_connection_state state,
+    uint8_t flags, int dir) {
+
+  if (flags & TCP_RST)
+    return connection_closed;
+
+  if (flags & TCP_SYN) {
+    switch (state) {
+      case connection_closed:
+      case connection_time_wait:
+        return dir == SR_NAT_OUTBOUND ? connection_syn_sent : connection_listen;
+      case connection_syn_sent:
+        return dir == SR_NAT_INBOUND ? connection_syn_received : state;
+      case connection_listen:
+        return dir == SR_NAT_OUTBOUND ? connection_syn_received : state;
+      default:
+        return state;
+    }
+  }
+
+  if (flags & TCP_FIN) {
+    switch (state) {
+      case connection_established:
+        return dir == SR_NAT_OUTBOUND ? connection_fin_wait_1 : connection_close_wait;
+      case connection_fin_wait_1:
+        return dir == SR_NAT_INBOUND ? connection_closing : state;
+      case connection_close_wait:
+        return dir == SR_NAT_OUTBOUND ? connection_last_ack : state;
+      default:
+        return state;
+    }
+  }
+
+  if (flags & TCP_ACK) {
+    switch (state) {
+      case connection_syn_received:
+        return connection_established;
+      case connection_closing:
+      case connection_last_ack:
+        return connection_time_wait;
+      default:
+        return state;
+    }
+  }
+
+  return state;
+}
+
 
 int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
+  return sr_nat_init_shards(nat, SR_NAT_SHARDS);
+}
 
-  assert(nat);
+int sr_nat_init_shards(struct sr_nat *nat, unsigned int nshards) {
 
-  /* Acquire mutex lock */
-  pthread_mutexattr_init(&(nat->attr));
-  pthread_mutexattr_settype(&(nat->attr), PTHREAD_MUTEX_RECURSIVE);
-  int success = pthread_mutex_init(&(nat->lock), &(nat->attr));
+  assert(nat);
+  assert(nshards > 0 && nshards <= SR_NAT_MAX_SHARDS);
+
+  /* Initialize any variables here (before the timeout thread sees them) */
+
+  nat->ip_ext = 0;
+  nat->port_reuse_delay = SR_NAT_PORT_REUSE_DELAY;
+  nat->icmp_timeout = SR_NAT_ICMP_TIMEOUT;
+  nat->udp_timeout = SR_NAT_UDP_TIMEOUT;
+  nat->tcp_est_timeout = SR_NAT_TCP_EST_TIMEOUT;
+  nat->tcp_trans_timeout = SR_NAT_TCP_TRANS_TIMEOUT;
+
+  nat->nshards = nshards;
+  nat->shards = calloc(nshards, sizeof(struct sr_nat_shard));
+  if (nat->shards == NULL)
+    return -1;
+
+  time_t now = time(NULL);
+  unsigned int i;
+  for (i = 0; i < nshards; i++) {
+    struct sr_nat_shard *shard = &nat->shards[i];
+
+    /* Acquire mutex lock */
+    pthread_mutex_init(&(shard->lock), NULL);
+    shard->nat = nat;
+    shard->mappings = NULL;
+    shard->count = 0;
+    shard->allocs = 0;
+    sr_timer_wheel_init(&shard->timers, now);
+    shard->hash_size = SR_NAT_HASH_SZ;
+    shard->int_hash = calloc(shard->hash_size, sizeof(struct sr_nat_mapping *));
+    shard->ext_hash = calloc(shard->hash_size, sizeof(struct sr_nat_mapping *));
+    assert(shard->int_hash && shard->ext_hash);
+  }
+  if (sr_nat_partition(nat, SR_NAT_PORT_MIN, SR_NAT_PORT_MAX) != 0)
+    return -1;
 
   /* Initialize timeout thread */
 
@@ -26,28 +475,52 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
 
   /* CAREFUL MODIFYING CODE ABOVE THIS LINE! */
 
-  nat->mappings = NULL;
-  /* Initialize any variables here */
-
-  return success;
+  return 0;
 }
 
 
 int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
-  pthread_mutex_lock(&(nat->lock));
+
+  int ret = 0;
+
+  /* stop the timeout thread first; it only holds a lock while awake
+     and sleep() is a cancellation point */
+  pthread_cancel(nat->thread);
+  pthread_join(nat->thread, NULL);
 
   /* free nat memory here */
-  struct sr_nat_mapping * mapping = nat->mappings;
-  struct sr_nat_mapping * temp = NULL;
-  while (mapping != NULL) {
-        temp = mapping->next;
-        free(mapping);
-        mapping = temp;
+  unsigned int i;
+  for (i = 0; i < nat->nshards; i++) {
+    struct sr_nat_shard *shard = &nat->shards[i];
+
+    pthread_mutex_lock(&(shard->lock));
+
+    struct sr_nat_mapping * mapping = shard->mappings;
+    struct sr_nat_mapping * temp = NULL;
+    while (mapping != NULL) {
+          temp = mapping->next;
+          sr_nat_free_mapping(mapping);
+          mapping = temp;
+    }
+    shard->mappings = NULL;
+    free(shard->int_hash);
+    free(shard->ext_hash);
+    shard->int_hash = shard->ext_hash = NULL;
+
+    int t;
+    for (t = 0; t < SR_NAT_NTYPES; t++) {
+      free(shard->ports[t].ring);
+      free(shard->ports[t].released);
+    }
+
+    pthread_mutex_unlock(&(shard->lock));
+    ret |= pthread_mutex_destroy(&(shard->lock));
   }
 
-  pthread_kill(nat->thread, SIGKILL);
-  return pthread_mutex_destroy(&(nat->lock)) &&
-    pthread_mutexattr_destroy(&(nat->attr));
+  free(nat->shards);
+  nat->shards = NULL;
+  nat->nshards = 0;
+  return ret;
 
 }
 
@@ -55,45 +528,48 @@ void *sr_nat_timeout(void *nat_ptr) {  /* Periodic Timout handling */
   struct sr_nat *nat = (struct sr_nat *)nat_ptr;
   while (1) {
     sleep(1.0);
-    pthread_mutex_lock(&(nat->lock));
+    sr_nat_expire(nat, time(NULL));
+  }
+  return NULL;
+}
 
-    time_t curtime = time(NULL);
+/* Expire every mapping and connection idle up to now.  Only the wheel
+   slots that come due are looked at, one shard locked at a time. */
+void sr_nat_expire(struct sr_nat *nat, time_t now) {
+  unsigned int i;
 
-    // set these accordingly, using default for now
-    int ICMP_timeout = 60;  
-    int TCP_established_timeout = 7440;
-    int TCP_transitory_timeout = 300; 
+  for (i = 0; i < nat->nshards; i++) {
+    struct sr_nat_shard *shard = &nat->shards[i];
 
-    /* handle periodic tasks here */
-     /* go through each mapping and remove it if it is timed out */
+    pthread_mutex_lock(&(shard->lock));
+    sr_timer_advance(&shard->timers, now, shard);
+    pthread_mutex_unlock(&(shard->lock));
+  }
+}
 
-    /* ICMP query time out interval */ 
-    
-    struct sr_nat_mapping * mapping = nat->mappings;
-    struct sr_nat_mapping * prev_mapping = NULL;
-    while (mapping != NULL) {
-       if (mapping->type == nat_mapping_icmp) {
-            if (curtime - mapping->last_updated >= ICMP_timeout) {
-                  // mapping is timed out
-                  // remove it from list and free it 
-                  if (prev_mapping == NULL) { // first mapping in the table
-                      nat->mappings = mapping->next;
-                  } else {
-                    prev_mapping->next = mapping->next;
-                  }
-                  free(mapping);
-            }
-       } else if (mapping->type == nat_mapping_tcp) {
-          // need to check if transitory or established 
-         // check last value in conns
-       }
-       prev_mapping = mapping;
-       mapping = mapping->next;
+/* Add up the shards' counters. */
+void sr_nat_get_stats(struct sr_nat *nat, struct sr_nat_stats *stats) {
+  unsigned int i;
+  int d, t;
+
+  memset(stats, 0, sizeof(struct sr_nat_stats));
+  for (i = 0; i < nat->nshards; i++) {
+    struct sr_nat_shard *shard = &nat->shards[i];
+
+    pthread_mutex_lock(&(shard->lock));
+    stats->count += shard->count;
+    stats->timers += shard->timers.pending;
+    for (d = 0; d < 2; d++) {
+      stats->translated[d] += shard->translated[d];
+      stats->dropped[d] += shard->dropped[d];
     }
-
-    pthread_mutex_unlock(&(nat->lock));
+    stats->allocs += shard->allocs;
+    for (t = 0; t < SR_NAT_NTYPES; t++) {
+      stats->exhausted[t] += shard->ports[t].exhausted;
+      stats->cooling[t] += shard->ports[t].cooling;
+    }
+    pthread_mutex_unlock(&(shard->lock));
   }
-  return NULL;
 }
 
 /* Get the mapping associated with given external port.
@@ -101,31 +577,20 @@ void *sr_nat_timeout(void *nat_ptr) {  /* Periodic Timout handling */
 struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
     uint16_t aux_ext, sr_nat_mapping_type type ) {
 
-  pthread_mutex_lock(&(nat->lock));
-   
+  struct sr_nat_shard *shard = sr_nat_shard_ext(nat, aux_ext);
+  struct sr_nat_mapping *copy = NULL;
+  struct sr_nat_mapping *mapping;
 
+  if (shard == NULL)
+    return NULL;
 
-   /* handle lookup here, malloc and assign to copy. */
-  struct sr_nat_mapping * associated_mapping = nat->mappings; 
-  while (associated_mapping != NULL) {
-      if (associated_mapping->aux_ext == aux_ext && associated_mapping->type == type) {
-          break;
-      }
-    associated_mapping = associated_mapping->next;
-  }
+  pthread_mutex_lock(&(shard->lock));
 
-  if (associated_mapping == NULL) {
-    printf("no such mapping");
-  }
-  struct sr_nat_mapping *copy = NULL;
-  
-  /* do memcpy here? */
-  if (associated_mapping) {
-     copy = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
-     memcpy(copy, associated_mapping, sizeof(struct sr_nat_mapping));
-  }
+  mapping = sr_nat_find_external(shard, aux_ext, type);
+  if (mapping)
+    copy = sr_nat_copy(shard, mapping);
 
-  pthread_mutex_unlock(&(nat->lock));
+  pthread_mutex_unlock(&(shard->lock));
   return copy;
 }
 
@@ -134,30 +599,100 @@ struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
 struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
 
-  pthread_mutex_lock(&(nat->lock));
+  struct sr_nat_shard *shard = sr_nat_shard_int(nat, ip_int, aux_int, type);
+  struct sr_nat_mapping *copy = NULL;
+  struct sr_nat_mapping *mapping;
 
-  /* handle lookup here, malloc and assign to copy. */
-  struct sr_nat_mapping * associated_mapping = nat->mappings; 
-  while (associated_mapping != NULL) {
-      if ((associated_mapping->ip_int == ip_int) && (associated_mapping->aux_int == aux_int) && (associated_mapping->type == type)) {
-          break;
-      }
-    associated_mapping = associated_mapping->next;
+  pthread_mutex_lock(&(shard->lock));
+
+  mapping = sr_nat_find_internal(shard, ip_int, aux_int, type);
+  if (mapping) {
+    mapping->last_updated = sr_nat_tick(shard);
+    copy = sr_nat_copy(shard, mapping);
   }
 
-  if (associated_mapping == NULL) {
-    printf("no such mapping");
+  pthread_mutex_unlock(&(shard->lock));
+  return copy;
+}
+
+/* The same lookups into caller storage: nothing is allocated.  Return 0,
+   or -1 if there is no mapping. */
+int sr_nat_lookup_external_r(struct sr_nat *nat, uint16_t aux_ext,
+  sr_nat_mapping_type type, struct sr_nat_binding *binding ) {
+
+  struct sr_nat_shard *shard = sr_nat_shard_ext(nat, aux_ext);
+  struct sr_nat_mapping *mapping;
+
+  if (shard == NULL)
+    return -1;
+
+  pthread_mutex_lock(&(shard->lock));
+
+  mapping = sr_nat_find_external(shard, aux_ext, type);
+  if (mapping)
+    sr_nat_bind(mapping, binding);
+
+  pthread_mutex_unlock(&(shard->lock));
+  return mapping ? 0 : -1;
+}
+
+int sr_nat_lookup_internal_r(struct sr_nat *nat, uint32_t ip_int,
+  uint16_t aux_int, sr_nat_mapping_type type, struct sr_nat_binding *binding ) {
+
+  struct sr_nat_shard *shard = sr_nat_shard_int(nat, ip_int, aux_int, type);
+  struct sr_nat_mapping *mapping;
+
+  pthread_mutex_lock(&(shard->lock));
+
+  mapping = sr_nat_find_internal(shard, ip_int, aux_int, type);
+  if (mapping) {
+    mapping->last_updated = sr_nat_tick(shard);
+    sr_nat_bind(mapping, binding);
   }
-   struct sr_nat_mapping *copy = NULL;
-  /* do memcpy here? */
-  if (associated_mapping) {
-    copy = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
-     memcpy(copy, associated_mapping, sizeof(struct sr_nat_mapping));
+
+  pthread_mutex_unlock(&(shard->lock));
+  return mapping ? 0 : -1;
+}
+
+/* New mapping for (ip_int, aux_int, type) in the shard it hashes to.
+   Caller holds the shard lock and has checked there is none yet.  NULL
+   when no external id of the shard is free. */
+static struct sr_nat_mapping *sr_nat_new_mapping(struct sr_nat_shard *shard,
+    uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type, time_t now) {
+
+  struct sr_nat *nat = shard->nat;
+  struct sr_nat_mapping *mapping;
+  uint16_t aux_ext;
+
+  /* keep chains short: grow at an average of one mapping per bucket */
+  if (shard->count >= shard->hash_size)
+    sr_nat_rehash(shard, shard->hash_size * 2);
+
+  /* icmp ids, tcp and udp ports come from separate pools */
+  if (!sr_nat_port_alloc(shard, type, &aux_ext, now))
+    return NULL;
+
+  mapping = (struct sr_nat_mapping *) sr_nat_alloc(shard, sizeof(struct sr_nat_mapping));
+  if (mapping == NULL) {
+    sr_nat_port_release(shard, type, aux_ext, 0);
+    return NULL;
   }
-  
 
-  pthread_mutex_unlock(&(nat->lock));
-  return copy;
+  mapping->type = type;
+  mapping->ip_int = ip_int; /* set the internal ip address */
+  mapping->aux_int = aux_int; /* set the internal port or icmp id */
+  mapping->ip_ext = nat->ip_ext;
+  mapping->aux_ext = aux_ext;
+  mapping->last_updated = now; /* set it to current time */
+  mapping->conns = NULL; /* null for ICMP, filled in as tcp connections are seen */
+
+  /* icmp/udp idle timeout; a tcp mapping nothing has gone through
+     yet gets the transitory one */
+  sr_timer_init(&mapping->timer, sr_nat_mapping_expired, mapping);
+  sr_timer_add(&shard->timers, &mapping->timer, now + sr_nat_idle_timeout(nat, type));
+
+  sr_nat_link(shard, mapping);
+  return mapping;
 }
 
 /* Insert a new mapping into the nat's mapping table.
@@ -166,78 +701,299 @@ struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
 
-  pthread_mutex_lock(&(nat->lock));
-
-  /* Should we check whether mapping already exists before inserting it ? */ 
-  int mapping_exists = 0;
-  struct sr_nat_mapping * map_i = nat->mappings;
-  while (map_i != NULL) {
-        if (map_i->ip_int == ip_int && map_i->aux_int == aux_int && map_i->type == type) {
-            mapping_exists = 1;
-            printf("mapping exists");
-            break; 
-        }
-        map_i = map_i->next;
-  }
-  
-  /* handle insert here, create a mapping, and then return a copy of it */
-  struct sr_nat_mapping *mapping = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping)); 
-  mapping->ip_int = ip_int; // set the internal ip address
-  mapping->aux_int = aux_int; // set the internal port or icmp id
-  mapping->type = type; // set type 
-  mapping->last_updated = time(NULL); // set it to current time
-  
-
-  if (type == nat_mapping_icmp) {
-  	/* for icmp, map internal address and internal identifier to a globally unique identifier */
-    	 /* start at zero 
-	 should we also just look through the ones that are icmp ? ? */
-    	 uint16_t unique_id = 0; 
-    	 int found_next_available_id = 0; 
-  	    while (!found_next_available_id) {
-		           struct sr_nat_mapping * this_mapping = nat->mappings;
-       		     while (this_mapping != NULL) {
-			             if (this_mapping->aux_ext == unique_id) {
- 				           unique_id++;
-				            break;
-			         }
-			         this_mapping = this_mapping->next;
-		    }
-
-       	 /* went through all of the mappings and didn't find the unique id */
-      		  if (this_mapping == NULL) {
-			             found_next_available_id = 1;
-		        }
-   	}
-    mapping->conns = NULL; /* null for ICMP */
-    mapping->aux_ext = unique_id;  /* set the unique id */
-  } else if (type == nat_mapping_tcp) {
-	/* need to make sure port we map to start from a specific number
-	greater than 1023*/ 
-        /* set mapping->conns */ 
-
-
-
-  }
-  
-    /* set the external address to the external address of the nat  ? ? */ 
-  // mapping->ip_ext = 
-
-  /* add it to the list of mappings */
-  if (!mapping_exists) {
-       mapping->next = nat->mappings;
-  }
- 
- 
-  /* What else do we need to set in the mapping? */
-   struct sr_nat_mapping *copy = NULL;
-  /* look at arp_cache for this part */
-  /* need to return copy for thread safety */ 
+  struct sr_nat_shard *shard = sr_nat_shard_int(nat, ip_int, aux_int, type);
+  struct sr_nat_mapping *mapping;
+  struct sr_nat_mapping *copy = NULL;
+
+  pthread_mutex_lock(&(shard->lock));
+
+  /* an existing mapping is returned as is */
+  mapping = sr_nat_find_internal(shard, ip_int, aux_int, type);
+  if (mapping == NULL)
+    mapping = sr_nat_new_mapping(shard, ip_int, aux_int, type, sr_nat_tick(shard));
+  if (mapping)
+    copy = sr_nat_copy(shard, mapping);
+
+  pthread_mutex_unlock(&(shard->lock));
+  return copy;
+}
+
+/* Insert into caller storage.  Only a new mapping allocates. */
+int sr_nat_insert_mapping_r(struct sr_nat *nat, uint32_t ip_int,
+  uint16_t aux_int, sr_nat_mapping_type type, struct sr_nat_binding *binding ) {
+
+  struct sr_nat_shard *shard = sr_nat_shard_int(nat, ip_int, aux_int, type);
+  struct sr_nat_mapping *mapping;
+
+  pthread_mutex_lock(&(shard->lock));
+
+  mapping = sr_nat_find_internal(shard, ip_int, aux_int, type);
+  if (mapping == NULL)
+    mapping = sr_nat_new_mapping(shard, ip_int, aux_int, type, sr_nat_tick(shard));
+  if (mapping)
+    sr_nat_bind(mapping, binding);
+
+  pthread_mutex_unlock(&(shard->lock));
+  return mapping ? 0 : -1;
+}
+
+/* Connection tracking on a TCP mapping.  Caller holds the shard lock. */
+static int sr_nat_track(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping,
+    uint32_t ip_peer, uint16_t port_peer, uint8_t flags, int dir, time_t now) {
+
+  struct sr_nat *nat = shard->nat;
+  struct sr_nat_connection *conn;
+  tcp_connection_state state;
+
+  mapping->last_updated = now;
+
+  for (conn = mapping->conns; conn != NULL; conn = conn->next) {
+    if (conn->ip_peer == ip_peer && conn->port_peer == port_peer)
+      break;
+  }
+
+  if (conn == NULL) {
+    /* only a SYN opens a connection */
+    if (!(flags & TCP_SYN) || (flags & TCP_RST))
+      return connection_closed;
+    conn = (struct sr_nat_connection *) sr_nat_alloc(shard, sizeof(struct sr_nat_connection));
+    if (conn == NULL)
+      return -1;
+    conn->ip_peer = ip_peer;
+    conn->port_peer = port_peer;
+    conn->state = connection_closed;
+    conn->mapping = mapping;
+    sr_timer_init(&conn->timer, sr_nat_conn_expired, conn);
+    conn->next = mapping->conns;
+    mapping->conns = conn;
+
+    /* from now on the mapping lives as long as its connections */
+    sr_timer_del(&shard->timers, &mapping->timer);
+  }
+
+  state = sr_nat_tcp_next(conn->state, flags, dir);
+  conn->last_updated = now;
+
+  /* re-arm only when new or switching between the established and the
+     transitory timeout; otherwise the callback catches up lazily */
+  if (!sr_timer_pending(&conn->timer) ||
+      sr_nat_conn_timeout(nat, state) != sr_nat_conn_timeout(nat, conn->state))
+    sr_timer_add(&shard->timers, &conn->timer, now + sr_nat_conn_timeout(nat, state));
+  conn->state = state;
+  return state;
+}
+
+/* Track a TCP segment on the mapping for external port aux_ext. */
+int sr_nat_tcp_track(struct sr_nat *nat, uint16_t aux_ext,
+  uint32_t ip_peer, uint16_t port_peer, uint8_t flags, int dir ) {
+
+  struct sr_nat_shard *shard = sr_nat_shard_ext(nat, aux_ext);
+  struct sr_nat_mapping *mapping;
+  int ret = -1;
+
+  if (shard == NULL)
+    return -1;
+
+  pthread_mutex_lock(&(shard->lock));
+
+  mapping = sr_nat_find_external(shard, aux_ext, nat_mapping_tcp);
+  if (mapping)
+    ret = sr_nat_track(shard, mapping, ip_peer, port_peer, flags, dir, sr_nat_tick(shard));
+
+  pthread_mutex_unlock(&(shard->lock));
+  return ret;
+}
+
+/* Replace the address and echo id of an ICMP query, fixing both sums. */
+static void sr_nat_rewrite_icmp(sr_ip_hdr_t *ip, uint8_t *icmp, int dst,
+    uint32_t addr, uint16_t id) {
+
+  uint16_t old, sum;
+
+  memcpy(&old, icmp + offsetof(sr_icmp_t8_hdr_t, identifier), 2);
+  memcpy(&sum, icmp + offsetof(sr_icmp_t8_hdr_t, icmp_sum), 2);
+  sum = cksum_update16(sum, old, id);
+  memcpy(icmp + offsetof(sr_icmp_t8_hdr_t, icmp_sum), &sum, 2);
+  memcpy(icmp + offsetof(sr_icmp_t8_hdr_t, identifier), &id, 2);
+
+  if (dst) {
+    ip->ip_sum = cksum_update32(ip->ip_sum, ip->ip_dst, addr);
+    ip->ip_dst = addr;
+  } else {
+    ip->ip_sum = cksum_update32(ip->ip_sum, ip->ip_src, addr);
+    ip->ip_src = addr;
+  }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_nat_translate(..)
+ *
+ * Translates one packet in place.  Outbound, the source becomes
+ * (ip_ext, aux_ext), creating the mapping on the first packet of a
+ * flow; inbound, the destination goes back to (ip_int, aux_int).  TCP
+ * segments also go through connection tracking.  Only the flow's shard
+ * is locked, found by flow hash outbound and by external port inbound.
+ * Lookup, rewrite and tracking all happen under one hold of that lock
+ * on the table's own entries, so nothing is copied or allocated except
+ * for a new mapping or connection.
+ *
+ * ICMP is translated for echo queries only; an inbound packet of any
+ * other kind, or with no mapping, is SR_NAT_NO_MAPPING and left for the
+ * router.  Fragments are not translated.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_nat_translate(struct sr_nat *nat, sr_ip_hdr_t *ip, unsigned int len, int dir) {
+
+  unsigned int hl = ip->ip_hl * 4;
+  uint8_t *l4 = (uint8_t *)ip + hl;
+  sr_nat_mapping_type type;
+  struct sr_nat_shard *shard;
+  struct sr_nat_mapping *mapping;
+  uint16_t aux, port_peer = 0;
+  uint8_t flags = 0;
+  time_t now;
+  int ret = SR_NAT_OK;
+
+  if (hl < sizeof(sr_ip_hdr_t) || len < hl || (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)))
+    goto unhandled;
+
+  switch (ip->ip_p) {
+    case ip_protocol_icmp:
+      if (len < hl + 8)
+        goto unhandled;
+      if (l4[0] != (dir == SR_NAT_OUTBOUND ? SR_NAT_ICMP_ECHO_REQUEST : SR_NAT_ICMP_ECHO_REPLY))
+        goto unhandled;
+      type = nat_mapping_icmp;
+      memcpy(&aux, l4 + offsetof(sr_icmp_t8_hdr_t, identifier), 2);
+      break;
+    case ip_protocol_tcp:
+      if (len < hl + sizeof(sr_tcp_hdr_t))
+        goto unhandled;
+      type = nat_mapping_tcp;
+      flags = ((sr_tcp_hdr_t *)l4)->tcp_flags;
+      break;
+    case ip_protocol_udp:
+      if (len < hl + sizeof(sr_udp_hdr_t))
+        goto unhandled;
+      type = nat_mapping_udp;
+      break;
+    default:
+      goto unhandled;
+  }
+
+  /* tcp and udp keep the source port first, destination second */
+  if (type != nat_mapping_icmp) {
+    memcpy(&aux, l4 + (dir == SR_NAT_OUTBOUND ? 0 : 2), 2);
+    memcpy(&port_peer, l4 + (dir == SR_NAT_OUTBOUND ? 2 : 0), 2);
+  }
+
+  if (dir == SR_NAT_OUTBOUND) {
+    shard = sr_nat_shard_int(nat, ip->ip_src, aux, type);
+  } else {
+    shard = sr_nat_shard_ext(nat, ntohs(aux));
+    if (shard == NULL)
+      return SR_NAT_NO_MAPPING;
+  }
+
+  pthread_mutex_lock(&(shard->lock));
+  now = sr_nat_tick(shard);
+
+  if (dir == SR_NAT_OUTBOUND) {
+    mapping = sr_nat_find_internal(shard, ip->ip_src, aux, type);
+    if (mapping == NULL)
+      mapping = sr_nat_new_mapping(shard, ip->ip_src, aux, type, now);
+    if (mapping == NULL) {
+      ret = SR_NAT_DROP;
+      goto out;
+    }
+    mapping->last_updated = now;
+    if (type == nat_mapping_tcp &&
+        sr_nat_track(shard, mapping, ip->ip_dst, port_peer, flags, dir, now) < 0) {
+      ret = SR_NAT_DROP;
+      goto out;
+    }
+    if (type == nat_mapping_icmp)
+      sr_nat_rewrite_icmp(ip, l4, 0, mapping->ip_ext, htons(mapping->aux_ext));
+    else
+      ip_rewrite_endpoint(ip, 0, mapping->ip_ext, htons(mapping->aux_ext));
+  } else {
+    mapping = sr_nat_find_external(shard, ntohs(aux), type);
+    if (mapping == NULL) {
+      ret = SR_NAT_NO_MAPPING;
+      goto out;
+    }
+    if (type == nat_mapping_tcp &&
+        sr_nat_track(shard, mapping, ip->ip_src, port_peer, flags, dir, now) < 0) {
+      ret = SR_NAT_DROP;
+      goto out;
+    }
+    if (type == nat_mapping_icmp)
+      sr_nat_rewrite_icmp(ip, l4, 1, mapping->ip_int, mapping->aux_int);
+    else
+      ip_rewrite_endpoint(ip, 1, mapping->ip_int, mapping->aux_int);
+  }
+
+out:
+  if (ret == SR_NAT_OK)
+    shard->translated[dir]++;
+  else if (ret == SR_NAT_DROP)
+    shard->dropped[dir]++;
+  pthread_mutex_unlock(&(shard->lock));
+  return ret;
+
+unhandled:
+  /* not ours to translate: outbound it cannot leave, inbound it may be
+     for the router */
+  if (dir == SR_NAT_INBOUND)
+    return SR_NAT_NO_MAPPING;
+  shard = sr_nat_shard_int(nat, ip->ip_src, 0, nat_mapping_icmp);
+  pthread_mutex_lock(&(shard->lock));
+  shard->dropped[dir]++;
+  pthread_mutex_unlock(&(shard->lock));
+  return SR_NAT_DROP;
+}
+
+/* Drop the mapping for an external port and release the port. */
+int sr_nat_remove_mapping(struct sr_nat *nat, uint16_t aux_ext,
+  sr_nat_mapping_type type ) {
+
+  struct sr_nat_shard *shard = sr_nat_shard_ext(nat, aux_ext);
+  struct sr_nat_mapping *mapping;
+  int ret = -1;
+
+  if (shard == NULL)
+    return -1;
+
+  pthread_mutex_lock(&(shard->lock));
+
+  mapping = sr_nat_find_external(shard, aux_ext, type);
   if (mapping) {
-     copy = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
-     memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
+    sr_nat_drop(shard, mapping, sr_nat_tick(shard));
+    ret = 0;
   }
 
-  pthread_mutex_unlock(&(nat->lock));
-  return copy;
+  pthread_mutex_unlock(&(shard->lock));
+  return ret;
+}
+
+/* Use ports/ids lo..hi for new mappings of every type.  Every shard is
+   locked, in order, while the range is split up again. */
+int sr_nat_set_port_range(struct sr_nat *nat, uint16_t lo, uint16_t hi) {
+  unsigned int i, count = 0;
+  int ret;
+
+  if (lo <= 1023 || hi < lo)
+    return -1;
+
+  for (i = 0; i < nat->nshards; i++) {
+    pthread_mutex_lock(&(nat->shards[i].lock));
+    count += nat->shards[i].count;
+  }
+
+  ret = count != 0 ? -1 : sr_nat_partition(nat, lo, hi);
+
+  for (i = nat->nshards; i-- > 0; )
+    pthread_mutex_unlock(&(nat->shards[i].lock));
+  return ret;
 }
@@ -6,14 +6,49 @@
 #include <time.h>
 #include <pthread.h>
 
-uint8_t ICMP_DATA_SIZE = 100;
+#include "sr_timer.h"
+
+/* initial buckets in each mapping index of a shard, grows with it */
+#define SR_NAT_HASH_SZ 1024
+
+/* shards the table is split into by sr_nat_init(), at most
+   SR_NAT_MAX_SHARDS */
+#define SR_NAT_SHARDS 16
+#define SR_NAT_MAX_SHARDS 64
+
+/* default range of external ports/ids, per type */
+#define SR_NAT_PORT_MIN 1024
+#define SR_NAT_PORT_MAX 65535
+
+/* seconds a released port/id waits before it is handed out again */
+#define SR_NAT_PORT_REUSE_DELAY 30
+
+/* default idle timeouts, seconds */
+#define SR_NAT_ICMP_TIMEOUT 60
+#define SR_NAT_UDP_TIMEOUT 300
+#define SR_NAT_TCP_EST_TIMEOUT 7440
+#define SR_NAT_TCP_TRANS_TIMEOUT 300
+
+/* direction of a packet through the nat */
+#define SR_NAT_OUTBOUND 0
+#define SR_NAT_INBOUND 1
+
+/* sr_nat_translate() results */
+#define SR_NAT_OK 0
+#define SR_NAT_NO_MAPPING 1
+#define SR_NAT_DROP -1
+
+#define SR_NAT_ICMP_ECHO_REPLY 0
+#define SR_NAT_ICMP_ECHO_REQUEST 8
 
 typedef enum {
   nat_mapping_icmp,
-  nat_mapping_tcp
-  /* nat_mapping_udp, */
+  nat_mapping_tcp,
+  nat_mapping_udp
 } sr_nat_mapping_type;
 
+#define SR_NAT_NTYPES 3
+
 typedef enum {
   connection_closed, /* may not be needed as connection is freed */
   connection_listen,
@@ -28,81 +63,207 @@ typedef enum {
   connection_time_wait
 } tcp_connection_state;
 
-struct sr_nat_connection {
-  /* add TCP connection state data members here */
-  /* From the handout: 
+/* One TCP connection through a mapping, keyed by the external endpoint
+   it talks to.  From the handout:
 
        No need to track sequence numbers, or window values
-       or ensure TCP packets are in proper order to the end hosts. 
+       or ensure TCP packets are in proper order to the end hosts.
        Keep only the information that is useful to the NAT for establishing or clearing mappings.
-  */ 
 
-  /* pair of sockets ? */ 
-  /* what other state do we need to keep track of ? */
+   so only SYN, FIN and RST move the state.  Without sequence numbers the
+   ACK of a FIN cannot be told from any other ACK, so fin_wait_2 is never
+   entered. */
+struct sr_nat_connection {
+  uint32_t ip_peer;   /* external host, network byte order */
+  uint16_t port_peer; /* its port, network byte order */
   tcp_connection_state state;
+  time_t last_updated;
+  struct sr_timer timer; /* idle timeout, established or transitory */
+  struct sr_nat_mapping *mapping;
   struct sr_nat_connection *next;
 };
 
-/* Structure of a type8 ICMP header
-*/
-struct sr_icmp_t8_hdr {
-  uint8_t icmp_type;
-  uint8_t icmp_code;
-  uint16_t icmp_sum;  /* added identifier and sequence number */
-  uint16_t identifier;
-  uint16_t sequence_num;
-  uint16_t unused;
-  uint16_t next_mtu;
-  uint8_t data[ICMP_DATA_SIZE];
-} __attribute__ ((packed));
-typedef struct sr_icmp_t8_hdr sr_icmp_t8_hdr_t;
-
 struct sr_nat_mapping {
   sr_nat_mapping_type type;
   uint32_t ip_int; /* internal ip addr */
   uint32_t ip_ext; /* external ip addr */
-  uint16_t aux_int; /* internal port or icmp id */
-  uint16_t aux_ext; /* external port or icmp id */
+  uint16_t aux_int; /* internal port or icmp id, as in the packet */
+  uint16_t aux_ext; /* external port or icmp id, host byte order */
   time_t last_updated; /* use to timeout mappings */
-  struct sr_nat_connection *conns; /* list of connections. null for ICMP */
   struct sr_nat_mapping *next;
+
+  /* table state, not meaningful in the copies handed out (conns is NULL
+     there) */
+  struct sr_nat_connection *conns; /* list of connections. null for ICMP */
+  struct sr_timer timer; /* ICMP/UDP idle timeout, or TCP with no connections */
+  struct sr_nat_mapping *prev;      /* shard->mappings is doubly linked */
+  struct sr_nat_mapping *int_next;  /* chain in the (ip_int, aux_int) index */
+  struct sr_nat_mapping *ext_next;  /* chain in the (aux_ext) index */
 };
 
-struct sr_nat {
-  /* add any fields here */
-  /*my addition:
-  add ICMP query timeout interval here
-  tcp idle timeout
-  tcp transitory idle timeout   */
+/* What a translation needs of a mapping, filled in by the _r lookups
+   into the caller's storage (usually the stack). */
+struct sr_nat_binding {
+  sr_nat_mapping_type type;
+  uint32_t ip_int;
+  uint32_t ip_ext;
+  uint16_t aux_int; /* as in the packet */
+  uint16_t aux_ext; /* host byte order */
+};
+
+/* External port/id pool of one mapping type.  Free ports sit in a FIFO
+   ring, so allocate and release are O(1) and a released port goes to the
+   back of the line instead of being handed straight out again. */
+struct sr_nat_ports {
+  uint16_t lo, hi;       /* range, inclusive */
+  uint16_t *ring;        /* free ports, oldest first */
+  time_t *released;      /* per port (index port - lo), 0 if never used */
+  unsigned int head;     /* next port to hand out */
+  unsigned int nfree;
+  unsigned long exhausted; /* allocations failed: every port in use */
+  unsigned long cooling;   /* allocations failed: free ports still in reuse delay */
+};
+
+/* One slice of the table.  A flow's mapping lives in the shard its
+   internal (ip_int, aux_int, type) hashes to, and gets an external
+   port/id from that shard's part of the port range, so a packet in
+   either direction finds its shard without looking anywhere else: by
+   flow hash outbound, by external port inbound.  Everything in a shard
+   is under its own lock. */
+struct sr_nat_shard {
+  pthread_mutex_t lock;
+  struct sr_nat *nat;
 
+  /* Every mapping is on the mappings list and in both indexes.  The
+     indexes are chained hash tables of hash_size buckets, keyed on
+     (ip_int, aux_int, type) and (aux_ext, type). */
   struct sr_nat_mapping *mappings;
+  struct sr_nat_mapping **int_hash;
+  struct sr_nat_mapping **ext_hash;
+  unsigned int hash_size; /* power of two */
+  unsigned int count;
+
+  struct sr_nat_ports ports[SR_NAT_NTYPES];
+
+  /* every mapping and connection timeout in the shard; the timeout
+     thread advances it once a second, so expiry costs what expires, not
+     the table size.  It is also the shard's clock: times stamped on
+     mappings are the last second passed to sr_nat_expire(), at most
+     about a second stale. */
+  struct sr_timer_wheel timers;
+
+  /* sr_nat_translate() counts, by direction */
+  unsigned long translated[2];
+  unsigned long dropped[2];
+  /* mallocs made: mappings, connections and the copies handed out */
+  unsigned long allocs;
+};
+
+struct sr_nat {
+  uint32_t ip_ext; /* external address of the nat, network byte order */
+
+  struct sr_nat_shard *shards;
+  unsigned int nshards;
+
+  /* external ports/ids lo..hi of every type, split into nshards runs of
+     port_span (the last one takes the remainder) */
+  uint16_t port_lo, port_hi;
+  unsigned int port_span;
+  int port_reuse_delay; /* seconds, SR_NAT_PORT_REUSE_DELAY by default */
+
+  /* idle timeouts, seconds */
+  int icmp_timeout;
+  int udp_timeout;
+  int tcp_est_timeout;   /* established connections */
+  int tcp_trans_timeout; /* connections being opened or closed */
 
   /* threading */
-  pthread_mutex_t lock;
-  pthread_mutexattr_t attr;
   pthread_attr_t thread_attr;
   pthread_t thread;
 };
 
+/* Totals over every shard, from sr_nat_get_stats(). */
+struct sr_nat_stats {
+  unsigned int count;     /* mappings */
+  unsigned long timers;   /* pending mapping and connection timeouts */
+  unsigned long translated[2];
+  unsigned long dropped[2];
+  unsigned long allocs;
+  unsigned long exhausted[SR_NAT_NTYPES];
+  unsigned long cooling[SR_NAT_NTYPES];
+};
+
 
 int   sr_nat_init(struct sr_nat *nat);     /* Initializes the nat */
+/* sr_nat_init() with the table split into nshards shards, 1 for a
+   single lock over everything */
+int   sr_nat_init_shards(struct sr_nat *nat, unsigned int nshards);
 int   sr_nat_destroy(struct sr_nat *nat);  /* Destroys the nat (free memory) */
 void *sr_nat_timeout(void *nat_ptr);  /* Periodic Timout */
 
+/* Expire every mapping and connection idle up to now.  The timeout thread
+   calls this each second. */
+void  sr_nat_expire(struct sr_nat *nat, time_t now);
+
+/* Add up the shards' counters into *stats. */
+void  sr_nat_get_stats(struct sr_nat *nat, struct sr_nat_stats *stats);
+
+/* Use ports/ids lo..hi (lo > 1023) for new mappings of every type,
+   repartitioned over the shards.  Only before any mapping exists;
+   returns -1 otherwise or on a bad range (fewer ports than shards). */
+int   sr_nat_set_port_range(struct sr_nat *nat, uint16_t lo, uint16_t hi);
+
 /* Get the mapping associated with given external port.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
     uint16_t aux_ext, sr_nat_mapping_type type );
 
-/* Get the mapping associated with given internal (ip, port) pair.
+/* Get the mapping associated with given internal (ip, port) pair.  This
+   is the outbound direction, so it also refreshes the mapping.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
-/* Insert a new mapping into the nat's mapping table.
+/* Insert a new mapping into the nat's mapping table.  Returns the
+   existing one if (ip_int, aux_int, type) is already mapped, NULL when
+   no external id is free.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
+/* Zero-copy forms of the three calls above.  The mapping's addresses
+   and ports are copied into *binding; nothing is allocated except a new
+   mapping on insert.  Return 0, or -1 if there is no mapping (no
+   external id free, for insert). */
+int   sr_nat_lookup_external_r(struct sr_nat *nat, uint16_t aux_ext,
+  sr_nat_mapping_type type, struct sr_nat_binding *binding );
+int   sr_nat_lookup_internal_r(struct sr_nat *nat, uint32_t ip_int,
+  uint16_t aux_int, sr_nat_mapping_type type, struct sr_nat_binding *binding );
+int   sr_nat_insert_mapping_r(struct sr_nat *nat, uint32_t ip_int,
+  uint16_t aux_int, sr_nat_mapping_type type, struct sr_nat_binding *binding );
+
+/* Feed a TCP segment through the connection tracking of the mapping on
+   external port aux_ext.  (ip_peer, port_peer) is the external endpoint,
+   flags the TCP flags byte, dir SR_NAT_OUTBOUND or SR_NAT_INBOUND.
+   Refreshes the mapping and returns the connection's new state, or -1 if
+   there is no such mapping or no memory for a new connection. */
+int   sr_nat_tcp_track(struct sr_nat *nat, uint16_t aux_ext,
+  uint32_t ip_peer, uint16_t port_peer, uint8_t flags, int dir );
+
+struct sr_ip_hdr;
+
+/* Translate the packet at ip in place, len bytes from the IP header on,
+   in direction dir (SR_NAT_OUTBOUND from an inside interface to an
+   outside one, SR_NAT_INBOUND addressed to ip_ext).  Returns SR_NAT_OK,
+   SR_NAT_DROP, or SR_NAT_NO_MAPPING for an inbound packet the nat has
+   nothing for (it may be for the router itself). */
+int   sr_nat_translate(struct sr_nat *nat, struct sr_ip_hdr *ip,
+  unsigned int len, int dir );
+
+/* Drop the mapping for an external port and release the port.
+   Returns 0, or -1 if there is no such mapping. */
+int   sr_nat_remove_mapping(struct sr_nat *nat, uint16_t aux_ext,
+  sr_nat_mapping_type type );
+
 
 #endif
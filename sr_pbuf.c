@@ -0,0 +1,297 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pbuf.c
+ *
+ * Description:
+ *
+ * Packet buffer pool (see sr_pbuf.h).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sr_pbuf.h"
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pbuf_cache
+ *
+ * A thread's own free buffers and counters.  Created on the thread's
+ * first allocation; when the thread exits its buffers go back to the
+ * global list and its counts into the pool's.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pbuf_cache
+{
+    struct sr_pbuf* bufs[SR_PBUF_CACHE];
+    unsigned int n;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long failed;
+    struct sr_pbuf_cache* next;     /* on the pool's list of caches */
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    struct sr_pbuf* free;
+    unsigned long nfree;
+    unsigned long bufs;
+    unsigned long grows;
+    int strict;
+    struct sr_pbuf_cache* caches;   /* of live threads */
+    unsigned long allocs;           /* counts of exited threads */
+    unsigned long frees;
+    unsigned long failed;
+    pthread_key_t key;
+} sr_pbuf_pool = { PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_once_t sr_pbuf_once = PTHREAD_ONCE_INIT;
+static __thread struct sr_pbuf_cache* sr_pbuf_tls;
+
+static void sr_pbuf_cache_release(void* arg);
+
+static void sr_pbuf_setup(void)
+{
+    pthread_key_create(&sr_pbuf_pool.key, sr_pbuf_cache_release);
+} /* -- sr_pbuf_setup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pbuf_grow(..)
+ * Scope:  Local
+ *
+ * Adds a chunk of buffers to the free list.  Called with the lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pbuf_grow(void)
+{
+    struct sr_pbuf* chunk;
+    int i;
+
+    if (sr_pbuf_pool.strict)
+    {
+        fprintf(stderr, "sr_pbuf: pool of %lu buffers had to grow in strict mode\n",
+                sr_pbuf_pool.bufs);
+        abort();
+    }
+
+    if ((chunk = (struct sr_pbuf*)malloc(SR_PBUF_CHUNK * sizeof(struct sr_pbuf))) == 0)
+    { return -1; }
+    sr_pbuf_pool.grows++;
+
+    for (i = 0; i < SR_PBUF_CHUNK; i++)
+    {
+        chunk[i].next = sr_pbuf_pool.free;
+        sr_pbuf_pool.free = &chunk[i];
+    }
+    sr_pbuf_pool.nfree += SR_PBUF_CHUNK;
+    sr_pbuf_pool.bufs += SR_PBUF_CHUNK;
+    return 0;
+} /* -- sr_pbuf_grow -- */
+
+/* Move buffers from the global list into c until it is half full. */
+static void sr_pbuf_refill(struct sr_pbuf_cache* c)
+{
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    while (c->n < SR_PBUF_CACHE / 2)
+    {
+        if (sr_pbuf_pool.free == 0 && sr_pbuf_grow() != 0)
+        { break; }
+        c->bufs[c->n++] = sr_pbuf_pool.free;
+        sr_pbuf_pool.free = sr_pbuf_pool.free->next;
+        sr_pbuf_pool.nfree--;
+    }
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+} /* -- sr_pbuf_refill -- */
+
+/* Give back the buffers in c above keep. */
+static void sr_pbuf_spill(struct sr_pbuf_cache* c, unsigned int keep)
+{
+    struct sr_pbuf* pb;
+
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    while (c->n > keep)
+    {
+        pb = c->bufs[--c->n];
+        pb->next = sr_pbuf_pool.free;
+        sr_pbuf_pool.free = pb;
+        sr_pbuf_pool.nfree++;
+    }
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+} /* -- sr_pbuf_spill -- */
+
+static struct sr_pbuf_cache* sr_pbuf_cache_get(void)
+{
+    struct sr_pbuf_cache* c = sr_pbuf_tls;
+
+    if (c)
+    { return c; }
+
+    pthread_once(&sr_pbuf_once, sr_pbuf_setup);
+    if ((c = (struct sr_pbuf_cache*)calloc(1, sizeof(struct sr_pbuf_cache))) == 0)
+    { return 0; }
+
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    c->next = sr_pbuf_pool.caches;
+    sr_pbuf_pool.caches = c;
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+
+    pthread_setspecific(sr_pbuf_pool.key, c);
+    sr_pbuf_tls = c;
+    return c;
+} /* -- sr_pbuf_cache_get -- */
+
+/* Thread exit: hand everything in the thread's cache to the pool. */
+static void sr_pbuf_cache_release(void* arg)
+{
+    struct sr_pbuf_cache* c = (struct sr_pbuf_cache*)arg;
+    struct sr_pbuf_cache** pp;
+
+    sr_pbuf_spill(c, 0);
+
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    for (pp = &sr_pbuf_pool.caches; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == c)
+        {
+            *pp = c->next;
+            break;
+        }
+    }
+    sr_pbuf_pool.allocs += c->allocs;
+    sr_pbuf_pool.frees += c->frees;
+    sr_pbuf_pool.failed += c->failed;
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+
+    free(c);
+} /* -- sr_pbuf_cache_release -- */
+
+int sr_pbuf_reserve(unsigned int nbufs)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    while (sr_pbuf_pool.bufs < nbufs)
+    {
+        if ((ret = sr_pbuf_grow()) != 0)
+        { break; }
+    }
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+    return ret;
+} /* -- sr_pbuf_reserve -- */
+
+void sr_pbuf_strict(int on)
+{
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    sr_pbuf_pool.strict = on;
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+} /* -- sr_pbuf_strict -- */
+
+struct sr_pbuf* sr_pbuf_alloc(void)
+{
+    struct sr_pbuf_cache* c = sr_pbuf_cache_get();
+    struct sr_pbuf* pb;
+
+    if (c == 0)
+    { return 0; }
+
+    if (c->n == 0)
+    {
+        sr_pbuf_refill(c);
+        if (c->n == 0)
+        {
+            c->failed++;
+            return 0;
+        }
+    }
+
+    pb = c->bufs[--c->n];
+    pb->next = 0;
+    pb->refcnt = 1;
+    pb->len = 0;
+    pb->data = pb->buf + SR_PBUF_HEADROOM;
+    c->allocs++;
+    return pb;
+} /* -- sr_pbuf_alloc -- */
+
+struct sr_pbuf* sr_pbuf_copy(const uint8_t* frame, unsigned int len)
+{
+    struct sr_pbuf* pb;
+
+    if (len > SR_PBUF_ROOM)
+    {
+        if (sr_pbuf_cache_get())
+        { sr_pbuf_tls->failed++; }
+        return 0;
+    }
+    if ((pb = sr_pbuf_alloc()) == 0)
+    { return 0; }
+
+    memcpy(pb->data, frame, len);
+    pb->len = len;
+    return pb;
+} /* -- sr_pbuf_copy -- */
+
+void sr_pbuf_ref(struct sr_pbuf* pb)
+{
+    __atomic_add_fetch(&pb->refcnt, 1, __ATOMIC_RELAXED);
+} /* -- sr_pbuf_ref -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pbuf_free(..)
+ * Scope:  Global
+ *
+ * Drops a reference.  The last one puts the buffer on the calling
+ * thread's cache, whichever thread allocated it; a full cache sends half
+ * of itself back to the global list.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pbuf_free(struct sr_pbuf* pb)
+{
+    struct sr_pbuf_cache* c;
+
+    if (pb == 0 || __atomic_sub_fetch(&pb->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+    { return; }
+
+    if ((c = sr_pbuf_cache_get()) == 0)
+    {
+        /* no cache to put it on: straight to the list */
+        pthread_mutex_lock(&sr_pbuf_pool.lock);
+        pb->next = sr_pbuf_pool.free;
+        sr_pbuf_pool.free = pb;
+        sr_pbuf_pool.nfree++;
+        sr_pbuf_pool.frees++;
+        pthread_mutex_unlock(&sr_pbuf_pool.lock);
+        return;
+    }
+
+    if (c->n == SR_PBUF_CACHE)
+    { sr_pbuf_spill(c, SR_PBUF_CACHE / 2); }
+    c->bufs[c->n++] = pb;
+    c->frees++;
+} /* -- sr_pbuf_free -- */
+
+void sr_pbuf_get_stats(struct sr_pbuf_stats* stats)
+{
+    struct sr_pbuf_cache* c;
+
+    pthread_mutex_lock(&sr_pbuf_pool.lock);
+    stats->bufs = sr_pbuf_pool.bufs;
+    stats->grows = sr_pbuf_pool.grows;
+    stats->allocs = sr_pbuf_pool.allocs;
+    stats->frees = sr_pbuf_pool.frees;
+    stats->failed = sr_pbuf_pool.failed;
+    for (c = sr_pbuf_pool.caches; c; c = c->next)
+    {
+        stats->allocs += c->allocs;
+        stats->frees += c->frees;
+        stats->failed += c->failed;
+    }
+    pthread_mutex_unlock(&sr_pbuf_pool.lock);
+
+    stats->in_use = stats->allocs - stats->frees;
+} /* -- sr_pbuf_get_stats -- */
@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pbuf.h
+ *
+ * Description:
+ *
+ * Pool of fixed size packet buffers.  Every frame the router builds or
+ * keeps (ARP requests and replies, ICMP messages, frames waiting on ARP,
+ * frames held by a send batch) lives in one.  A buffer has
+ * SR_PBUF_HEADROOM bytes in front of the frame, so the VNS header can be
+ * written there and the frame sent in place, and a reference count, so
+ * the ARP queue and a send batch can hold the same frame without a copy.
+ *
+ * Free buffers sit on a global list under a mutex, with a small cache per
+ * thread in front of it: allocating and freeing normally touch only the
+ * calling thread's cache, and the list is visited once per half cache.
+ * The pool grows by SR_PBUF_CHUNK buffers at a time when the list runs
+ * dry and never shrinks, so once traffic has reached steady state nothing
+ * is malloc'd.  sr_pbuf_strict() turns that into an assertion: any growth
+ * after it aborts.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_PBUF_H
+#define sr_PBUF_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_PBUF_SIZE      2048  /* bytes per buffer, headroom included */
+#define SR_PBUF_HEADROOM  64    /* room in front of the frame, at least a
+                                   c_packet_header */
+#define SR_PBUF_ROOM      (SR_PBUF_SIZE - SR_PBUF_HEADROOM)  /* largest frame */
+
+#define SR_PBUF_CHUNK     64    /* buffers malloc'd at once when growing */
+#define SR_PBUF_CACHE     32    /* buffers a thread keeps to itself */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pbuf
+ *
+ * One buffer.  The frame is len bytes at data, which starts out
+ * SR_PBUF_HEADROOM into buf.  next is free for whoever holds the only
+ * reference.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pbuf
+{
+    struct sr_pbuf* next;
+    int refcnt;
+    unsigned int len;
+    uint8_t* data;
+    uint8_t buf[SR_PBUF_SIZE];
+};
+
+struct sr_pbuf_stats
+{
+    unsigned long bufs;         /* buffers in the pool */
+    unsigned long in_use;       /* allocated and not yet freed */
+    unsigned long allocs;       /* sr_pbuf_alloc() calls that got a buffer */
+    unsigned long frees;        /* buffers returned */
+    unsigned long failed;       /* allocations refused: too big, no memory */
+    unsigned long grows;        /* mallocs made by the pool */
+};
+
+/* Make sure the pool holds at least nbufs buffers.  Optional, the pool
+   also grows on demand.  Returns -1 when out of memory. */
+int  sr_pbuf_reserve(unsigned int nbufs);
+
+/* From here on, abort if the pool ever has to grow. */
+void sr_pbuf_strict(int on);
+
+/* A buffer with one reference, len 0, data at the default headroom.
+   NULL when out of memory. */
+struct sr_pbuf* sr_pbuf_alloc(void);
+
+/* sr_pbuf_alloc() with a copy of frame in it.  NULL if len is over
+   SR_PBUF_ROOM or out of memory. */
+struct sr_pbuf* sr_pbuf_copy(const uint8_t* frame, unsigned int len);
+
+/* Take another reference, and drop one; the last one frees the buffer. */
+void sr_pbuf_ref(struct sr_pbuf* pb);
+void sr_pbuf_free(struct sr_pbuf* pb);
+
+/* Totals over every thread.  The counters are read without stopping the
+   other threads, so they are only exact when the pool is quiet. */
+void sr_pbuf_get_stats(struct sr_pbuf_stats* stats);
+
+#endif /* -- sr_PBUF_H -- */
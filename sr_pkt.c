@@ -0,0 +1,100 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pkt.c
+ *
+ * Description:
+ *
+ * Packet descriptor (see sr_pkt.h).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_pkt.h"
+#include "sr_protocol.h"
+
+/* Murmur3 finalizer over a 32 bit key */
+static uint32_t sr_pkt_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+} /* -- sr_pkt_mix -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_parse(..)
+ * Scope:  Global
+ *
+ * The flow hash covers the IPv4 addresses and protocol and, for TCP and
+ * UDP that is not fragmented, the ports.  Fragments leave the ports out
+ * so that every fragment of a datagram hashes alike.  An ARP request is
+ * hashed on the address it asks about, a reply on the one it answers
+ * for.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pkt_parse(struct sr_pkt* pkt, uint8_t* frame, unsigned int len,
+                  struct sr_if* in)
+{
+    const sr_ip_hdr_t* ip;
+    const sr_arp_hdr_t* arp;
+    const uint8_t* l4;
+    unsigned int hl;
+    uint32_t h;
+
+    pkt->frame = frame;
+    pkt->len = len;
+    pkt->in = in;
+    pkt->hash = 0;
+    pkt->type = 0;
+    pkt->l3 = pkt->l4 = 0;
+    pkt->proto = 0;
+    pkt->flags = 0;
+
+    if (len < sizeof(sr_ethernet_hdr_t))
+    { return; }
+    pkt->type = ntohs(((const sr_ethernet_hdr_t*)frame)->ether_type);
+
+    switch (pkt->type)
+    {
+        case ethertype_ip:
+            if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+            { return; }
+            pkt->l3 = sizeof(sr_ethernet_hdr_t);
+            ip = (const sr_ip_hdr_t*)(frame + pkt->l3);
+            pkt->proto = ip->ip_p;
+            if (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK))
+            { pkt->flags |= SR_PKT_FRAG; }
+
+            hl = ip->ip_hl * 4;
+            if (hl >= sizeof(sr_ip_hdr_t) && pkt->l3 + hl <= len)
+            { pkt->l4 = pkt->l3 + hl; }
+
+            h = sr_pkt_mix(ip->ip_src) ^ ip->ip_dst;
+            h = sr_pkt_mix(h ^ ip->ip_p);
+            if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+                !(pkt->flags & SR_PKT_FRAG) && pkt->l4 && pkt->l4 + 4 <= len)
+            {
+                l4 = frame + pkt->l4;
+                h = sr_pkt_mix(h ^ (((uint32_t)l4[0] << 24) | (l4[1] << 16) |
+                                    (l4[2] << 8) | l4[3]));
+            }
+            pkt->hash = h;
+            break;
+
+        case ethertype_arp:
+            if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+            { return; }
+            pkt->l3 = sizeof(sr_ethernet_hdr_t);
+            arp = (const sr_arp_hdr_t*)(frame + pkt->l3);
+            pkt->hash = sr_pkt_mix(ntohs(arp->ar_op) == arp_op_reply ?
+                                   arp->ar_sip : arp->ar_tip);
+            break;
+
+        default:
+            break;
+    }
+} /* -- sr_pkt_parse -- */
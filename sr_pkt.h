@@ -0,0 +1,62 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pkt.h
+ *
+ * Description:
+ *
+ * Packet descriptor.  A received frame is parsed once, where it comes in
+ * (the VNS reader, a replay, sr_handlepacket), into a struct sr_pkt, and
+ * everything after that works from the descriptor: the flow hash the
+ * engine dispatches on, the ARP filter in sr_vns_comm.c, the vector
+ * stages, sr_handleARP, sr_handleIP and the ICMP replies.  Headers are
+ * found through offsets that sr_pkt_parse has already checked against
+ * the frame length, so those stages need no length checks of their own.
+ *
+ * Offsets rather than pointers, so a descriptor still holds when the
+ * frame is copied (the engine moves it into a packet buffer): only frame
+ * changes.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_PKT_H
+#define sr_PKT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_if;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pkt
+ *
+ * l3 is the ARP or IPv4 header, 0 when the frame is neither or too short
+ * for a whole one.  l4 is what follows the IPv4 header (options
+ * included), 0 when ip_hl does not fit the frame.  hash is 0 for
+ * anything but IPv4 and ARP.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pkt
+{
+    uint8_t* frame;
+    unsigned int len;
+    struct sr_if* in;           /* receiving interface, 0 if unknown */
+    uint32_t hash;              /* flow hash, see sr_pkt_parse */
+    uint16_t type;              /* Ethernet type, host order */
+    uint16_t l3;                /* offsets into frame */
+    uint16_t l4;
+    uint8_t proto;              /* IP protocol */
+    uint8_t flags;
+};
+
+#define SR_PKT_FRAG 0x01        /* IP fragment, first or later */
+
+/* Fill pkt for the frame of len bytes received on in. */
+void sr_pkt_parse(struct sr_pkt* pkt, uint8_t* frame, unsigned int len,
+                  struct sr_if* in);
+
+#endif /* -- sr_PKT_H -- */
@@ -0,0 +1,437 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.c
+ *
+ * Description:
+ *
+ * Offline packet backend (see sr_io.h).  Frames are read from a pcap file,
+ * such as the ones sr -l writes, and handed to sr_handlepacket either back
+ * to back or with the spacing they were captured at.  Frames the router
+ * sends go to an output pcap, or nowhere.
+ *
+ * A capture of the router's own log holds what it sent as well as what it
+ * received, and pcap does not record the interface.  So the interfaces
+ * are given in a file, one per line:
+ *
+ *   eth1 10.0.1.1 c6:52:8a:73:d7:b3
+ *
+ * and a frame is replayed on the interface whose MAC it is addressed to
+ * (or, for a broadcast ARP request, whose IP it asks for).  Everything
+ * else, including the router's own output, is skipped.
+ *
+ * When the input is used up the backend prints packets/sec and the
+ * latency of sr_handlepacket per frame (of queueing it, with workers).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_io.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_dumper.h"
+#include "sr_engine.h"
+#include "sr_pkt.h"
+#include "vnscommand.h"
+
+#define SR_REPLAY_SNAPLEN 65535
+
+/* byte swapped TCPDUMP_MAGIC, a capture from the other endianness */
+#define SR_REPLAY_MAGIC_SWAPPED 0xd4c3b2a1
+
+struct sr_replay_frame
+{
+    uint8_t* data;              /* Ethernet frame */
+    unsigned int len;
+    struct sr_if* iface;        /* interface it arrives on */
+    double ts;                  /* capture time, seconds */
+};
+
+struct sr_replay
+{
+    struct sr_replay_frame* frames;
+    uint32_t nframes;
+    uint32_t next;              /* next frame to deliver */
+    int loops;                  /* passes over frames still to go */
+    int timed;                  /* honour capture spacing */
+
+    uint8_t* work;              /* frame being handled, with VNS headroom */
+
+    FILE* out;                  /* egress pcap, or 0 to discard */
+    pthread_mutex_t out_lock;   /* ARP thread sends too */
+    uint32_t sent;
+
+    uint32_t* lat;              /* ns per sr_handlepacket (or dispatch) call */
+    uint32_t nlat;
+    double start;               /* wall clock at first frame */
+    double pass_start;          /* wall clock at start of this pass */
+};
+
+static double sr_replay_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t sr_replay_swap32(uint32_t x)
+{
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_load_ifaces(..)
+ * Scope:  Global
+ *
+ * Read the interface list ("name ip mac" per line, # for comments) into
+ * sr->if_list, the way sr_handle_hwinfo would from the server.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_replay_load_ifaces(struct sr_instance* sr, const char* filename)
+{
+    FILE* fp;
+    char line[256];
+    char name[sr_IFACE_NAMELEN + 1];
+    char ip[32];
+    unsigned int mac[ETHER_ADDR_LEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    struct in_addr ip_addr;
+    int i, count = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (line[0] == '#' || sscanf(line, "%31s", ip) != 1)
+        { continue; }
+
+        if (sscanf(line, "%15s %31s %x:%x:%x:%x:%x:%x", name, ip, &mac[0],
+                   &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 8 ||
+            inet_aton(ip, &ip_addr) == 0)
+        {
+            fprintf(stderr, "%s: bad interface line: %s", filename, line);
+            fclose(fp);
+            return -1;
+        }
+
+        for (i = 0; i < ETHER_ADDR_LEN; i++)
+        { addr[i] = (unsigned char)mac[i]; }
+
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, addr);
+        sr_set_ether_ip(sr, ip_addr.s_addr);
+        count++;
+    }
+
+    fclose(fp);
+    return count ? 0 : -1;
+} /* -- sr_replay_load_ifaces -- */
+
+/* The interface a captured frame was received on, 0 if the router did
+   not receive it (its own output or traffic between other hosts). */
+static struct sr_if* sr_replay_ingress(struct sr_instance* sr,
+                                       const uint8_t* frame, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    struct sr_if* iface;
+
+    if (len < sizeof(sr_ethernet_hdr_t))
+    { return 0; }
+
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        if (memcmp(eth->ether_shost, iface->addr, ETHER_ADDR_LEN) == 0)
+        { return 0; }
+    }
+
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        if (memcmp(eth->ether_dhost, iface->addr, ETHER_ADDR_LEN) == 0)
+        { return iface; }
+    }
+
+    if (memcmp(eth->ether_dhost, BROADCAST, ETHER_ADDR_LEN) == 0 &&
+        ntohs(eth->ether_type) == ethertype_arp &&
+        len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        const sr_arp_hdr_t* arp = (const sr_arp_hdr_t*)(eth + 1);
+
+        for (iface = sr->if_list; iface; iface = iface->next)
+        {
+            if (arp->ar_tip == iface->ip)
+            { return iface; }
+        }
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_load(..)
+ * Scope:  Local
+ *
+ * Read every frame the router received out of a pcap file.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_load(struct sr_instance* sr, struct sr_replay* rp,
+                          const char* filename)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    uint32_t size = 0;
+    int swapped;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "rb")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    if (fread(&fh, sizeof(fh), 1, fp) != 1 ||
+        (fh.magic != TCPDUMP_MAGIC && fh.magic != SR_REPLAY_MAGIC_SWAPPED))
+    {
+        fprintf(stderr, "%s: not a pcap file\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    swapped = (fh.magic == SR_REPLAY_MAGIC_SWAPPED);
+
+    if ((swapped ? sr_replay_swap32(fh.linktype) : fh.linktype)
+        != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "%s: not an Ethernet capture\n", filename);
+        fclose(fp);
+        return -1;
+    }
+
+    while (fread(&ph, sizeof(ph), 1, fp) == 1)
+    {
+        struct sr_replay_frame* f;
+        uint32_t caplen = swapped ? sr_replay_swap32(ph.caplen) : ph.caplen;
+        uint8_t* data;
+
+        if (caplen > SR_REPLAY_SNAPLEN || (data = malloc(caplen ? caplen : 1)) == 0)
+        {
+            fprintf(stderr, "%s: bad record\n", filename);
+            fclose(fp);
+            return -1;
+        }
+        if (fread(data, 1, caplen, fp) != caplen)
+        {
+            free(data);
+            break; /* truncated capture, keep what we have */
+        }
+
+        if (rp->nframes == size)
+        {
+            size = size ? size * 2 : 64;
+            rp->frames = realloc(rp->frames, size * sizeof(struct sr_replay_frame));
+            assert(rp->frames);
+        }
+
+        f = &rp->frames[rp->nframes];
+        f->data = data;
+        f->len = caplen;
+        f->iface = sr_replay_ingress(sr, data, caplen);
+        f->ts = (swapped ? (int)sr_replay_swap32(ph.ts.tv_sec) : ph.ts.tv_sec) +
+                (swapped ? (int)sr_replay_swap32(ph.ts.tv_usec) : ph.ts.tv_usec) / 1e6;
+
+        if (f->iface)
+        { rp->nframes++; }
+        else
+        { free(data); }
+    }
+
+    fclose(fp);
+    return 0;
+} /* -- sr_replay_load -- */
+
+static int sr_replay_cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/*---------------------------------------------------------------------
+ * Backend operations
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_read(struct sr_instance* sr)
+{
+    struct sr_replay* rp = sr->io_data;
+    struct sr_replay_frame* f;
+    struct sr_pkt pkt;
+    struct timespec t0, t1;
+
+    if (rp->next == rp->nframes)
+    {
+        if (--rp->loops <= 0)
+        { return 0; }
+        rp->next = 0;
+        rp->pass_start = sr_replay_now();
+    }
+
+    if (rp->nlat == 0)
+    { rp->start = rp->pass_start = sr_replay_now(); }
+
+    f = &rp->frames[rp->next++];
+
+    if (rp->timed)
+    {
+        double wait = rp->pass_start + (f->ts - rp->frames[0].ts) - sr_replay_now();
+        if (wait > 0)
+        {
+            struct timespec ts;
+            ts.tv_sec = (time_t)wait;
+            ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+            nanosleep(&ts, 0);
+        }
+    }
+
+    /* the handler rewrites the frame in place, so work on a copy that
+       sits behind VNS header headroom like a frame from the server */
+    memcpy(rp->work + sizeof(c_packet_header), f->data, f->len);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    sr_pkt_parse(&pkt, rp->work + sizeof(c_packet_header), f->len, f->iface);
+    sr_engine_input(sr, &pkt);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    rp->lat[rp->nlat++] = (uint32_t)((t1.tv_sec - t0.tv_sec) * 1000000000L +
+                                     (t1.tv_nsec - t0.tv_nsec));
+    return 1;
+}
+
+static int sr_replay_send(struct sr_instance* sr, uint8_t* buf,
+                          unsigned int len, const char* iface)
+{
+    struct sr_replay* rp = sr->io_data;
+    struct pcap_pkthdr h;
+
+    pthread_mutex_lock(&rp->out_lock);
+    rp->sent++;
+    if (rp->out)
+    {
+        gettimeofday(&h.ts, 0);
+        h.caplen = len;
+        h.len = len;
+        sr_dump(rp->out, &h, buf);
+    }
+    pthread_mutex_unlock(&rp->out_lock);
+
+    return 0;
+}
+
+static void sr_replay_close(struct sr_instance* sr)
+{
+    struct sr_replay* rp = sr->io_data;
+    double secs = sr_replay_now() - rp->start;
+    uint32_t i, n = rp->nlat;
+
+    if (n)
+    {
+        qsort(rp->lat, n, sizeof(uint32_t), sr_replay_cmp_u32);
+        printf("replay: %u frames in %.3f s, %.0f packets/s, %u sent\n",
+               n, secs, n / secs, rp->sent);
+        printf("replay: %s ns p50 %u p99 %u p99.9 %u max %u\n",
+               sr->engine ? "dispatch" : "sr_handlepacket", rp->lat[n / 2], rp->lat[(uint32_t)(n * 0.99)],
+               rp->lat[(uint32_t)(n * 0.999)], rp->lat[n - 1]);
+    }
+
+    pthread_mutex_lock(&rp->out_lock);
+    if (rp->out)
+    { sr_dump_close(rp->out); }
+    rp->out = 0;
+    pthread_mutex_unlock(&rp->out_lock);
+
+    for (i = 0; i < rp->nframes; i++)
+    { free(rp->frames[i].data); }
+    free(rp->frames);
+    free(rp->work);
+    free(rp->lat);
+    /* rp itself stays: the ARP thread may still send into it */
+}
+
+static const struct sr_io_ops sr_replay_ops =
+{
+    "replay",
+    sr_replay_read,
+    sr_replay_send,
+    sr_replay_close
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_open(..)
+ * Scope:  Global
+ *
+ * Load in_pcap and make it sr's packet source.  Interfaces must already
+ * be set up (sr_replay_load_ifaces).  Frames the router sends are written
+ * to out_pcap if it is not 0.  The capture is replayed loops times; timed
+ * keeps the captured spacing instead of going as fast as possible.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_replay_open(struct sr_instance* sr, const char* in_pcap,
+                   const char* out_pcap, int loops, int timed)
+{
+    struct sr_replay* rp;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(in_pcap);
+
+    if ((rp = calloc(1, sizeof(struct sr_replay))) == 0)
+    { return -1; }
+
+    if (sr_replay_load(sr, rp, in_pcap) != 0)
+    { return -1; }
+    if (rp->nframes == 0)
+    {
+        fprintf(stderr, "%s: no frames addressed to the router\n", in_pcap);
+        return -1;
+    }
+
+    rp->loops = loops > 0 ? loops : 1;
+    rp->timed = timed;
+    rp->work = malloc(sizeof(c_packet_header) + SR_REPLAY_SNAPLEN);
+    rp->lat = malloc((size_t)rp->nframes * rp->loops * sizeof(uint32_t));
+    if (!rp->work || !rp->lat)
+    {
+        fprintf(stderr, "sr_replay_open: out of memory\n");
+        return -1;
+    }
+
+    pthread_mutex_init(&rp->out_lock, 0);
+    if (out_pcap)
+    {
+        if ((rp->out = sr_dump_open(out_pcap, 0, SR_REPLAY_SNAPLEN)) == 0)
+        { return -1; }
+    }
+
+    printf("replay: %u frames from %s, %d pass(es)%s\n", rp->nframes,
+           in_pcap, rp->loops, timed ? ", captured timing" : "");
+
+    sr->io_data = rp;
+    sr->io = &sr_replay_ops;
+    return 0;
+} /* -- sr_replay_open -- */
@@ -34,6 +34,10 @@
 
 
 
+#include <arpa/inet.h>
+
+
+
 #include "sr_if.h"
 
 #include "sr_rt.h"
@@ -48,6 +52,10 @@
 
 #include "sr_dumper.h"
 
+#include "sr_log.h"
+
+#include "sr_pkt.h"
+
 
 
 /*---------------------------------------------------------------------
@@ -106,6 +114,148 @@ void sr_init(struct sr_instance* sr)
 
 
 
+/*---------------------------------------------------------------------
+
+ * Method: sr_enable_nat(..)
+
+ * Scope:  Global
+
+ *
+
+ * Turn on NAT mode.  The interfaces named in inside face the private
+
+ * network, every other one the outside; the address of the first
+
+ * outside interface is the one mappings are made on.  Returns -1 if an
+
+ * interface does not exist or none is left for the outside.
+
+ *
+
+ *---------------------------------------------------------------------*/
+
+
+
+int sr_enable_nat(struct sr_instance* sr, char** inside, int ninside)
+
+{
+
+    struct sr_if* iface;
+
+    struct in_addr ext;
+
+    int i;
+
+
+
+    for (i = 0; i < ninside; i++) {
+
+        iface = sr_get_interface(sr, inside[i]);
+
+        if (!iface) {
+
+            sr_log_error("NAT: no interface %s\n", inside[i]);
+
+            return -1;
+
+        }
+
+        iface->nat_inside = 1;
+
+    }
+
+
+
+    for (iface = sr->if_list; iface && iface->nat_inside; iface = iface->next);
+
+    if (!iface) {
+
+        sr_log_error("NAT: no outside interface\n");
+
+        return -1;
+
+    }
+
+
+
+    if (sr_nat_init(&sr->nat) != 0)
+
+        return -1;
+
+    sr->nat.ip_ext = iface->ip;
+
+    sr_if_addr_set_flags(sr, iface->ip, SR_IF_ADDR_NAT_EXT);
+
+    sr->nat_enabled = 1;
+
+
+
+    ext.s_addr = iface->ip;
+
+    sr_log_info("NAT: external address %s on %s\n", inet_ntoa(ext), iface->name);
+
+    return 0;
+
+} /* -- sr_enable_nat -- */
+
+
+
+
+/*---------------------------------------------------------------------
+
+ * Method: sr_start_nat(..)
+
+ * Scope:  Global
+
+ *
+
+ * Apply the -n settings in sr->nat_opts.  Called once the interfaces
+
+ * are known: at startup when they come from a file (replay), otherwise
+
+ * when the server's HWINFO arrives.  Does nothing if NAT was not asked
+
+ * for or is already on.
+
+ *
+
+ *---------------------------------------------------------------------*/
+
+
+
+int sr_start_nat(struct sr_instance* sr)
+
+{
+
+    struct sr_nat_opts* opts = &sr->nat_opts;
+
+
+
+    if (!opts->enabled || sr->nat_enabled)
+
+        return 0;
+
+
+
+    if (sr_enable_nat(sr, opts->inside, opts->ninside) != 0)
+
+        return -1;
+
+    sr->nat.icmp_timeout = opts->icmp_timeout;
+
+    sr->nat.tcp_est_timeout = opts->tcp_est_timeout;
+
+    sr->nat.tcp_trans_timeout = opts->tcp_trans_timeout;
+
+    sr->nat.udp_timeout = opts->udp_timeout;
+
+    return 0;
+
+} /* -- sr_start_nat -- */
+
+
+
+
 /*---------------------------------------------------------------------
 
  * Method: sr_handlepacket(uint8_t* p,char* interface)
@@ -130,7 +280,11 @@ void sr_init(struct sr_instance* sr)
 
  * packet instead if you intend to keep it around beyond the scope of
 
- * the method call.
+ * the method call.  The packet may be modified and sent back out with
+
+ * sr_send_packet_inplace, which reuses the VNS header in front of it
+
+ * (interface points into that header, so look it up first).
 
  *
 
@@ -143,51 +297,60 @@ void sr_handlepacket(struct sr_instance* sr,
         unsigned int len,
         char* interface/* lent */)
 {
+  struct sr_pkt pkt;
+
   /* REQUIRES */
   assert(sr);
   assert(packet);
   assert(interface);
 
-  printf("*** -> Received packet of length %d \n",len);
+  sr_pkt_parse(&pkt, packet, len, sr_get_interface(sr, interface));
+  sr_handle_pkt(sr, &pkt);
+}/* end sr_ForwardPacket */
 
-  /* Get the ethernet header from the packet */
-  sr_ethernet_hdr_t *ether_hdr = (sr_ethernet_hdr_t *) packet;
+/*---------------------------------------------------------------------
+ * Method: sr_handle_pkt(struct sr_pkt* pkt)
+ * Scope:  Global
+ *
+ * sr_handlepacket for a frame that has already been parsed: what the VNS
+ * reader, the engine workers and the vector path call.  The frame is
+ * lent on the same terms.
+ *
+ *---------------------------------------------------------------------*/
 
-  /* Get the ethernet interface */
-  struct sr_if *sr_ether_if = sr_get_interface(sr, interface);
+void sr_handle_pkt(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+  sr_log_debug("*** -> Received packet of length %d \n",pkt->len);
 
   /* Check whether we found an interface corresponding to the name */
-  if (sr_ether_if) {
-	printf("Interface name: %s\n", sr_ether_if->name);
+  if (pkt->in) {
+	sr_log_debug("Interface name: %s\n", pkt->in->name);
   } else {
-	printf("Invalid interface found.\n");
+	sr_log_warn("Invalid interface found.\n");
 	return;
   }
 
   /* Packet type check: IP, ARP, or neither */
-  switch (ntohs(ether_hdr->ether_type)) {
+  switch (pkt->type) {
 	case ethertype_arp:
 	
 		/* ARP packet */
 
-		printf("Received ARP packet\n");
+		sr_log_debug("Received ARP packet\n");
 
 		/* Check minimum length */
-		if(len < (sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))) {
-			printf("Invalid ARP Packet\n");
+		if (!pkt->l3) {
+			sr_log_debug("Invalid ARP Packet\n");
 			return;
 		}
 
-		/* Get the ARP header from the packet */
-		sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-
 		/* Check to make sure we are handling Ethernet format */
-		if (ntohs(arp_hdr->ar_hrd) != arp_hrd_ethernet) {
-			printf ("Wrong hardware address format. Only Ethernet is supported.\n");
+		if (ntohs(((sr_arp_hdr_t *)(pkt->frame + pkt->l3))->ar_hrd) != arp_hrd_ethernet) {
+			sr_log_debug("Wrong hardware address format. Only Ethernet is supported.\n");
 			return;
 		}
 
-		sr_handleARP(sr, ether_hdr, sr_ether_if, arp_hdr);
+		sr_handleARP(sr, pkt);
 		
 		break;
 		
@@ -195,23 +358,17 @@ void sr_handlepacket(struct sr_instance* sr,
 
 		/* IP packet */
 
-		printf("Received IP packet\n");
-
-		printf("Length is %u\n", len);
-
-		printf("Should be length %lu\n", (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)));
+		sr_log_debug("Received IP packet, length %u\n", pkt->len);
 
 		/* Minimum length */
-		if(len < (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))) {
-			printf("Invalid IP Packet\n");
+		if (!pkt->l3) {
+			sr_log_debug("Invalid IP Packet\n");
 			return;
 		}
 
-		sr_ip_hdr_t *ip_packet_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+		sr_log_dump(print_hdr_ip(pkt->frame + pkt->l3));
 
-		print_hdr_ip((uint8_t *)ip_packet_hdr);
-
-        sr_handleIP(sr, ip_packet_hdr, len, ether_hdr, sr_ether_if);
+        sr_handleIP(sr, pkt);
 		
         break;
 
@@ -219,11 +376,11 @@ void sr_handlepacket(struct sr_instance* sr,
 	
 		/* if it's neither, just ignore it */
 
-		printf("Incorrect protocol type received: %u\n", (unsigned)ntohs(ether_hdr->ether_type));
+		sr_log_debug("Incorrect protocol type received: %u\n", (unsigned)pkt->type);
 
         break;	
   }
-}/* end sr_ForwardPacket */
+}/* -- sr_handle_pkt -- */
 
 
 
@@ -243,7 +400,6 @@ void set_eth_header(uint8_t *packet, uint8_t *ether_shost, uint8_t *ether_dhost,
 	/* Set up the Ethernet header */
 	sr_ethernet_hdr_t *ether_arp_reply = (sr_ethernet_hdr_t *)packet;
 
-	printf("ETHER ADDR %lu, memcopied %lu", ETHER_ADDR_LEN, (sizeof(uint8_t) * ETHER_ADDR_LEN));
 	/* note: uint8_t is not 1 bit so use the size */
 	memcpy(ether_arp_reply->ether_shost, ether_shost, ETHER_ADDR_LEN); /* dest ethernet address */
 	memcpy(ether_arp_reply->ether_dhost, ether_dhost, ETHER_ADDR_LEN); /* source ethernet address */
@@ -267,10 +423,14 @@ void set_eth_header(uint8_t *packet, uint8_t *ether_shost, uint8_t *ether_dhost,
 
 
 
- void sr_handleIP(struct sr_instance* sr, sr_ip_hdr_t *ip_packet_hdr, unsigned int len, sr_ethernet_hdr_t *ether_hdr, struct sr_if *ether_if) {
+ void sr_handleIP(struct sr_instance* sr, struct sr_pkt *pkt) {
 
 	/* Handles IP packets */ 
 
+	sr_ip_hdr_t *ip_packet_hdr = (sr_ip_hdr_t *)(pkt->frame + pkt->l3);
+	struct sr_if *ether_if = pkt->in;
+	unsigned int len = pkt->len;
+
 	
 
     /* Checking validation: TTL, checksum*/
@@ -281,27 +441,45 @@ void set_eth_header(uint8_t *packet, uint8_t *ether_shost, uint8_t *ether_dhost,
 
     if (ip_packet_hdr->ip_ttl <= 1){
 
-        sr_send_icmp_packet(sr, ip_packet_hdr, ICMP_TIME_EXCEEDED, ICMP_TIME_EXCEEDED_CODE);
+        sr_send_icmp_packet(sr, pkt, ICMP_TIME_EXCEEDED, ICMP_TIME_EXCEEDED_CODE);
 
 		return;
 
     }
 
 
-	printf("CHECKSUM FOR IP\n");
-
-    /* Checksum */
-	if (!validate_checksum((uint8_t *)ip_packet_hdr, ip_packet_hdr->ip_hl*4, ethertype_ip)) {
-		printf("INVALID IP\n");
+    /* Checksum, over a header that fits the frame */
+	if (!pkt->l4 || !validate_checksum((uint8_t *)ip_packet_hdr, pkt->l4 - pkt->l3, ethertype_ip)) {
+		sr_log_debug("INVALID IP\n");
 		return;
 	};
 
+    /* One probe says whether the packet is for the router, and whether
+       to its NAT external address */
+    const struct sr_if_addr *local = sr_if_addr_lookup(sr, ip_packet_hdr->ip_dst);
+
+    /* NAT: a packet from outside to the external address goes back to
+       the inside host it is mapped to, or on to the router itself */
+    int nat_inbound = 0;
+    if (sr->nat_enabled && !ether_if->nat_inside && local && (local->flags & SR_IF_ADDR_NAT_EXT)) {
+        switch (sr_nat_translate(&sr->nat, ip_packet_hdr, len - sizeof(sr_ethernet_hdr_t), SR_NAT_INBOUND)) {
+            case SR_NAT_OK:
+                nat_inbound = 1;
+                break;
+            case SR_NAT_DROP:
+                sr_log_debug("NAT: dropping inbound packet\n");
+                return;
+            default:
+                break;
+        }
+    }
+
     /* Check destination */ 
-    struct sr_if * local_interface = sr_search_interface_by_ip(sr, (ip_packet_hdr->ip_dst)); /*htons*/
+    struct sr_if * local_interface = (nat_inbound || !local) ? NULL : local->iface;
 
     if (local_interface)
     {
-		printf("FOUND LOCAL INTERFACE FOR THE IP ADDRESS\n");
+		sr_log_debug("FOUND LOCAL INTERFACE FOR THE IP ADDRESS\n");
         /* Destination is local interface */
         switch(ip_packet_hdr->ip_p)
         {				
@@ -310,22 +488,22 @@ void set_eth_header(uint8_t *packet, uint8_t *ether_shost, uint8_t *ether_dhost,
 			
             case ip_protocol_icmp:
 				/* ICMP is an echo request */
-				printf ("ICMP ECHO REQUEST RECEIVED\n");
+				sr_log_debug("ICMP ECHO REQUEST RECEIVED\n");
 				/* Check length */
 				
-				if (len-sizeof(sr_ethernet_hdr_t) < (sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t))){
+				if (len < pkt->l4 + sizeof(sr_icmp_hdr_t)){
 					perror("Invalid ICMP packet\n");
 					return;
 				}
 				
 
 				/* If echo */
-				icmp_hdr_t *icmp_packet = (icmp_hdr_t *) ((uint8_t *)ip_packet_hdr + ip_packet_hdr->ip_hl*4);
+				icmp_hdr_t *icmp_packet = (icmp_hdr_t *)(pkt->frame + pkt->l4);
 
 				if(icmp_packet->icmp_type == ICMP_ECHO){
-					sr_send_icmp_packet(sr, ip_packet_hdr, ICMP_ECHO, ICMP_ECHO);
+					sr_send_icmp_packet(sr, pkt, ICMP_ECHO, ICMP_ECHO);
 				} else {
-					sr_send_icmp_packet(sr, ip_packet_hdr, ICMP_DEST_UNREACHABLE, ICMP_DEST_PORT_UNREACHABLE_CODE);
+					sr_send_icmp_packet(sr, pkt, ICMP_DEST_UNREACHABLE, ICMP_DEST_PORT_UNREACHABLE_CODE);
 				}
 
                 break;
@@ -333,71 +511,76 @@ void set_eth_header(uint8_t *packet, uint8_t *ether_shost, uint8_t *ether_dhost,
             default: ;
 
 				/* Otherwise send dest unreachable */
-				sr_send_icmp_packet(sr, ip_packet_hdr, ICMP_DEST_UNREACHABLE, ICMP_DEST_PORT_UNREACHABLE_CODE);
+				sr_send_icmp_packet(sr, pkt, ICMP_DEST_UNREACHABLE, ICMP_DEST_PORT_UNREACHABLE_CODE);
                 break;
         }
     }
     else
     {
 		/* Destination is elsewhere: forward packet */
-		printf("FORWARDING IP PACKET\n");
+		sr_log_debug("FORWARDING IP PACKET\n");
 		
         struct sr_rt *rt_node = sr_search_route_table(sr, ip_packet_hdr->ip_dst);
 		if (rt_node)
 		{
-			/* Create new header */
-			int len = sizeof(sr_ethernet_hdr_t) + ntohs(ip_packet_hdr->ip_len);
-			uint8_t *buf = malloc(len);
-
-			sr_ip_hdr_t *ip_hdr_fwd = (sr_ip_hdr_t *)(buf + sizeof(sr_ethernet_hdr_t));
-			sr_ethernet_hdr_t *ether_hdr_fwd = (sr_ethernet_hdr_t *)buf;
-			memcpy(ip_hdr_fwd, ip_packet_hdr, ntohs(ip_packet_hdr->ip_len));
-
-
+			/* Rewrite the received frame in place.  The buffer belongs to
+			   sr_vns_comm.c and has room for the VNS header in front, so it
+			   can go straight back out; only the ARP queue keeps a copy. */
+			unsigned int fwd_len = sizeof(sr_ethernet_hdr_t) + ntohs(ip_packet_hdr->ip_len);
+			uint8_t *buf = pkt->frame;
+
+			if (fwd_len > len) {
+				sr_log_debug("IP length exceeds frame, dropping\n");
+				return;
+			}
 
-			/* Decrement, calculate new checksum, forward */
+			struct sr_if *outgoing = rt_node->out;
 
-			ip_hdr_fwd->ip_ttl--;
-			
-			/* Check if TTL is 0 after decrementing, in which case we drop
-			the packet instead and send an icmp */
-			
-			if (ip_hdr_fwd->ip_ttl <= 0) {
-				sr_send_icmp_packet(sr, ip_hdr_fwd, ICMP_TIME_EXCEEDED, ICMP_TIME_EXCEEDED_CODE);
-				return;
+			/* NAT: inside to outside is translated on the way; outside
+			   hosts only reach inside ones through a mapping */
+			if (sr->nat_enabled && ether_if->nat_inside != outgoing->nat_inside) {
+				if (ether_if->nat_inside) {
+					if (sr_nat_translate(&sr->nat, ip_packet_hdr, fwd_len - sizeof(sr_ethernet_hdr_t),
+					                     SR_NAT_OUTBOUND) != SR_NAT_OK) {
+						sr_log_debug("NAT: dropping outbound packet\n");
+						return;
+					}
+				} else if (!nat_inbound) {
+					sr_log_debug("NAT: dropping unsolicited packet for the inside\n");
+					return;
+				}
 			}
 
-			ip_hdr_fwd->ip_sum = 0;
-			ip_hdr_fwd->ip_sum = cksum(ip_hdr_fwd, ip_hdr_fwd->ip_hl * 4);
+			/* Decrement, update the checksum, forward.  TTL > 1 was
+			   checked above so it cannot reach 0 here. */
+
+			ip_decrement_ttl(ip_packet_hdr);
 
-			struct sr_arpentry *entry = sr_arpcache_lookup(&sr->cache, rt_node->gw.s_addr);
-			struct sr_if *outgoing = sr_get_interface(sr, rt_node->interface);
+			unsigned char next_hop_mac[ETHER_ADDR_LEN];
 		
-			printf("Got our arp entry!\n");
-			if (entry) {
-				printf("Foward packet to the next hop!\n");
+			if (sr_arpcache_lookup_mac(&sr->cache, rt_node->gw.s_addr, next_hop_mac)) {
+				sr_log_debug("Foward packet to the next hop!\n");
 				
-				set_eth_header((uint8_t *)ether_hdr_fwd, outgoing->addr, entry->mac, ethertype_ip);
+				set_eth_header(buf, outgoing->addr, next_hop_mac, ethertype_ip);
 				
-				printf("Our completed packet is:");
-				print_hdrs(buf, len);
+				sr_log_dump(print_hdrs(buf, fwd_len));
 				
-				sr_send_packet(sr, buf, len, outgoing->name);
-				free(buf);
+				sr_send_packet_inplace(sr, buf, fwd_len, outgoing->name);
 				return;
 			} else {
-				printf("SENDING ARP REQUEST TO FIND IP->MAC MAPPING.\n");
-				set_eth_header((uint8_t *)ether_hdr_fwd, outgoing->addr, (uint8_t *)EMPTY, ethertype_ip);
-				printf("Our packet with dest empty is is:");
-				print_hdrs(buf, len);
+				sr_log_debug("SENDING ARP REQUEST TO FIND IP->MAC MAPPING.\n");
+				set_eth_header(buf, outgoing->addr, (uint8_t *)EMPTY, ethertype_ip);
+				sr_log_dump(print_hdrs(buf, fwd_len));
 				
-				struct sr_arpreq * req = sr_arpcache_queuereq(&sr->cache, rt_node->gw.s_addr, buf, len, rt_node->interface);
-				handle_arpreq(sr, req);
+				/* the queue keeps a copy of the frame */
+				struct sr_pbuf * copy = sr_pbuf_copy(buf, fwd_len);
+				sr_arpcache_queuereq_send(sr, rt_node->gw.s_addr, copy, outgoing);
+				sr_pbuf_free(copy);
 			}
 		}
         else
         {
-			sr_send_icmp_packet(sr, ip_packet_hdr, ICMP_DEST_UNREACHABLE, ICMP_DEST_PORT_UNREACHABLE_CODE);
+			sr_send_icmp_packet(sr, pkt, ICMP_DEST_UNREACHABLE, ICMP_DEST_PORT_UNREACHABLE_CODE);
 
         }
     }
@@ -419,7 +602,14 @@ int sr_check_arp_send(struct sr_instance *sr,
 	}
 
 	unsigned int frame_length = sizeof(sr_ethernet_hdr_t) + len;
-	sr_ethernet_hdr_t * frame = (sr_ethernet_hdr_t *)malloc(frame_length);
+	struct sr_pbuf * pb = frame_length <= SR_PBUF_ROOM ? sr_pbuf_alloc() : NULL;
+	int ret = 0;
+	if (!pb) {
+		sr_log_warn("No packet buffer for a %u byte frame\n", frame_length);
+		return -1;
+	}
+	sr_ethernet_hdr_t * frame = (sr_ethernet_hdr_t *)pb->data;
+	pb->len = frame_length;
 	frame->ether_type = htons(ethertype_ip);
 	memcpy((uint8_t *)frame + sizeof(sr_ethernet_hdr_t), ip_packet, len);
 	memcpy(frame->ether_shost, local_interface->addr, ETHER_ADDR_LEN);
@@ -427,21 +617,16 @@ int sr_check_arp_send(struct sr_instance *sr,
 	uint32_t ip_to_arp = sr_search_interface_by_ip(sr, rt_entry->gw.s_addr) ?
 		ip_packet->ip_dst : rt_entry->gw.s_addr;
 
-	struct sr_arpentry * entry = sr_arpcache_lookup(
-		&sr->cache, ip_to_arp);
-	if (entry) {
-		memcpy(frame->ether_dhost, entry->mac, ETHER_ADDR_LEN);
-		free(entry);
+	if (sr_arpcache_lookup_mac(&sr->cache, ip_to_arp, frame->ether_dhost)) {
 		/*print_hdrs((uint8_t *)frame, frame_length);
 		*/
-		return sr_send_packet(sr, (uint8_t *)frame, frame_length, interface);
+		ret = sr_send_pbuf(sr, pb, interface);
 	}
 	else {
-		struct sr_arpreq * req = sr_arpcache_queuereq(&sr->cache,
-			ip_packet->ip_dst, (uint8_t *)frame, frame_length, interface);
-		handle_arpreq(sr, req);
-		return 0;
+		sr_arpcache_queuereq_send(sr, ip_packet->ip_dst, pb, local_interface);
 	}
+	sr_pbuf_free(pb);
+	return ret;
 }
 
 void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t src, uint32_t dst) {
@@ -476,9 +661,12 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
  *---------------------------------------------------------------------*/
 
 
- void sr_handleARP(struct sr_instance* sr, sr_ethernet_hdr_t *ether_hdr, struct sr_if *sr_ether_if, sr_arp_hdr_t *arp_hdr) {
+ void sr_handleARP(struct sr_instance* sr, struct sr_pkt *pkt) {
 
 	/* Handles ARP requests and ARP replies */
+
+	sr_ethernet_hdr_t *ether_hdr = (sr_ethernet_hdr_t *)pkt->frame;
+	sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(pkt->frame + pkt->l3);
 	
 	/* Opcode check: Request, reply, or neither */
 	switch (ntohs(arp_hdr->ar_op)) {
@@ -486,7 +674,7 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 
 			/* ARP request  */
 
-			printf("ARP REQUEST\n");
+			sr_log_debug("ARP REQUEST\n");
 
 			/* Check if the request is for this routers IP */
 			struct sr_if *router_if = sr_search_interface_by_ip(sr, arp_hdr->ar_tip);
@@ -500,9 +688,15 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 				}
 				*/ 
 				
-				printf("Sending a reply back to sender IP address\n");
+				sr_log_debug("Sending a reply back to sender IP address\n");
 				unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-				uint8_t *packet = malloc(len);
+				struct sr_pbuf *pb = sr_pbuf_alloc();
+				if (!pb) {
+					sr_log_warn("No packet buffer for an ARP reply\n");
+					break;
+				}
+				uint8_t *packet = pb->data;
+				pb->len = len;
 
 				/* Set up Ethernet header */
 
@@ -512,14 +706,14 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 
 				set_arp_header(packet+sizeof(sr_ethernet_hdr_t), arp_op_reply, router_if->addr, router_if->ip, arp_hdr->ar_sha, arp_hdr->ar_sip);
 
-				print_hdrs(packet, len);
+				sr_log_dump(print_hdrs(packet, len));
 
 				/* Send packet and free the packet from memory */
-				if (sr_send_packet(sr, packet, len, router_if->name) == -1) {
-					printf ("\n\n\nSENDING FAILED\n\n\n");
+				if (sr_send_pbuf(sr, pb, router_if->name) == -1) {
+					sr_log_warn("Sending ARP reply failed\n");
 				}
 				
-				free(packet);
+				sr_pbuf_free(pb);
 			}
 			break;
 
@@ -527,7 +721,7 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 
 			/* ARP reply */
 			
-			printf("ARP reply to %lu\n", (unsigned long)arp_hdr->ar_sip);
+			sr_log_debug("ARP reply to %lu\n", (unsigned long)arp_hdr->ar_sip);
 
 			/* Queue the packet for this IP */
 
@@ -545,8 +739,8 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 			
 			if (cached) {
 				for (to_send_packet = cached->packets; to_send_packet != NULL; to_send_packet = to_send_packet->next) {
-					printf("\n\n????????SENDING FOR THE IP: \n");
-					print_addr_ip_int(arp_hdr->ar_sip);
+					sr_log_debug("Sending queued packet\n");
+					sr_log_dump(print_addr_ip_int(ntohl(arp_hdr->ar_sip)));
 					/*
 					uint8_t *buf = malloc(sizeof(uint8_t) * packet->len);
 
@@ -560,10 +754,10 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 					sr_ethernet_hdr_t * ether_frame =
 						(sr_ethernet_hdr_t *)to_send_packet->buf;			
 					memcpy(ether_frame->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-					print_hdr_eth((uint8_t *)ether_frame);
-					if (sr_send_packet(sr, to_send_packet->buf, to_send_packet->len, to_send_packet->iface) == -1) {
+					sr_log_dump(print_hdr_eth((uint8_t *)ether_frame));
+					if (sr_send_pbuf(sr, to_send_packet->pb, to_send_packet->iface->name) == -1) {
 
-						printf ("\n\n\nSENDING FAILED AT ARP REPLY\n\n\n");
+						sr_log_warn("Sending queued packet failed\n");
 
 					}
 
@@ -583,7 +777,7 @@ void set_ip_header(uint8_t *packet, unsigned int len, uint8_t protocol, uint32_t
 
 		default:
 
-			printf("Incorrect ARP opcode. Only ARP requests and replies are handled.\n");
+			sr_log_debug("Incorrect ARP opcode. Only ARP requests and replies are handled.\n");
 
 	}
 	return;
@@ -616,7 +810,13 @@ void send_arp_request(struct sr_instance *sr, struct sr_arpreq *dest, struct sr_
 
 	/* Send the ARP request to the Gateway. Has to have MAC address ff-ff-ff-ff (broadcast) */
 	unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-	uint8_t *packet = malloc(len);
+	struct sr_pbuf *pb = sr_pbuf_alloc();
+	if (!pb) {
+		sr_log_warn("No packet buffer for an ARP request\n");
+		return;
+	}
+	uint8_t *packet = pb->data;
+	pb->len = len;
 
 	/* Set the ARP Header */
 	set_arp_header(packet + sizeof(sr_ethernet_hdr_t), arp_op_request, src->addr, src->ip, (unsigned char *)BROADCAST, dest->ip); 
@@ -626,8 +826,8 @@ void send_arp_request(struct sr_instance *sr, struct sr_arpreq *dest, struct sr_
 	set_eth_header(packet, src->addr, (unsigned char *)BROADCAST, ethertype_arp);
 
 	/* Send the packet */
-	sr_send_packet(sr, packet, len, src->name);
-	free(packet);
+	sr_send_pbuf(sr, pb, src->name);
+	sr_pbuf_free(pb);
 }
 
 
@@ -650,9 +850,6 @@ int get_icmp_len(uint8_t type, uint8_t code, sr_ip_hdr_t *orig_ip_hdr) {
 
 	differs for every type */
 	
-	printf("%lu is icmp3, %lu is icmp. Our result is %lu.\n",sizeof(sr_icmp_t3_hdr_t),
-	sizeof(icmp_hdr_t), type == ICMP_DEST_UNREACHABLE ? sizeof(sr_icmp_t3_hdr_t) : sizeof(icmp_hdr_t));
-
 	return type == ICMP_DEST_UNREACHABLE ? sizeof(sr_icmp_t3_hdr_t) : sizeof(icmp_hdr_t); 
 }
 
@@ -713,17 +910,18 @@ void create_icmp(uint8_t *packet, uint8_t type, uint8_t code, sr_ip_hdr_t *orig_
 
 
 
-void sr_send_icmp_packet(struct sr_instance *sr, sr_ip_hdr_t * ip_packet_hdr, uint8_t icmp_type, uint8_t icmp_code) {
+void sr_send_icmp_packet(struct sr_instance *sr, struct sr_pkt *pkt, uint8_t icmp_type, uint8_t icmp_code) {
+
+	/* Sends an ICMP packet about the IP packet pkt */
+	sr_log_debug("Start sending icmp packet.\n");
 
-	/* Sends an ICMP packet */
-	printf("Start sending icmp packet.\n");
+	sr_ip_hdr_t * ip_packet_hdr = (sr_ip_hdr_t *)(pkt->frame + pkt->l3);
 
 	struct sr_rt * route = sr_search_route_table(sr, ip_packet_hdr->ip_src);
 
 	if(route) {
-		struct sr_if * local_if = sr_get_interface(sr, route->interface);
-		
-		printf("Got our interface!\n");
+		struct sr_if * local_if = route->out;
+
 
 		if (!local_if) {
 			perror("Invalid interface");
@@ -733,32 +931,36 @@ void sr_send_icmp_packet(struct sr_instance *sr, sr_ip_hdr_t * ip_packet_hdr, ui
 		unsigned int icmp_len;
 		unsigned int len;
 		uint8_t *icmp;
+		struct sr_pbuf *pb = sr_pbuf_alloc();
+
+		if (!pb) {
+			sr_log_warn("No packet buffer for an ICMP message\n");
+			return;
+		}
 		
-		printf ("We are trying to send an ICMP message of type: %u", icmp_type);
+		sr_log_debug("Sending an ICMP message of type: %u\n", icmp_type);
 
         switch(icmp_type)
 		{
             case ICMP_ECHO: ; 
 			
-				printf ("Checking our received ICMP header.\n");
-
 				/* Get the ICMP header we received */
-				icmp_hdr_t *icmp_hdr = (icmp_hdr_t *) ((uint8_t *)ip_packet_hdr + ip_packet_hdr->ip_hl*4);
+				icmp_hdr_t *icmp_hdr = (icmp_hdr_t *)(pkt->frame + pkt->l4);
 
 				/* Get the ICMP length*/
 				icmp_len = get_icmp_len(icmp_type, icmp_code, ip_packet_hdr);
 
 				/* Check the ICMP checksum as well */
 				if (!validate_checksum((uint8_t *)icmp_hdr, icmp_len, ip_protocol_icmp)) {
-					printf("INVALID ICMP\n");
+					sr_log_debug("INVALID ICMP\n");
+					sr_pbuf_free(pb);
 					return;
 				}
 				
-				printf ("All good. Creating a reply.\n");
-
 				/* Create ICMP reply*/
 				len = icmp_len + sizeof(sr_ethernet_hdr_t) +  sizeof(sr_ip_hdr_t);
-				icmp = malloc(len); /*allocate memory*/
+				icmp = pb->data;
+				pb->len = len;
 
 				icmp_hdr_t *icmp_hdr_reply = (icmp_hdr_t *)(icmp + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)); /*create ICMP reply*/
 
@@ -798,27 +1000,18 @@ void sr_send_icmp_packet(struct sr_instance *sr, sr_ip_hdr_t * ip_packet_hdr, ui
 
 				/* Otherwise handle DEST UNREACHABLE and TIME EXCEEDED the same way*/
 				
-				printf("Creating an ICMP(dest unreachable or time exceeded)\n");
+				sr_log_debug("Creating an ICMP(dest unreachable or time exceeded)\n");
 
 				icmp_len = get_icmp_len(icmp_type, icmp_code, ip_packet_hdr);
-				printf("%ud is icmp len but we need,", icmp_len);
-				printf("%lu len.,", sizeof(sr_icmp_t3_hdr_t));
-				printf ("Wtf is going on here\n");
-				printf("We need %ud total len.", icmp_len + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 				len = icmp_len + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
-				printf ("Whatttttttt\n");
-				printf("We need %ud icmp len.", icmp_len);
-				printf("We need %ud len.", len);
-				icmp = malloc(len);
+				icmp = pb->data;
+				pb->len = len;
 
-				
-				printf("We need %ud memory.", len);
 				/* Set the Ethernet header information 
 
 				set_eth_header(icmp, ether_hdr->ether_dhost, ether_hdr->ether_shost, ethertype_ip);
 				*/
-				
-				printf("Set our ethernet header!\n");
+
 
 				/* Set IP information 
 
@@ -851,28 +1044,23 @@ void sr_send_icmp_packet(struct sr_instance *sr, sr_ip_hdr_t * ip_packet_hdr, ui
 		/*
         struct sr_rt *entry = sr_search_route_table(sr, ip_packet_hdr->ip_src);
 		*/
-		printf("Searching for our entry!\n");
-		
-		struct sr_arpentry *entry = sr_arpcache_lookup(&sr->cache, route->gw.s_addr);
+		unsigned char next_hop_mac[ETHER_ADDR_LEN];
 		
-		printf("Got our arp entry!\n");
-        if (entry) {
-			printf("Foward packet to the next hop!\n");
-			set_eth_header(icmp, local_if->addr, entry->mac, ethertype_ip);
-			printf("Our completed ICMP packet is:");
-			print_hdrs(icmp, len);
+        if (sr_arpcache_lookup_mac(&sr->cache, route->gw.s_addr, next_hop_mac)) {
+			sr_log_debug("Foward packet to the next hop!\n");
+			set_eth_header(icmp, local_if->addr, next_hop_mac, ethertype_ip);
+			sr_log_dump(print_hdrs(icmp, len));
 			
-			sr_send_packet(sr, icmp, len, local_if->name);
-			free(icmp);
+			sr_send_pbuf(sr, pb, local_if->name);
+			sr_pbuf_free(pb);
 			return;
         } else {
-			printf("SENDING ARP REQUEST TO FIND IP->MAC MAPPING.\n");
+			sr_log_debug("SENDING ARP REQUEST TO FIND IP->MAC MAPPING.\n");
 			set_eth_header(icmp, local_if->addr, (uint8_t *)EMPTY, ethertype_ip);
-			printf("Our packet with dest empty is is:");
-			print_hdrs(icmp, len);
+			sr_log_dump(print_hdrs(icmp, len));
 			
-			struct sr_arpreq * req = sr_arpcache_queuereq(&sr->cache, route->gw.s_addr, icmp, len, local_if->name);
-			handle_arpreq(sr, req);
+			sr_arpcache_queuereq_send(sr, route->gw.s_addr, pb, local_if);
+			sr_pbuf_free(pb);
 		}
 		/*return sr_check_arp_send(sr, (sr_ip_hdr_t *)icmp+sizeof(sr_ethernet_hdr_t), len, entry, entry->interface); */
     }
@@ -901,32 +1089,11 @@ struct sr_if * sr_search_interface_by_ip(struct sr_instance *sr, uint32_t ip)
 
 {
 
-	/* Find the interface the IP address corresponds to*/
-
-	struct sr_if *interface;
-
-	
-
-	printf ("SEARCH INTERFACE BY IP\n");
-
-	print_addr_ip_int(ip);
-
-	
-
-	for (interface = sr->if_list; interface != NULL; interface = interface->next) {
-
-		if (interface->ip == (ip)) { 
-
-			break;
-
-		}
-
-	}
-
-	
-
-	return interface;
+	/* Find the interface the IP address corresponds to, in the
+	   address table (sr_if.c) */
+	const struct sr_if_addr *local = sr_if_addr_lookup(sr, ip);
 
+	return local ? local->iface : NULL;
 }
 
 
@@ -935,29 +1102,17 @@ struct sr_rt * sr_search_route_table(struct sr_instance *sr,uint32_t ip)
 
 {
 
-	/* Searches the routing table for the node containing the IP address */
-
-    struct sr_rt * entry = sr->routing_table;
-
-    struct sr_rt * match = 0;
-
-    while(entry){
+	/* Searches the routing table for the node containing the IP address.
 
-        if((entry->dest.s_addr & entry->mask.s_addr) == (ip & entry->mask.s_addr)){
+	   Use the compiled FIB when there is one, otherwise walk the list */
 
-            if(! match || entry->mask.s_addr > match->mask.s_addr){
+	if (sr->fib.tbl16) {
 
-            match = entry;
+		return sr_fib_lookup(&sr->fib, ip);
 
-            }
-
-        }
-
-        entry = entry->next;
-
-    }
+	}
 
-    return match;
+	return sr_rt_lookup_linear(sr->routing_table, ip);
 
 }
 
@@ -979,26 +1134,10 @@ struct sr_rt * sr_search_route_table(struct sr_instance *sr,uint32_t ip)
 
  int validate_checksum(uint8_t *buf, unsigned int len, uint16_t protocol) {
 
-	/* Validate checksum */
-	
-	uint8_t *packet = malloc(len);
-	memcpy(packet, buf, len);
-	unsigned int result = 0;
-
-	switch(protocol){
-		case ethertype_ip: ;
-			sr_ip_hdr_t *ip_packet = (sr_ip_hdr_t *)packet;
-			ip_packet->ip_sum = 0;
-			result = (((sr_ip_hdr_t *)buf)->ip_sum != cksum(ip_packet, len)) ? 0:1;
-			break;
-
-		case ip_protocol_icmp: ;
-			icmp_hdr_t *icmp_packet = (icmp_hdr_t *)packet;
-			icmp_packet->icmp_sum = 0;
-			result = (((icmp_hdr_t *)icmp_packet)->icmp_sum != cksum(icmp_packet, len)) ? 0:1;
-			break;
-	}
+	/* Validate checksum.  IP and ICMP both use the ones' complement sum
+	   over the header with the checksum field included, so this is the
+	   same check for either protocol and needs no scratch copy. */
 
-	free (packet);
-	return result;
+	(void)protocol;
+	return cksum_verify(buf, len);
  }
@@ -11,10 +11,15 @@
 
 #include <netinet/in.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <stdio.h>
 
 #include "sr_protocol.h"
+#include "sr_if.h"
 #include "sr_arpcache.h"
+#include "sr_fib.h"
+#include "sr_nat.h"
+#include "sr_pbuf.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -46,6 +51,89 @@
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_io_ops;
+struct sr_vec;
+struct sr_pkt;
+
+/* bytes of VNS stream taken in per recv(); holds many frames, and always
+   at least one of the largest command accepted (10000 bytes) */
+#define SR_RX_BUF_SZ (128 * 1024)
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rx_buf
+ *
+ * Receive buffer for the VNS connection.  Each recv() takes whatever the
+ * socket has room for, and every whole command in it is handled where it
+ * lies; a partial one at the end is moved to the front before the next
+ * recv().  With -V the frames are gathered into vec and handed to the
+ * router together, up to SR_VEC_MAX at a time.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_rx_buf
+{
+    uint8_t* data;              /* SR_RX_BUF_SZ bytes, from the first read */
+    unsigned int head;          /* first byte not yet handled */
+    unsigned int tail;          /* end of what has been received */
+    unsigned long reads;        /* recv() calls */
+    unsigned long packets;      /* VNSPACKETs handed to the router */
+    struct sr_vec* vec;         /* frames not yet handed over, with -V */
+};
+
+/* frames one send batch holds before it is written out early */
+#define SR_TX_BATCH 64
+
+/* ----------------------------------------------------------------------------
+ * struct sr_tx_batch
+ *
+ * Send batching for the VNS connection (-B).  While the reading thread
+ * handles what one recv() brought in, the frames it sends are queued and
+ * go out together with one writev() when it is done.  Frames sent in
+ * place are queued where they lie in the receive buffer, frames in a
+ * packet buffer are queued with a reference held until the write, and
+ * others are copied into a packet buffer first.  Frames from any other
+ * thread (the ARP sweeper) are written straight away.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_tx_batch
+{
+    int enabled;
+    int active;                 /* a batch is open on owner */
+    pthread_t owner;
+    unsigned int n;             /* frames queued */
+    struct iovec iov[SR_TX_BATCH];
+    struct sr_pbuf* held[SR_TX_BATCH]; /* buffers of queued frames */
+    unsigned int nheld;
+    pthread_mutex_t lock;       /* held for each write to the server */
+    unsigned long writes;       /* write()/writev() calls */
+    unsigned long frames;       /* frames written */
+};
+
+#define SR_NAT_MAX_INSIDE 8
+
+/* ----------------------------------------------------------------------------
+ * struct sr_nat_opts
+ *
+ * NAT settings from the command line.  Interfaces only exist once the
+ * server has sent HWINFO, so they are kept here until then and applied
+ * by sr_start_nat.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_nat_opts
+{
+    int enabled;
+    char* inside[SR_NAT_MAX_INSIDE]; /* interface names facing the private side */
+    int ninside;
+    int icmp_timeout;
+    int tcp_est_timeout;
+    int tcp_trans_timeout;
+    int udp_timeout;
+};
+
+struct sr_dump_async;
+struct sr_engine;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -63,38 +151,55 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
+    struct sr_if_table ifs;     /* the same by id and name */
     struct sr_rt* routing_table; /* routing table */
+    struct sr_fib fib;          /* compiled routing table */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
     FILE* logfile;
+    struct sr_dump_async* logq; /* writer thread for logfile, 0 to write inline */
+    const struct sr_io_ops* io;  /* packet backend, 0 for the VNS server */
+    void* io_data;
+    int nat_enabled;            /* translate between inside and outside */
+    struct sr_nat_opts nat_opts; /* -n settings, applied by sr_start_nat */
+    struct sr_nat nat;
+    struct sr_rx_buf rx;        /* VNS receive buffer */
+    struct sr_tx_batch tx;      /* VNS send batching */
+    struct sr_engine* engine;   /* worker threads, 0 to handle input inline */
+    int vector;                 /* input goes to sr_handlepacket_vec (-V) */
 };
 
-/* -- sr_main.c -- */
+/* -- sr_rt.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_inplace(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_pbuf(struct sr_instance* , struct sr_pbuf* , const char*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
+int  sr_enable_nat(struct sr_instance* , char** , int );
+int  sr_start_nat(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_handle_pkt(struct sr_instance* , struct sr_pkt* );
 
-void sr_handleARP(struct sr_instance*, sr_ethernet_hdr_t *, struct sr_if *, struct sr_arp_hdr *);
+void sr_handleARP(struct sr_instance*, struct sr_pkt *);
 void set_arp_header(uint8_t *, unsigned short, unsigned char *, uint32_t, unsigned char *, uint32_t);
 void send_arp_request(struct sr_instance *, struct sr_arpreq *, struct sr_if *);
 
 void set_eth_header(uint8_t *, uint8_t *, uint8_t *, uint16_t);
 
-void sr_handleIP(struct sr_instance*, struct sr_ip_hdr *, unsigned int, sr_ethernet_hdr_t *, struct sr_if *);
+void sr_handleIP(struct sr_instance*, struct sr_pkt *);
 void set_ip_header(uint8_t *, unsigned int, uint8_t, uint32_t, uint32_t);
 
 int get_icmp_len(uint8_t, uint8_t, sr_ip_hdr_t *);
 void create_icmp(uint8_t *, uint8_t, uint8_t, sr_ip_hdr_t *, unsigned int);
 
 void sr_handle_icmp(struct sr_instance* sr, uint8_t * packet,unsigned int len, char* interface);
-void sr_send_icmp_packet(struct sr_instance *, sr_ip_hdr_t *, uint8_t, uint8_t);
+void sr_send_icmp_packet(struct sr_instance *, struct sr_pkt *, uint8_t, uint8_t);
 
 struct sr_if * sr_search_interface_by_ip(struct sr_instance *sr, uint32_t ip);
 struct sr_rt * sr_search_route_table(struct sr_instance * sr,uint32_t ip);
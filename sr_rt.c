@@ -82,6 +82,10 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
         sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
     } /* -- while -- */
 
+    /* -- compile the table for lookups, the list is kept for printing and
+          as a fallback if it cannot be compiled -- */
+    sr_fib_build(&sr->fib, sr->routing_table);
+
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
@@ -99,6 +103,9 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     assert(if_name);
     assert(sr);
 
+    /* -- compiled table no longer matches the list -- */
+    sr_fib_destroy(&sr->fib);
+
     /* -- empty list special case -- */
     if(sr->routing_table == 0)
     {
@@ -109,6 +116,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
         sr->routing_table->gw   = gw;
         sr->routing_table->mask = mask;
         strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        sr->routing_table->out = sr_get_interface(sr, if_name);
 
         return;
     }
@@ -128,6 +136,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     rt_walker->gw   = gw;
     rt_walker->mask = mask;
     strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    rt_walker->out = sr_get_interface(sr, if_name);
 
 } /* -- sr_add_entry -- */
 
@@ -176,3 +185,73 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\n",entry->interface);
 
 } /* -- sr_print_routing_entry -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_verify_routing_table()
+ * Scope: Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware.  Entries added before the interfaces were known get
+ * theirs here.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    {
+        return 999; /* doh! */
+    }
+
+    rt_walker = sr->routing_table;
+
+    while(rt_walker)
+    {
+        /* -- check to see if interface exists -- */
+        rt_walker->out = sr_get_interface(sr, rt_walker->interface);
+        if(rt_walker->out == 0)
+        { ret++; } /* -- interface not found! -- */
+
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_lookup_linear(..)
+ * Scope:  Global
+ *
+ * Longest prefix match by walking the routing table list.  Used when the
+ * table has not been compiled into a FIB.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_rt_lookup_linear(struct sr_rt* rt, uint32_t ip)
+{
+    struct sr_rt* match = 0;
+
+    while(rt)
+    {
+        if((rt->dest.s_addr & rt->mask.s_addr) == (ip & rt->mask.s_addr))
+        {
+            if(! match || rt->mask.s_addr > match->mask.s_addr)
+            { match = rt; }
+        }
+        rt = rt->next;
+    }
+
+    return match;
+} /* -- sr_rt_lookup_linear -- */
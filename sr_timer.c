@@ -0,0 +1,193 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel (see sr_timer.h).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+
+#include "sr_timer.h"
+
+#define SR_TIMER_L1_SHIFT  SR_TIMER_L0_BITS
+#define SR_TIMER_L2_SHIFT  (SR_TIMER_L0_BITS + SR_TIMER_LN_BITS)
+
+static void sr_timer_list_init(struct sr_timer* head)
+{
+    head->next = head->prev = head;
+} /* -- sr_timer_list_init -- */
+
+static void sr_timer_unlink(struct sr_timer* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = 0;
+} /* -- sr_timer_unlink -- */
+
+/* Move every timer on from onto the (empty) list to. */
+static void sr_timer_splice(struct sr_timer* from, struct sr_timer* to)
+{
+    if (from->next == from)
+    { return; }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    sr_timer_list_init(from);
+} /* -- sr_timer_splice -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_place(..)
+ * Scope:  Local
+ *
+ * Puts timer on the slot its expiry falls in, relative to the tick the
+ * wheel runs next.  Overdue timers go on the next slot to run.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_timer_place(struct sr_timer_wheel* wheel, struct sr_timer* timer)
+{
+    struct sr_timer* head;
+    time_t expires = timer->expires;
+    time_t delta = expires - wheel->now;
+
+    if (delta < 0)
+    { head = &wheel->l0[wheel->now & (SR_TIMER_L0_SZ - 1)]; }
+    else if (delta < SR_TIMER_L0_SZ)
+    { head = &wheel->l0[expires & (SR_TIMER_L0_SZ - 1)]; }
+    else if (delta < (1L << SR_TIMER_L2_SHIFT))
+    { head = &wheel->l1[(expires >> SR_TIMER_L1_SHIFT) & (SR_TIMER_LN_SZ - 1)]; }
+    else
+    {
+        if (delta > SR_TIMER_MAX)
+        { timer->expires = expires = wheel->now + SR_TIMER_MAX; }
+        head = &wheel->l2[(expires >> SR_TIMER_L2_SHIFT) & (SR_TIMER_LN_SZ - 1)];
+    }
+
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+} /* -- sr_timer_place -- */
+
+/* Redistribute one slot of an upper level over the levels below. */
+static void sr_timer_cascade(struct sr_timer_wheel* wheel, struct sr_timer* slot)
+{
+    struct sr_timer list;
+    struct sr_timer* timer;
+
+    sr_timer_list_init(&list);
+    sr_timer_splice(slot, &list);
+
+    while (list.next != &list)
+    {
+        timer = list.next;
+        sr_timer_unlink(timer);
+        sr_timer_place(wheel, timer);
+    }
+} /* -- sr_timer_cascade -- */
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel, time_t now)
+{
+    int i;
+
+    wheel->now = now;
+    wheel->pending = 0;
+    for (i = 0; i < SR_TIMER_L0_SZ; i++)
+    { sr_timer_list_init(&wheel->l0[i]); }
+    for (i = 0; i < SR_TIMER_LN_SZ; i++)
+    {
+        sr_timer_list_init(&wheel->l1[i]);
+        sr_timer_list_init(&wheel->l2[i]);
+    }
+} /* -- sr_timer_wheel_init -- */
+
+void sr_timer_init(struct sr_timer* timer, sr_timer_fn fn, void* data)
+{
+    timer->next = timer->prev = 0;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->data = data;
+} /* -- sr_timer_init -- */
+
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  time_t expires)
+{
+    if (timer->next)
+    { sr_timer_unlink(timer); }
+    else
+    { wheel->pending++; }
+
+    timer->expires = expires;
+    sr_timer_place(wheel, timer);
+} /* -- sr_timer_add -- */
+
+void sr_timer_del(struct sr_timer_wheel* wheel, struct sr_timer* timer)
+{
+    if (!timer->next)
+    { return; }
+
+    sr_timer_unlink(timer);
+    assert(wheel->pending > 0);
+    wheel->pending--;
+} /* -- sr_timer_del -- */
+
+int sr_timer_pending(const struct sr_timer* timer)
+{
+    return timer->next != 0;
+} /* -- sr_timer_pending -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_advance(..)
+ * Scope:  Global
+ *
+ * Runs the wheel forward to now, one tick at a time.  A tick with nothing
+ * due costs a couple of pointer compares.  The due slot is first moved to
+ * a private list so that callbacks can freely add timers, or cancel ones
+ * due in the same tick, while it is being drained.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned long sr_timer_advance(struct sr_timer_wheel* wheel, time_t now,
+                               void* arg)
+{
+    struct sr_timer due;
+    struct sr_timer* timer;
+    unsigned long fired = 0;
+    int i;
+
+    sr_timer_list_init(&due);
+
+    while (wheel->now <= now)
+    {
+        i = wheel->now & (SR_TIMER_L0_SZ - 1);
+        if (i == 0)
+        {
+            i = (wheel->now >> SR_TIMER_L1_SHIFT) & (SR_TIMER_LN_SZ - 1);
+            sr_timer_cascade(wheel, &wheel->l1[i]);
+            if (i == 0)
+            {
+                i = (wheel->now >> SR_TIMER_L2_SHIFT) & (SR_TIMER_LN_SZ - 1);
+                sr_timer_cascade(wheel, &wheel->l2[i]);
+            }
+            i = 0;
+        }
+
+        sr_timer_splice(&wheel->l0[i], &due);
+        wheel->now++;
+
+        while (due.next != &due)
+        {
+            timer = due.next;
+            sr_timer_unlink(timer);
+            wheel->pending--;
+            timer->fn(timer, arg);
+            fired++;
+        }
+    }
+
+    return fired;
+} /* -- sr_timer_advance -- */
@@ -0,0 +1,86 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel with one second ticks.  Timers are intrusive
+ * (embedded in the object they time out) and sit on doubly linked slot
+ * lists, so adding and cancelling are O(1).  Three levels cover 2^20
+ * seconds:
+ *
+ *   level 0   256 slots of 1 second        expiry < 256s away
+ *   level 1    64 slots of 256 seconds     expiry < 4.5h away
+ *   level 2    64 slots of 16384 seconds   expiry < 12 days away
+ *
+ * Advancing the wheel by one tick only touches the slot that comes due.
+ * Every 256 ticks one level 1 slot (and every 16384 ticks one level 2
+ * slot) is emptied into the level below, so each timer is moved at most
+ * twice before it fires.  The cost of sr_timer_advance() is therefore
+ * proportional to the number of timers that expire, not to the number
+ * pending.
+ *
+ * The wheel does no locking of its own; callers serialize access.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_TIMER_H
+#define sr_TIMER_H
+
+#include <time.h>
+
+#define SR_TIMER_L0_BITS  8
+#define SR_TIMER_LN_BITS  6
+#define SR_TIMER_L0_SZ    (1 << SR_TIMER_L0_BITS)
+#define SR_TIMER_LN_SZ    (1 << SR_TIMER_LN_BITS)
+
+/* farthest expiry the wheel can hold, later ones are clamped to it */
+#define SR_TIMER_MAX      ((1L << (SR_TIMER_L0_BITS + 2 * SR_TIMER_LN_BITS)) - 1)
+
+struct sr_timer;
+
+typedef void (*sr_timer_fn)(struct sr_timer* timer, void* arg);
+
+/* ----------------------------------------------------------------------------
+ * struct sr_timer
+ *
+ * One pending expiry.  next == 0 when the timer is not on the wheel.
+ * fn(timer, arg) runs from sr_timer_advance() with the timer already off
+ * the wheel; it may re-add it or add and cancel any other timer.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_timer
+{
+    struct sr_timer* next;
+    struct sr_timer* prev;
+    time_t expires;
+    sr_timer_fn fn;
+    void* data;             /* owner of the timer, for fn */
+};
+
+struct sr_timer_wheel
+{
+    time_t now;             /* next tick to run */
+    unsigned long pending;
+    struct sr_timer l0[SR_TIMER_L0_SZ];  /* list heads */
+    struct sr_timer l1[SR_TIMER_LN_SZ];
+    struct sr_timer l2[SR_TIMER_LN_SZ];
+};
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel, time_t now);
+
+void sr_timer_init(struct sr_timer* timer, sr_timer_fn fn, void* data);
+
+/* (Re)arm timer to fire at expires.  A timer already on the wheel is moved. */
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  time_t expires);
+
+void sr_timer_del(struct sr_timer_wheel* wheel, struct sr_timer* timer);
+
+int  sr_timer_pending(const struct sr_timer* timer);
+
+/* Run every timer due at or before now.  Returns the number fired. */
+unsigned long sr_timer_advance(struct sr_timer_wheel* wheel, time_t now,
+                               void* arg);
+
+#endif  /* --  sr_TIMER_H -- */
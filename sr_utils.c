@@ -1,24 +1,245 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include "sr_protocol.h"
 #include "sr_utils.h"
 
 
-uint16_t cksum (const void *_data, int len) {
-  const uint8_t *data = _data;
-  uint32_t sum;
-
-  for (sum = 0;len >= 2; data += 2, len -= 2)
-    sum += data[0] << 8 | data[1];
-  if (len > 0)
-    sum += data[0] << 8;
-  while (sum > 0xffff)
+/*
+ * Internet checksum.  The ones' complement sum does not care about byte
+ * order, so the kernels below add up native words and the folded result
+ * is already in network order.  Each kernel returns the unfolded sum;
+ * cksum() picks the widest one the CPU supports the first time it runs.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CKSUM_X86
+#include <immintrin.h>
+#endif
+
+typedef uint64_t (*cksum_sum_fn)(const uint8_t *data, int len);
+
+static uint64_t cksum_sum_scalar (const uint8_t *data, int len) {
+  uint64_t sum = 0;
+  uint64_t w64;
+  uint16_t w16;
+
+  for (; len >= 8; data += 8, len -= 8) {
+    memcpy(&w64, data, 8);
+    sum += (w64 & 0xffffffff) + (w64 >> 32);
+  }
+  for (; len >= 2; data += 2, len -= 2) {
+    memcpy(&w16, data, 2);
+    sum += w16;
+  }
+  if (len > 0) {
+    /* pad the odd byte with a zero byte after it */
+    w16 = 0;
+    memcpy(&w16, data, 1);
+    sum += w16;
+  }
+  return sum;
+}
+
+#ifdef CKSUM_X86
+
+/* 16 bit words are widened into 32 bit lanes; a lane takes at most four
+   words per step, so spill to the 64 bit total well before it can wrap */
+#define CKSUM_BLOCK_STEPS 8192
+
+__attribute__((target("sse2")))
+static uint64_t cksum_sum_sse2 (const uint8_t *data, int len) {
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t lanes[4];
+  uint64_t sum = 0;
+
+  while (len >= 32) {
+    __m128i acc = zero;
+    int steps = len / 32;
+
+    if (steps > CKSUM_BLOCK_STEPS)
+      steps = CKSUM_BLOCK_STEPS;
+    len -= steps * 32;
+    for (; steps; steps--, data += 32) {
+      __m128i v0 = _mm_loadu_si128((const __m128i *)data);
+      __m128i v1 = _mm_loadu_si128((const __m128i *)(data + 16));
+      acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v0, zero));
+      acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v0, zero));
+      acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v1, zero));
+      acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v1, zero));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  return sum + cksum_sum_scalar(data, len);
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_sum_avx2 (const uint8_t *data, int len) {
+  const __m256i zero = _mm256_setzero_si256();
+  uint32_t lanes[8];
+  uint64_t sum = 0;
+  int i;
+
+  while (len >= 64) {
+    __m256i acc = zero;
+    int steps = len / 64;
+
+    if (steps > CKSUM_BLOCK_STEPS)
+      steps = CKSUM_BLOCK_STEPS;
+    len -= steps * 64;
+    for (; steps; steps--, data += 64) {
+      __m256i v0 = _mm256_loadu_si256((const __m256i *)data);
+      __m256i v1 = _mm256_loadu_si256((const __m256i *)(data + 32));
+      acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v0, zero));
+      acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v0, zero));
+      acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v1, zero));
+      acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v1, zero));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    for (i = 0; i < 8; i++)
+      sum += lanes[i];
+  }
+  return sum + cksum_sum_scalar(data, len);
+}
+
+#endif /* CKSUM_X86 */
+
+struct cksum_impl_entry {
+  const char *name;
+  cksum_sum_fn fn;
+  int (*supported)(void);
+};
+
+static int cksum_always (void) { return 1; }
+
+#ifdef CKSUM_X86
+static int cksum_has_sse2 (void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+static int cksum_has_avx2 (void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* widest first */
+static const struct cksum_impl_entry cksum_impls[] = {
+#ifdef CKSUM_X86
+  { "avx2", cksum_sum_avx2, cksum_has_avx2 },
+  { "sse2", cksum_sum_sse2, cksum_has_sse2 },
+#endif
+  { "scalar", cksum_sum_scalar, cksum_always },
+  { 0, 0, 0 }
+};
+
+static uint64_t cksum_sum_resolve (const uint8_t *data, int len);
+
+/* a racing first call just picks the same kernel twice */
+static cksum_sum_fn cksum_sum = cksum_sum_resolve;
+static const char *cksum_sum_name = 0;
+
+static uint64_t cksum_sum_resolve (const uint8_t *data, int len) {
+  cksum_use(0);
+  return cksum_sum(data, len);
+}
+
+int cksum_use (const char *impl) {
+  const struct cksum_impl_entry *e;
+
+  for (e = cksum_impls; e->name; e++) {
+    if ((impl == 0 || strcmp(impl, e->name) == 0) && e->supported()) {
+      cksum_sum_name = e->name;
+      cksum_sum = e->fn;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *cksum_impl (void) {
+  if (!cksum_sum_name)
+    cksum_use(0);
+  return cksum_sum_name;
+}
+
+static uint16_t cksum_fold64 (uint64_t sum) {
+  while (sum >> 16)
     sum = (sum >> 16) + (sum & 0xffff);
-  sum = htons (~sum);
+  return (uint16_t)sum;
+}
+
+uint16_t cksum (const void *_data, int len) {
+  uint16_t sum = ~cksum_fold64(cksum_sum(_data, len));
+  return sum ? sum : 0xffff;
+}
+
+int cksum_verify (const void *_data, int len) {
+  return cksum_fold64(cksum_sum(_data, len)) == 0xffff;
+}
+
+static uint16_t cksum_fold (uint32_t sum) {
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = ~sum & 0xffff;
+  /* same convention as cksum: never hand out 0 */
   return sum ? sum : 0xffff;
 }
 
+uint16_t cksum_update16 (uint16_t sum, uint16_t old, uint16_t new) {
+  return cksum_fold((uint16_t)~sum + (uint16_t)~old + (uint32_t)new);
+}
+
+uint16_t cksum_update32 (uint16_t sum, uint32_t old, uint32_t new) {
+  return cksum_fold((uint16_t)~sum +
+                    (uint16_t)~(old >> 16) + (uint16_t)~(old & 0xffff) +
+                    (new >> 16) + (new & 0xffff));
+}
+
+void ip_decrement_ttl (sr_ip_hdr_t *iphdr) {
+  uint16_t old, new;
+
+  /* ttl shares its 16 bit word with ip_p */
+  memcpy(&old, &iphdr->ip_ttl, 2);
+  iphdr->ip_ttl--;
+  memcpy(&new, &iphdr->ip_ttl, 2);
+  iphdr->ip_sum = cksum_update16(iphdr->ip_sum, old, new);
+}
+
+void ip_rewrite_endpoint (sr_ip_hdr_t *iphdr, int dst, uint32_t ip, uint16_t port) {
+  uint8_t *l4 = (uint8_t *)iphdr + iphdr->ip_hl * 4;
+  uint8_t *pport = l4 + (dst ? 2 : 0); /* same place in tcp and udp */
+  uint8_t *psum = NULL;
+  uint32_t old_ip = dst ? iphdr->ip_dst : iphdr->ip_src;
+  uint16_t old_port, sum;
+
+  if (iphdr->ip_p == ip_protocol_tcp)
+    psum = l4 + offsetof(sr_tcp_hdr_t, tcp_sum);
+  else if (((sr_udp_hdr_t *)l4)->udp_sum != 0)
+    psum = l4 + offsetof(sr_udp_hdr_t, udp_sum);
+
+  memcpy(&old_port, pport, 2);
+  if (psum) {
+    memcpy(&sum, psum, 2);
+    sum = cksum_update32(sum, old_ip, ip);
+    sum = cksum_update16(sum, old_port, port);
+    /* a computed 0 goes out as all ones, 0 means "no checksum" in UDP */
+    if (sum == 0 && iphdr->ip_p == ip_protocol_udp)
+      sum = 0xffff;
+    memcpy(psum, &sum, 2);
+  }
+
+  iphdr->ip_sum = cksum_update32(iphdr->ip_sum, old_ip, ip);
+  if (dst)
+    iphdr->ip_dst = ip;
+  else
+    iphdr->ip_src = ip;
+  memcpy(pport, &port, 2);
+}
+
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
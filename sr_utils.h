@@ -30,6 +30,34 @@
 
 uint16_t cksum(const void *_data, int len);
 
+/* cksum() uses the widest kernel the CPU has ("avx2", "sse2", "scalar").
+   cksum_use(name) forces one, 0 goes back to the default; -1 if the CPU
+   lacks it.  cksum_impl() names the kernel in use. */
+int cksum_use(const char *impl);
+const char *cksum_impl(void);
+
+/* 1 if the ones' complement sum over data (checksum field included) is
+   all ones, i.e. the stored checksum is correct.  Reads data in place. */
+int cksum_verify(const void *_data, int len);
+
+/* Incremental update (RFC 1624, eqn. 3) after a 16 or 32 bit field
+   changed from old to new.  sum, old and new are taken exactly as they
+   sit in the packet, so no byte swapping is needed. */
+uint16_t cksum_update16(uint16_t sum, uint16_t old, uint16_t new);
+uint16_t cksum_update32(uint16_t sum, uint32_t old, uint32_t new);
+
+struct sr_ip_hdr;
+
+/* ip_ttl--, fixing ip_sum up incrementally */
+void ip_decrement_ttl(struct sr_ip_hdr *iphdr);
+
+/* Replace the source (dst == 0) or destination address and port of a TCP
+   or UDP packet; ip and port in network byte order.  ip_sum and the
+   transport checksum, which covers the address through the pseudo-header,
+   are fixed up incrementally.  A UDP packet sent without a checksum keeps
+   none.  The caller has checked that the transport header is there. */
+void ip_rewrite_endpoint(struct sr_ip_hdr *iphdr, int dst, uint32_t ip, uint16_t port);
+
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
 
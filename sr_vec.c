@@ -0,0 +1,214 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_vec.c
+ *
+ * Description:
+ *
+ * Vector input path (see sr_vec.h).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_vec.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_utils.h"
+#include "sr_log.h"
+
+/* how many frames ahead a stage prefetches */
+#define SR_VEC_AHEAD 4
+
+#define SR_VEC_IP(v, i) ((sr_ip_hdr_t*)((v)->pkt[i].frame + (v)->pkt[i].l3))
+
+/* Whether the frame is IPv4, whole header present, on a known interface. */
+static void sr_vec_classify(struct sr_vec* v)
+{
+    struct sr_pkt* pkt;
+    unsigned int i;
+
+    for (i = 0; i < v->n; i++)
+    {
+        if (i + SR_VEC_AHEAD < v->n)
+        { __builtin_prefetch(v->pkt[i + SR_VEC_AHEAD].frame + sizeof(sr_ethernet_hdr_t)); }
+
+        pkt = &v->pkt[i];
+        v->verdict[i] = (pkt->type == ethertype_ip && pkt->l3 && pkt->in) ?
+                        SR_VEC_FWD : SR_VEC_SCALAR;
+    }
+} /* -- sr_vec_classify -- */
+
+/* The checks sr_handleIP makes before it looks for a route, in the same
+   order, so a frame is dropped or handed over for the same reason. */
+static void sr_vec_validate(struct sr_instance* sr, struct sr_vec* v)
+{
+    sr_ip_hdr_t* ip;
+    unsigned int i;
+
+    for (i = 0; i < v->n; i++)
+    {
+        if (v->verdict[i] != SR_VEC_FWD)
+        { continue; }
+        ip = SR_VEC_IP(v, i);
+
+        if (ip->ip_ttl <= 1)
+        {
+            v->verdict[i] = SR_VEC_SCALAR;
+            continue;
+        }
+        if (!v->pkt[i].l4 ||
+            !validate_checksum((uint8_t*)ip, v->pkt[i].l4 - v->pkt[i].l3, ethertype_ip))
+        {
+            v->verdict[i] = SR_VEC_DROP;
+            continue;
+        }
+        /* NAT's external address is one of the router's too */
+        if (sr_if_addr_lookup(sr, ip->ip_dst))
+        { v->verdict[i] = SR_VEC_SCALAR; }
+    }
+} /* -- sr_vec_validate -- */
+
+/* Route and outgoing interface.  The FIB is read two frames' worth of
+   prefetch ahead: the first level entry 2 * SR_VEC_AHEAD frames on, the
+   second level entry it leads to SR_VEC_AHEAD frames on; the route found
+   is prefetched for the resolve stage. */
+static void sr_vec_lookup(struct sr_instance* sr, struct sr_vec* v)
+{
+    sr_ip_hdr_t* ip;
+    unsigned int i, ahead;
+
+    for (i = 0; i < v->n; i++)
+    {
+        ahead = i + 2 * SR_VEC_AHEAD;
+        if (ahead < v->n && v->verdict[ahead] == SR_VEC_FWD)
+        { sr_fib_prefetch(&sr->fib, SR_VEC_IP(v, ahead)->ip_dst, 0); }
+        ahead = i + SR_VEC_AHEAD;
+        if (ahead < v->n && v->verdict[ahead] == SR_VEC_FWD)
+        { sr_fib_prefetch(&sr->fib, SR_VEC_IP(v, ahead)->ip_dst, 1); }
+
+        if (v->verdict[i] != SR_VEC_FWD)
+        { continue; }
+        ip = SR_VEC_IP(v, i);
+
+        if ((v->rt[i] = sr_search_route_table(sr, ip->ip_dst)) == 0)
+        {
+            v->verdict[i] = SR_VEC_SCALAR;
+            continue;
+        }
+        __builtin_prefetch(v->rt[i]);
+
+        v->fwd_len[i] = sizeof(sr_ethernet_hdr_t) + ntohs(ip->ip_len);
+        if (v->fwd_len[i] > v->pkt[i].len)
+        {
+            v->verdict[i] = SR_VEC_DROP;
+            continue;
+        }
+
+        v->out[i] = v->rt[i]->out;
+        if (sr->nat_enabled && v->pkt[i].in->nat_inside != v->out[i]->nat_inside)
+        { v->verdict[i] = SR_VEC_SCALAR; }
+    }
+} /* -- sr_vec_lookup -- */
+
+/* Next hop MACs.  Frames in a row to the same next hop share one
+   lookup; a miss is left to the scalar path to queue. */
+static void sr_vec_resolve(struct sr_instance* sr, struct sr_vec* v)
+{
+    uint32_t gw, last_gw = 0;
+    int last = -1;
+    unsigned int i, ahead;
+
+    for (i = 0; i < v->n; i++)
+    {
+        ahead = i + SR_VEC_AHEAD;
+        if (ahead < v->n && v->verdict[ahead] == SR_VEC_FWD)
+        { sr_arpcache_prefetch(&sr->cache, v->rt[ahead]->gw.s_addr); }
+
+        if (v->verdict[i] != SR_VEC_FWD)
+        { continue; }
+
+        gw = v->rt[i]->gw.s_addr;
+        if (last >= 0 && gw == last_gw)
+        {
+            memcpy(v->mac[i], v->mac[last], ETHER_ADDR_LEN);
+            continue;
+        }
+        if (!sr_arpcache_lookup_mac(&sr->cache, gw, v->mac[i]))
+        {
+            v->verdict[i] = SR_VEC_SCALAR;
+            continue;
+        }
+        last = i;
+        last_gw = gw;
+    }
+} /* -- sr_vec_resolve -- */
+
+static void sr_vec_rewrite(struct sr_vec* v)
+{
+    unsigned int i;
+
+    for (i = 0; i < v->n; i++)
+    {
+        if (v->verdict[i] != SR_VEC_FWD)
+        { continue; }
+
+        ip_decrement_ttl(SR_VEC_IP(v, i));
+        set_eth_header(v->pkt[i].frame, v->out[i]->addr, v->mac[i], ethertype_ip);
+    }
+} /* -- sr_vec_rewrite -- */
+
+/* Everything goes out, or through sr_handle_pkt, in arrival order. */
+static void sr_vec_transmit(struct sr_instance* sr, struct sr_vec* v)
+{
+    unsigned int i;
+
+    for (i = 0; i < v->n; i++)
+    {
+        switch (v->verdict[i])
+        {
+            case SR_VEC_FWD:
+                sr_send_packet_inplace(sr, v->pkt[i].frame, v->fwd_len[i], v->out[i]->name);
+                break;
+            case SR_VEC_SCALAR:
+                sr_handle_pkt(sr, &v->pkt[i]);
+                break;
+            default:
+                break;
+        }
+    }
+} /* -- sr_vec_transmit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket_vec(..)
+ * Scope:  Global
+ *
+ * With debug logging or header dumps on every frame goes through
+ * sr_handle_pkt, which does the logging.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_handlepacket_vec(struct sr_instance* sr, struct sr_vec* v)
+{
+    unsigned int i;
+
+    if ((SR_LOG_LEVEL >= SR_LOG_DEBUG && sr_log_level >= SR_LOG_DEBUG) ||
+        sr_log_dump_rate)
+    {
+        for (i = 0; i < v->n; i++)
+        { sr_handle_pkt(sr, &v->pkt[i]); }
+        v->n = 0;
+        return;
+    }
+
+    sr_vec_classify(v);
+    sr_vec_validate(sr, v);
+    sr_vec_lookup(sr, v);
+    sr_vec_resolve(sr, v);
+    sr_vec_rewrite(v);
+    sr_vec_transmit(sr, v);
+    v->n = 0;
+} /* -- sr_handlepacket_vec -- */
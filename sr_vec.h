@@ -0,0 +1,80 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_vec.h
+ *
+ * Description:
+ *
+ * Vector input path.  sr_handlepacket_vec() takes up to SR_VEC_MAX frames
+ * at once and runs the common case, an IPv4 packet forwarded to a next
+ * hop whose MAC is cached, one stage at a time over the whole vector:
+ *
+ *   classify   receiving interface and Ethernet type, from the descriptor
+ *   validate   TTL, header checksum, local destination, NAT
+ *   lookup     longest prefix match, outgoing interface
+ *   resolve    next hop MAC from the ARP cache
+ *   rewrite    TTL and checksum, Ethernet addresses
+ *   transmit   in arrival order
+ *
+ * Each stage prefetches the headers, or the table entries, of a frame a
+ * few places ahead of the one it works on.  A frame any stage cannot
+ * finish (ARP, anything for the router, TTL expiry, no route, a NAT
+ * crossing, an ARP miss) is left untouched and goes through
+ * sr_handle_pkt in the transmit stage, at its place in the vector, so
+ * every frame is handled exactly as the scalar path would and frames go
+ * out in the order they came in.
+ *
+ * Turned on with -V, for the VNS reader and the -w workers.  It pays once
+ * the FIB and ARP cache no longer fit in cache, where the prefetches hide
+ * the misses; with a handful of routes the extra passes cost more than
+ * they save (sr_bench vector shows both).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_VEC_H
+#define sr_VEC_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+#include "sr_pkt.h"
+
+#define SR_VEC_MAX 256  /* frames per vector */
+
+struct sr_instance;
+struct sr_if;
+struct sr_rt;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vec
+ *
+ * The caller parses n frames into pkt.  The frames are lent under the
+ * same terms as to sr_handlepacket (and, like there, may be rewritten and
+ * sent in place).  The rest is the stages' scratch space.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_vec
+{
+    unsigned int n;
+    struct sr_pkt pkt[SR_VEC_MAX];
+
+    uint8_t verdict[SR_VEC_MAX];        /* SR_VEC_FWD, _SCALAR or _DROP */
+    struct sr_if* out[SR_VEC_MAX];
+    struct sr_rt* rt[SR_VEC_MAX];
+    unsigned int fwd_len[SR_VEC_MAX];
+    uint8_t mac[SR_VEC_MAX][ETHER_ADDR_LEN];
+};
+
+#define SR_VEC_FWD    0   /* still on the vector path */
+#define SR_VEC_SCALAR 1   /* left for sr_handle_pkt */
+#define SR_VEC_DROP   2   /* dropped, as sr_handlepacket would */
+
+/* Handle v->n frames, then set v->n to 0. */
+void sr_handlepacket_vec(struct sr_instance* sr, struct sr_vec* v);
+
+#endif /* -- sr_VEC_H -- */
@@ -35,21 +35,27 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_io.h"
+#include "sr_engine.h"
+#include "sr_vec.h"
+#include "sr_pkt.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
 static void sr_log_packet(struct sr_instance* , uint8_t* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
-                                  unsigned int len,
-                                  char* interface  /* lent */);
+                                  struct sr_pkt* pkt);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static void sr_tx_begin(struct sr_instance* sr);
+static int  sr_tx_end(struct sr_instance* sr);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -331,80 +337,95 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
     return sr_read_from_server_expect(sr, 0);
 }
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_command_len(..)
+ * Scope: Local
+ *
+ * Length of the command at the head of the receive buffer if all of it
+ * is there, 0 if more has to be read, -1 if the length is bogus.
+ *
+ *---------------------------------------------------------------------------*/
 
-    /* REQUIRES */
-    assert(sr);
+static int sr_rx_command_len(struct sr_rx_buf* rx)
+{
+    uint32_t len;
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+    if ( rx->tail - rx->head < 4 )
+    { return 0; }
 
-    bytes_read = 0;
+    memcpy(&len, rx->data + rx->head, 4);
+    len = ntohl(len);
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+    if ( len > 10000 || len < 8 )
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
+        fprintf(stderr,"Error: bad command length %u\n",len);
+        return -1;
+    }
 
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
+    return ( rx->tail - rx->head < len ) ? 0 : (int)len;
+} /* -- sr_rx_command_len -- */
 
-    }
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_fill(..)
+ * Scope: Local
+ *
+ * Move what is left of the buffer (at most one partial command) to the
+ * front and recv() as much as fits behind it.  Returns the bytes read,
+ * 0 if the server closed the connection, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
 
-    len = ntohl(len);
+static int sr_rx_fill(struct sr_instance* sr)
+{
+    struct sr_rx_buf* rx = &sr->rx;
+    int ret;
 
-    if ( len > 10000 || len < 0 )
+    if ( rx->head )
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
+        memmove(rx->data, rx->data + rx->head, rx->tail - rx->head);
+        rx->tail -= rx->head;
+        rx->head = 0;
     }
 
-    if((buf = malloc(len)) == 0)
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        rx->reads++;
+        ret = recv(sr->sockfd, rx->data + rx->tail, SR_RX_BUF_SZ - rx->tail, 0);
+    } while ( ret == -1 && errno == EINTR ); /* be mindful of signals */
+
+    if ( ret == -1 )
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        perror("recv(..):sr_client.c::sr_read_from_server");
         return -1;
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    rx->tail += ret;
+    return ret;
+} /* -- sr_rx_fill -- */
 
-    bytes_read = 0;
+/* Hand the frames gathered so far to the router. */
+static void sr_rx_flush(struct sr_instance* sr)
+{
+    if ( sr->rx.vec && sr->rx.vec->n )
+    { sr_handlepacket_vec(sr, sr->rx.vec); }
+} /* -- sr_rx_flush -- */
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: Local
+ *
+ * Act on one command of len bytes, in place in the receive buffer.
+ * Returns 1 to go on, 0 if the server closed the session, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_handle_command(struct sr_instance* sr, uint8_t* buf, int len,
+                             int expected_cmd)
+{
+    int command, ret;
+    c_packet_ethernet_header* sr_pkt = 0;
+    struct sr_vec* vec = sr->rx.vec;
+    struct sr_pkt one, *pkt;
 
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
@@ -418,6 +439,10 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         }
     }
 
+    /* frames before anything else are handled before it */
+    if ( command != VNSPACKET )
+    { sr_rx_flush(sr); }
+
     ret = 1;
     switch (command)
     {
@@ -426,12 +451,15 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
+            /* -- parse it once, when gathering straight into the vector -- */
+            pkt = ( sr->engine == 0 && vec ) ? &vec->pkt[vec->n] : &one;
+            sr_pkt_parse(pkt, buf + sizeof(c_packet_header),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
+                    sr_get_interface(sr, (char*)(buf + sizeof(c_base))));
+
+            /* -- check if it is an ARP to another router if so drop   -- */
+            if ( sr_arp_req_not_for_us(sr, pkt) )
             { break; }
 
             /* -- log packet -- */
@@ -439,11 +467,16 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
                     ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
 
             /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+            sr->rx.packets++;
+            if ( pkt == &one )
+            {
+                sr_engine_input(sr, pkt);
+                break;
+            }
+
+            /* -- or keep it gathered; it stays put until the next recv() -- */
+            if ( ++vec->n == SR_VEC_MAX )
+            { sr_rx_flush(sr); }
 
             break;
 
@@ -454,8 +487,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
 
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -474,6 +505,11 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
                 fprintf(stderr,"Routing table not consistent with hardware\n");
                 return -1;
             }
+            if(sr_start_nat(sr) != 0)
+            {
+                fprintf(stderr,"Could not set up NAT\n");
+                return -1;
+            }
             printf(" <-- Ready to process packets --> \n");
             break;
 
@@ -501,8 +537,85 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
+    return ret;
+} /* -- sr_handle_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: Global
+ *
+ * Blocks until at least one whole command is buffered, then handles
+ * every whole command the last recv() brought in, so that under load one
+ * syscall delivers many packets.  Frames go to sr_handlepacket (with -V
+ * to sr_handlepacket_vec, a vector at a time) where they lie in the
+ * buffer, VNS header in front, and nothing is allocated (with -w they
+ * are copied out to the workers instead).
+ * When a particular reply is expected (setting up the session) only that
+ * one command is handled and the rest stays buffered.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    struct sr_rx_buf* rx = &sr->rx;
+    int len, ret;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ( rx->data == 0 && (rx->data = malloc(SR_RX_BUF_SZ)) == 0 )
+    {
+        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        return -1;
+    }
+    if ( sr->vector && rx->vec == 0 &&
+         (rx->vec = calloc(1, sizeof(struct sr_vec))) == 0 )
+    {
+        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        return -1;
+    }
+
+    /*---------------------------------------------------------------------------
+      Read until a whole command is in
+      -------------------------------------------------------------------------*/
+
+    while ( (len = sr_rx_command_len(rx)) == 0 )
+    {
+        if ( (ret = sr_rx_fill(sr)) <= 0 )
+        {
+            if ( ret == 0 )
+            { fprintf(stderr,"VNS server closed connection\n"); }
+            return -1;
+        }
+    }
+
+    /*---------------------------------------------------------------------------
+      Handle it and whatever else came with it.  Whatever they send is
+      written out before the buffer is touched again.
+      -------------------------------------------------------------------------*/
+
+    sr_tx_begin(sr);
+    do
+    {
+        if ( len < 0 )
+        {
+            sr_rx_flush(sr);
+            sr_tx_end(sr);
+            close(sr->sockfd);
+            return -1;
+        }
+
+        ret = sr_handle_command(sr, rx->data + rx->head, len, expected_cmd);
+        rx->head += len;
+
+        if ( ret != 1 || expected_cmd )
+        { break; }
+    } while ( (len = sr_rx_command_len(rx)) != 0 );
+
+    sr_rx_flush(sr);
+    if ( sr_tx_end(sr) != 0 && ret == 1 )
+    { ret = -1; }
+
     return ret;
 }/* -- sr_read_from_server -- */
 
@@ -550,12 +663,146 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_writev(..)
+ * Scope: Local
+ *
+ * Write n iovecs holding frames frames to the server, however many calls
+ * it takes.  Worker threads (-w) and the ARP sweeper send too, so the
+ * whole write is under the send lock, which keeps frames from
+ * interleaving on the stream.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_tx_writev(struct sr_instance* sr, struct iovec* iov, int n,
+                        unsigned int frames)
+{
+    ssize_t ret;
+    int err = 0;
+
+    pthread_mutex_lock(&sr->tx.lock);
+    while ( n > 0 )
+    {
+        sr->tx.writes++;
+        if ( (ret = writev(sr->sockfd, iov, n)) < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            err = -1;
+            break;
+        }
+
+        /* skip what went out, partly written iovec included */
+        while ( n > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if ( n > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    if ( err == 0 )
+    { sr->tx.frames += frames; }
+    pthread_mutex_unlock(&sr->tx.lock);
+    return err;
+} /* -- sr_tx_writev -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_flush(..)
+ * Scope: Local
+ *
+ * Write out every frame queued in the send batch and let go of the
+ * packet buffers they were in.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_tx_flush(struct sr_instance* sr)
+{
+    struct sr_tx_batch* tx = &sr->tx;
+    unsigned int i;
+    int ret = 0;
+
+    if ( tx->n == 0 )
+    { return 0; }
+
+    if ( sr_tx_writev(sr, tx->iov, tx->n, tx->n) != 0 )
+    {
+        fprintf(stderr, "Error writing packet\n");
+        ret = -1;
+    }
+
+    for ( i = 0; i < tx->nheld; i++ )
+    { sr_pbuf_free(tx->held[i]); }
+    tx->nheld = 0;
+    tx->n = 0;
+    return ret;
+} /* -- sr_tx_flush -- */
+
+/* Open a send batch on the calling thread, if batching is on. */
+static void sr_tx_begin(struct sr_instance* sr)
+{
+    struct sr_tx_batch* tx = &sr->tx;
+
+    if ( !tx->enabled )
+    { return; }
+
+    tx->owner = pthread_self();
+    tx->n = 0;
+    tx->nheld = 0;
+    tx->active = 1;
+} /* -- sr_tx_begin -- */
+
+/* Close it, writing out what it holds. */
+static int sr_tx_end(struct sr_instance* sr)
+{
+    if ( !sr->tx.active )
+    { return 0; }
+
+    sr->tx.active = 0;
+    return sr_tx_flush(sr);
+} /* -- sr_tx_end -- */
+
+/* Whether a frame sent now goes into the open batch. */
+static int sr_tx_batching(struct sr_instance* sr)
+{
+    return sr->tx.active && pthread_equal(sr->tx.owner, pthread_self());
+} /* -- sr_tx_batching -- */
+
+/* Queue the frame in pb in the open send batch, holding a reference to
+   it until the batch is written.  The VNS header goes in the headroom. */
+static void sr_tx_queue(struct sr_instance* sr, struct sr_pbuf* pb,
+                        const char* iface)
+{
+    struct sr_tx_batch* tx = &sr->tx;
+    c_packet_header *sr_pkt = (c_packet_header *)(pb->data - sizeof(c_packet_header));
+    unsigned int total_len = pb->len + sizeof(c_packet_header);
+
+    if ( tx->n == SR_TX_BATCH )
+    { sr_tx_flush(sr); }
+
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface,16);
+
+    sr_pbuf_ref(pb);
+    tx->held[tx->nheld++] = pb;
+    tx->iov[tx->n].iov_base = sr_pkt;
+    tx->iov[tx->n].iov_len = total_len;
+    tx->n++;
+} /* -- sr_tx_queue -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
  *
  * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * to be injected onto the wire.  The VNS header is built on the stack and
+ * goes out ahead of buf with one writev(), or buf is copied into a packet
+ * buffer and queued in the open send batch.
  *
  *---------------------------------------------------------------------------*/
 
@@ -564,8 +811,11 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
+    c_packet_header hdr;
+    c_packet_header *sr_pkt = &hdr;
     unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct iovec iov[2];
+    struct sr_pbuf* pb;
 
     /* REQUIRES */
     assert(sr);
@@ -578,35 +828,148 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
+    /* -- log packet -- */
+    sr_log_packet(sr,buf,len);
+
+    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
+        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+        return -1;
+    }
+
+    if ( sr->io )
+    { return sr->io->send(sr, buf, len, iface); }
+
+    if ( sr_tx_batching(sr) )
+    {
+        if ( (pb = sr_pbuf_copy(buf, len)) != 0 )
+        {
+            sr_tx_queue(sr, pb, iface);
+            sr_pbuf_free(pb);
+            return 0;
+        }
+        /* too big for a buffer: write it now, behind what is queued */
+        sr_tx_flush(sr);
+    }
+
     /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
     sr_pkt->mLen  = htonl(total_len);
     sr_pkt->mType = htonl(VNSPACKET);
     strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+
+    iov[0].iov_base = sr_pkt;
+    iov[0].iov_len = sizeof(c_packet_header);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = len;
+
+    if( sr_tx_writev(sr, iov, 2, 1) != 0 ){
+        fprintf(stderr, "Error writing packet\n");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_inplace(..)
+ * Scope: Global
+ *
+ * Same as sr_send_packet but without the copy.  The sizeof(c_packet_header)
+ * bytes in front of buf must be writable and owned by the caller; the VNS
+ * header is built there and the whole thing goes out with one write().
+ * Packets handed to sr_handlepacket always have this headroom since they
+ * sit right behind the header they arrived with.  In a send batch the
+ * frame is only queued, so buf has to stay put until the batch ends, as a
+ * frame in the receive buffer does.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_send_inplace(struct sr_instance* sr, uint8_t* buf,
+                           unsigned int len, const char* iface,
+                           struct sr_pbuf* pb)
+{
+    c_packet_header *sr_pkt;
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct iovec iov;
+    struct sr_tx_batch* tx = &sr->tx;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+
+    if ( len < sizeof(struct sr_ethernet_hdr) ){
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        return -1;
+    }
 
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
+    if ( sr->io )
+    { return sr->io->send(sr, buf, len, iface); }
+
+    if ( pb && sr_tx_batching(sr) )
+    {
+        sr_tx_queue(sr, pb, iface);
+        return 0;
+    }
+
+    sr_pkt = (c_packet_header *)(buf - sizeof(c_packet_header));
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface,16);
+
+    if ( sr_tx_batching(sr) )
+    {
+        if ( tx->n == SR_TX_BATCH )
+        { sr_tx_flush(sr); }
+        tx->iov[tx->n].iov_base = sr_pkt;
+        tx->iov[tx->n].iov_len = total_len;
+        tx->n++;
+        return 0;
+    }
+
+    iov.iov_base = sr_pkt;
+    iov.iov_len = total_len;
+
+    if( sr_tx_writev(sr, &iov, 1, 1) != 0 ){
         fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
         return -1;
     }
 
-    free(sr_pkt);
-
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_send_inplace -- */
+
+int sr_send_packet_inplace(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed, with headroom */ ,
+                         unsigned int len,
+                         const char* iface /* borrowed */)
+{
+    return sr_send_inplace(sr, buf, len, iface, 0);
+} /* -- sr_send_packet_inplace -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_pbuf(..)
+ * Scope: Global
+ *
+ * sr_send_packet_inplace for the frame in a packet buffer, whose headroom
+ * takes the VNS header.  In a send batch the batch holds a reference to
+ * pb until it is written, so the caller frees its own right away either
+ * way.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_pbuf(struct sr_instance* sr /* borrowed */,
+                 struct sr_pbuf* pb /* borrowed */,
+                 const char* iface /* borrowed */)
+{
+    return sr_send_inplace(sr, pb->data, pb->len, iface, pb);
+} /* -- sr_send_pbuf -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -631,8 +994,17 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
     h.caplen = size;
     h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
 
+    if(sr->logq)
+    {
+        sr_dump_async(sr->logq, &h, buf);
+        return;
+    }
+
+    /* -- workers and the ARP thread log too, keep each record whole -- */
+    flockfile(sr->logfile);
     sr_dump(sr->logfile, &h, buf);
     fflush(sr->logfile);
+    funlockfile(sr->logfile);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -642,25 +1014,19 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
  *---------------------------------------------------------------------------*/
 
 int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
+                           struct sr_pkt* pkt)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
-    struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 
-    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    if ( pkt->type != ethertype_arp || pkt->l3 == 0 )
     { return 0; }
 
-    assert(iface);
+    assert(pkt->in);
 
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    a_hdr = (struct sr_arp_hdr*)(pkt->frame + pkt->l3);
 
-    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
-            (a_hdr->ar_op      == htons(arp_op_request))   &&
-            (a_hdr->ar_tip     != iface->ip ) )
+    if ( (a_hdr->ar_op      == htons(arp_op_request))   &&
+            (a_hdr->ar_tip     != pkt->in->ip ) )
     { return 1; }
 
     return 0;